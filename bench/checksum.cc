@@ -0,0 +1,84 @@
+// cost of page checksums: CRC32C of a page, then reads without and with cache hits, verified or not.
+// usage: checksumbench [pages] [rounds]
+#include "checksum.h"
+#include "pagedFile.h"
+#include <chrono>
+#include <filesystem>
+#include <fmt/format.h>
+#include <random>
+
+template <typename F> double nsPerOp(uint64_t ops, F f)
+{
+    auto begin = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double, std::nano> ns = std::chrono::steady_clock::now() - begin;
+    return ns.count() / ops;
+}
+
+int main(int argc, char **argv)
+{
+    using namespace PagedFile;
+    uint32_t pages = argc > 1 ? std::stoul(argv[1]) : CACHESIZE * 2;
+    uint32_t rounds = argc > 2 ? std::stoul(argv[2]) : 3;
+    const char *path = "./checksumbench.bin";
+    std::filesystem::remove(path);
+
+    std::vector<uint8_t> buf(PAGESIZE);
+    std::mt19937 rng(42);
+    for (auto &&b : buf)
+        b = rng();
+    constexpr uint32_t N = 1 << 18;
+    uint32_t sink = 0;
+    fmt::print("crc32c of a page: {:.1f} ns ({}), slice-by-8 {:.1f} ns\n", nsPerOp(N, [&] {
+                   for (uint32_t i = 0; i < N; i++)
+                       sink += crc32c(buf.data(), PAGESIZE, i);
+               }),
+               crc32cHardware() ? "crc32 instruction" : "slice-by-8", nsPerOp(N, [&] {
+                   for (uint32_t i = 0; i < N; i++)
+                       sink += crc32cSoftware(buf.data(), PAGESIZE, i);
+               }));
+
+    FileManager::createFile(path);
+    int fd = FileManager::openFile(path);
+    auto pm = getPageManager();
+    for (uint32_t i = 0; i < pages; i++)
+    {
+        auto p = pm->newPage({fd, i});
+        memcpy(p->_data + sizeof(PageHeader), buf.data(), PAGESIZE - sizeof(PageHeader));
+        p->_data[sizeof(PageHeader)] = i;
+    }
+    auto write = nsPerOp(pages, [&] { pm->flushAllByFd(fd, true); });
+    fmt::print("write back with checksum: {:.0f} ns/page\n", write);
+
+    std::vector<uint32_t> order(pages);
+    for (uint32_t i = 0; i < pages; i++)
+        order[i] = i;
+    std::shuffle(order.begin(), order.end(), rng);
+    auto dst = static_cast<uint8_t *>(aligned_alloc(PAGESIZE, PAGESIZE));
+    uint32_t hot = std::min(pages, CACHESIZE / 2);
+    fmt::print("{:>8} {:>16} {:>16}\n", "verify", "miss ns/page", "hit ns/page");
+    for (uint32_t r = 0; r < rounds; r++)
+    {
+        for (bool verify : {false, true})
+        {
+            pm->setVerify(verify);
+            auto miss = nsPerOp(pages, [&] {
+                for (auto i : order)
+                    pm->readPage({fd, i}, dst), sink += dst[sizeof(PageHeader)];
+            });
+            for (uint32_t i = 0; i < hot; i++)
+                pm->getPage({fd, i});
+            auto hit = nsPerOp(uint64_t(hot) * 16, [&] {
+                for (uint32_t k = 0; k < 16; k++)
+                    for (uint32_t i = 0; i < hot; i++)
+                        sink += pm->getPage({fd, order[i] % hot})->_data[sizeof(PageHeader)];
+            });
+            pm->flushAllByFd(fd, true);
+            fmt::print("{:>8} {:>16.0f} {:>16.1f}\n", verify ? "on" : "off", miss, hit);
+        }
+    }
+    free(dst);
+    FileManager::closeFile(fd, *pm);
+    FileManager::deleteFile(path);
+    return sink == 42; // keep sink alive
+}
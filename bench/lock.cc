@@ -0,0 +1,98 @@
+// lock contention: N writer threads update records of a hot or a cold key range by transactions of a LockedTable.
+// usage: lockbench [max threads] [seconds per run]
+#include "lock.h"
+#include "pagedFile.h"
+#include "record.h"
+#include "wal.h"
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fmt/format.h>
+#include <random>
+#include <thread>
+
+int main(int argc, char **argv)
+{
+    using namespace RecordMgr;
+    uint32_t maxThreads = argc > 1 ? std::stoul(argv[1]) : std::max(1u, std::thread::hardware_concurrency());
+    double seconds = argc > 2 ? std::stod(argv[2]) : 1;
+    const char *path = "./lockbench.bin";
+    const char *logPath = "./lockbench.log";
+    std::filesystem::remove(path);
+    std::filesystem::remove(logPath);
+
+    // records are loaded without a log, every run opens the table again with its own log attached
+    auto rm = RecordFileManager::creatTable(path, {makeColumn("id", ColumnType::INT64),
+                                                   makeColumn("v", ColumnType::INT64)});
+    constexpr uint32_t ROWS = 100000, HOT = 64, WRITES = 4;
+    std::vector<Rid> rids;
+    for (int64_t i = 0; i < ROWS; i++)
+    {
+        int64_t row[2] = {i, 0};
+        rids.push_back(rm.insertRecord(row));
+    }
+    auto pm = rm.getPageManager();
+    RecordFileManager::closeTable(rm);
+    uint64_t increments = 0; // by committed transactions, aborted ones are rolled back
+
+    fmt::print("{:>8} {:>6} {:>12} {:>10} {:>10} {:>12}\n", "threads", "range", "commits/s", "deadlocks", "waits",
+               "escalations");
+    for (uint32_t t = 1; t <= maxThreads; t *= 2)
+    {
+        for (auto range : {HOT, ROWS})
+        {
+            auto log = std::make_unique<PagedFile::LogManager>(logPath);
+            pm->attachLog(log.get());
+            auto rm = RecordFileManager::openTable(path);
+            for (auto &&r : rids)
+                r._fd = rm.getFd();
+            LockManager lm;
+            LockedTable table(rm, lm, *log);
+            std::atomic<bool> stop{false};
+            std::atomic<uint64_t> commits{0};
+            std::vector<std::thread> ts;
+            for (uint32_t i = 0; i < t; i++)
+            {
+                ts.emplace_back([&, i] {
+                    std::mt19937 rng(i);
+                    while (not stop)
+                    {
+                        bool ok = true;
+                        for (uint32_t w = 0; w < WRITES and ok; w++)
+                        {
+                            auto r = rids[rng() % range];
+                            int64_t row[2];
+                            ok = table.read(r, row) and (row[1]++, table.update(r, row));
+                        }
+                        if (ok)
+                            table.commit();
+                        else
+                            table.abort(); // a victim retries as a new transaction
+                        commits += ok;
+                    }
+                });
+            }
+            std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+            stop = true;
+            for (auto &&th : ts)
+                th.join();
+            increments += commits * WRITES;
+            uint64_t sum = 0;
+            for (auto it = rm.cbegin(); it != rm.cend(); ++it)
+                sum += reinterpret_cast<const int64_t *>(*it)[1];
+            if (sum != increments)
+            {
+                fmt::print(stderr, "records have {} increments, {} were committed\n", sum, increments);
+                return 1;
+            }
+            RecordFileManager::closeTable(rm);
+            pm->attachLog(nullptr);
+            log.reset();
+            std::filesystem::remove(logPath);
+            fmt::print("{:>8} {:>6} {:>12.0f} {:>10} {:>10} {:>12}\n", t, range == HOT ? "hot" : "cold",
+                       commits / seconds, lm.deadlocks(), lm.waits(), lm.escalations());
+        }
+    }
+    RecordFileManager::deleteTable(path);
+    return 0;
+}
@@ -0,0 +1,309 @@
+// microbenchmarks of the page cache, bitmaps and records, by google-benchmark.
+// Results are also written to sqlightbench.json unless --benchmark_out is given, compare two runs by
+// tools/compare.py of google-benchmark.
+// usage: sqlightbench [google-benchmark flags]
+#include "bitwise.h"
+#include "pagedFile.h"
+#include "record.h"
+#include <benchmark/benchmark.h>
+#include <filesystem>
+#include <random>
+#include <string>
+
+using namespace PagedFile;
+using namespace RecordMgr;
+
+namespace
+{
+
+constexpr uint32_t POOLPAGES = 256; // pages of the pools for misses and eviction
+
+constexpr uint32_t RECORDSIZE = 64;
+
+/**
+ * @brief a file of pages written back, none of them is cached.
+ */
+int makeFile(const char *path, uint32_t pages, PageManager *pm)
+{
+    std::filesystem::remove(path);
+    FileManager::createFile(path);
+    int fd = FileManager::openFile(path);
+    for (uint32_t i = 0; i < pages; i++)
+        pm->newPage({fd, i})->_data[sizeof(PageHeader)] = i;
+    pm->flushAllByFd(fd, true);
+    return fd;
+}
+
+void dropFile(const char *path, int fd, PageManager *pm)
+{
+    pm->discardAllByFd(fd);
+    FileManager::closeFile(fd, *pm);
+    FileManager::deleteFile(path);
+}
+
+PageManager *pool(const char *name)
+{
+    auto pm = getPool(name);
+    return pm ? pm : createPool(name, POOLPAGES);
+}
+
+RecordManager makeTable(const char *path, uint32_t rows, std::vector<Rid> &rids)
+{
+    std::filesystem::remove(path);
+    auto rm = RecordFileManager::creatTable(path, RECORDSIZE);
+    uint8_t rec[RECORDSIZE] = {};
+    for (uint32_t i = 0; i < rows; i++)
+    {
+        memcpy(rec, &i, sizeof(i));
+        rids.push_back(rm.insertRecord(rec));
+    }
+    return rm;
+}
+
+void getPageHit(benchmark::State &state)
+{
+    auto pm = getPageManager();
+    uint32_t pages = state.range(0);
+    int fd = makeFile("./bench-hit.bin", pages, pm);
+    pm->prefetch(fd, 0, pages);
+    uint32_t i = 0;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(pm->getPage({fd, i})->_data[sizeof(PageHeader)]);
+        i = i + 1 == pages ? 0 : i + 1;
+    }
+    state.SetItemsProcessed(state.iterations());
+    dropFile("./bench-hit.bin", fd, pm);
+}
+BENCHMARK(getPageHit)->Arg(64)->Arg(4096);
+
+void getPageMiss(benchmark::State &state)
+{
+    auto pm = pool("bench-miss");
+    uint32_t pages = POOLPAGES * 16;
+    int fd = makeFile("./bench-miss.bin", pages, pm);
+    std::mt19937 rng(42);
+    for (auto _ : state)
+        benchmark::DoNotOptimize(pm->getPage({fd, uint32_t(rng() % pages)})->_data[sizeof(PageHeader)]);
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * PAGESIZE);
+    dropFile("./bench-miss.bin", fd, pm);
+}
+BENCHMARK(getPageMiss);
+
+// every new page evicts a dirty page, which is written back
+void eviction(benchmark::State &state)
+{
+    auto pm = pool("bench-evict");
+    uint32_t pages = POOLPAGES * 16;
+    int fd = makeFile("./bench-evict.bin", 0, pm);
+    uint32_t i = 0;
+    for (auto _ : state)
+    {
+        pm->newPage({fd, i})->_data[sizeof(PageHeader)] = i;
+        i = i + 1 == pages ? 0 : i + 1;
+    }
+    state.SetItemsProcessed(state.iterations());
+    dropFile("./bench-evict.bin", fd, pm);
+}
+BENCHMARK(eviction);
+
+// the first zero bit is after state.range(0) ones
+void bitMapNextBit(benchmark::State &state)
+{
+    uint8_t data[64] = {};
+    BitMap bm(data, sizeof(data));
+    for (int64_t i = 0; i < state.range(0); i++)
+        bm.set(i);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(data);
+        benchmark::DoNotOptimize(bm.nextBit(0, false));
+    }
+}
+BENCHMARK(bitMapNextBit)->Arg(0)->Arg(63)->Arg(511);
+
+void bitMapCount(benchmark::State &state)
+{
+    std::vector<uint8_t> data(state.range(0));
+    std::mt19937 rng(42);
+    for (auto &&b : data)
+        b = rng();
+    BitMap bm(data.data(), data.size());
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(data.data());
+        benchmark::DoNotOptimize(bm.count(0, true));
+    }
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(bitMapCount)->Arg(8)->Arg(64)->Arg(512);
+
+void insertSequential(benchmark::State &state)
+{
+    std::vector<Rid> rids;
+    auto rm = makeTable("./bench-insert.bin", 0, rids);
+    uint8_t rec[RECORDSIZE] = {};
+    for (auto _ : state)
+        benchmark::DoNotOptimize(rm.insertRecord(rec));
+    state.SetItemsProcessed(state.iterations());
+    RecordFileManager::dropTable(rm);
+}
+BENCHMARK(insertSequential);
+
+// inserts fill holes of every other slot, which are made again when they are filled
+void insertFragmented(benchmark::State &state)
+{
+    std::vector<Rid> rids, holes;
+    auto rm = makeTable("./bench-fragmented.bin", state.range(0), rids);
+    for (size_t i = 0; i < rids.size(); i += 2)
+        rm.deleteRecord(rids[i]);
+    uint8_t rec[RECORDSIZE] = {};
+    for (auto _ : state)
+    {
+        holes.push_back(rm.insertRecord(rec));
+        if (holes.size() * 2 >= rids.size())
+        {
+            state.PauseTiming();
+            for (auto &&r : holes)
+                rm.deleteRecord(r);
+            holes.clear();
+            state.ResumeTiming();
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+    RecordFileManager::dropTable(rm);
+}
+BENCHMARK(insertFragmented)->Arg(100000);
+
+void scan(benchmark::State &state)
+{
+    std::vector<Rid> rids;
+    auto rm = makeTable("./bench-scan.bin", state.range(0), rids);
+    for (auto _ : state)
+    {
+        uint64_t sum = 0;
+        for (auto it = rm.cbegin(); it != rm.cend(); ++it)
+            sum += *reinterpret_cast<const uint32_t *>(*it);
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    RecordFileManager::dropTable(rm);
+}
+BENCHMARK(scan)->Arg(10000)->Arg(1000000);
+
+void update(benchmark::State &state)
+{
+    std::vector<Rid> rids;
+    auto rm = makeTable("./bench-update.bin", state.range(0), rids);
+    std::mt19937 rng(42);
+    uint8_t rec[RECORDSIZE] = {};
+    for (auto _ : state)
+        rm.updateRecord(rids[rng() % rids.size()], rec);
+    state.SetItemsProcessed(state.iterations());
+    RecordFileManager::dropTable(rm);
+}
+BENCHMARK(update)->Arg(100000);
+
+// copies of random records, arg 0 copies to the heap by make_unique, arg 1 to the arena of the thread
+void getRecord(benchmark::State &state)
+{
+    std::vector<Rid> rids;
+    auto rm = makeTable("./bench-get.bin", 100000, rids);
+    std::mt19937 rng(42);
+    for (auto _ : state)
+    {
+        auto r = rids[rng() % rids.size()];
+        if (state.range(0) == 0)
+        {
+            auto copy = rm.getRecord(r);
+            benchmark::DoNotOptimize(copy.get());
+        }
+        else
+        {
+            ArenaScope scope;
+            benchmark::DoNotOptimize(rm.getRecord(r, scope.arena()));
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+    RecordFileManager::dropTable(rm);
+}
+BENCHMARK(getRecord)->Arg(0)->Arg(1);
+
+// 4096 random records with pages of the table out of the pool,
+// arg 0 gets them one by one by getRecord, arg 1 by one getRecords
+void getRecords(benchmark::State &state)
+{
+    std::vector<Rid> rids;
+    auto rm = makeTable("./bench-multiget.bin", 100000, rids);
+    std::mt19937 rng(42);
+    std::vector<Rid> want(4096);
+    std::vector<uint8_t> out(want.size() * RECORDSIZE);
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        for (auto &&r : want)
+            r = rids[rng() % rids.size()];
+        rm.getPageManager()->flushAllByFd(rm.getFd(), true);
+        state.ResumeTiming();
+        if (state.range(0) == 0)
+        {
+            ArenaScope scope;
+            for (auto &&r : want)
+                benchmark::DoNotOptimize(rm.getRecord(r, scope.arena()));
+        }
+        else
+            benchmark::DoNotOptimize(rm.getRecords(want.data(), want.size(), out.data()));
+    }
+    state.SetItemsProcessed(state.iterations() * want.size());
+    RecordFileManager::dropTable(rm);
+}
+BENCHMARK(getRecords)->Arg(0)->Arg(1);
+
+// records are deleted in random order, then inserted again when all of them are gone
+void remove(benchmark::State &state)
+{
+    std::vector<Rid> rids;
+    auto rm = makeTable("./bench-delete.bin", state.range(0), rids);
+    std::mt19937 rng(42);
+    std::shuffle(rids.begin(), rids.end(), rng);
+    uint8_t rec[RECORDSIZE] = {};
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        rm.deleteRecord(rids[i++]);
+        if (i == rids.size())
+        {
+            state.PauseTiming();
+            for (auto &&r : rids)
+                r = rm.insertRecord(rec);
+            std::shuffle(rids.begin(), rids.end(), rng);
+            i = 0;
+            state.ResumeTiming();
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+    RecordFileManager::dropTable(rm);
+}
+BENCHMARK(remove)->Arg(100000);
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    std::vector<char *> args(argv, argv + argc);
+    std::string out = "--benchmark_out=sqlightbench.json", format = "--benchmark_out_format=json";
+    auto isOut = [](char *a) { return std::string_view(a).rfind("--benchmark_out=", 0) == 0; };
+    if (std::none_of(args.begin(), args.end(), isOut))
+    {
+        args.push_back(out.data());
+        args.push_back(format.data());
+    }
+    int n = args.size();
+    benchmark::Initialize(&n, args.data());
+    if (benchmark::ReportUnrecognizedArguments(n, args.data()))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,74 @@
+// recovery throughput: redo a log of updates after a crash, by 1, 2, 4 ... threads.
+// usage: recoverybench [log size in MiB] [max threads]
+#include "pagedFile.h"
+#include "record.h"
+#include "recovery.h"
+#include "wal.h"
+#include <chrono>
+#include <filesystem>
+#include <fmt/format.h>
+#include <random>
+
+int main(int argc, char **argv)
+{
+    using namespace RecordMgr;
+    uint64_t logSize = (argc > 1 ? std::stoull(argv[1]) : 256) << 20;
+    uint32_t maxThreads = argc > 2 ? std::stoul(argv[2]) : std::max(1u, std::thread::hardware_concurrency());
+    const char *path = "./recoverybench.bin";
+    const char *logPath = "./recoverybench.log";
+    namespace fs = std::filesystem;
+    fs::remove(path), fs::remove(logPath);
+
+    auto pm = PagedFile::getPageManager();
+    auto log = std::make_unique<PagedFile::LogManager>(logPath);
+    pm->attachLog(log.get());
+    auto rm = RecordFileManager::creatTable(path, {makeColumn("id", ColumnType::INT64),
+                                                   makeColumn("payload", ColumnType::CHAR, 92)});
+    constexpr uint32_t ROWS = 100000;
+    std::vector<Rid> rids;
+    uint8_t row[100] = {};
+    for (uint64_t i = 0; i < ROWS; i++)
+    {
+        memcpy(row, &i, sizeof(i));
+        rids.push_back(rm.insertRecord(row));
+    }
+    std::mt19937_64 rng(42);
+    while (log->nextLsn() < logSize)
+    {
+        auto i = rng() % ROWS;
+        memcpy(row, &i, sizeof(i));
+        row[8 + rng() % 92]++;
+        rm.updateRecord(rids[i], row);
+    }
+    log->flush();
+    // crash, nothing of the table is written back
+    pm->discardAllByFd(rm.getFd());
+    RecordFileManager::closeTable(rm);
+    pm->attachLog(nullptr);
+    log.reset();
+    fs::copy_file(path, std::string(path) + ".orig", fs::copy_options::overwrite_existing);
+    fs::copy_file(logPath, std::string(logPath) + ".orig", fs::copy_options::overwrite_existing);
+
+    fmt::print("{:>8} {:>10} {:>12} {:>10} {:>10} {:>14}\n", "threads", "log MiB", "records", "seconds", "MiB/s",
+               "records/s");
+    for (uint32_t t = 1; t <= maxThreads; t *= 2)
+    {
+        fs::copy_file(std::string(path) + ".orig", path, fs::copy_options::overwrite_existing);
+        fs::copy_file(std::string(logPath) + ".orig", logPath, fs::copy_options::overwrite_existing);
+        log = std::make_unique<PagedFile::LogManager>(logPath);
+        auto size = log->nextLsn() - log->firstLsn();
+        pm->attachLog(log.get());
+        auto begin = std::chrono::steady_clock::now();
+        auto st = recover(*log, pm, t);
+        std::chrono::duration<double> sec = std::chrono::steady_clock::now() - begin;
+        fmt::print("{:>8} {:>10.1f} {:>12} {:>10.3f} {:>10.1f} {:>14.0f}\n", t, size / 1048576.0, st._records,
+                   sec.count(), size / 1048576.0 / sec.count(), st._records / sec.count());
+        auto fd = PagedFile::FileManager::getFdByPath(PagedFile::FileManager::isFile(path));
+        PagedFile::FileManager::closeFile(fd, *pm);
+        pm->attachLog(nullptr);
+        log.reset();
+    }
+    for (auto p : {std::string(path), std::string(logPath)})
+        fs::remove(p), fs::remove(p + ".orig");
+    return 0;
+}
@@ -0,0 +1,69 @@
+// sqlightd throughput: clients read random records through a server in this process, with requests pipelined
+// to different depths.
+// usage: serverbench [clients] [seconds per run]
+#include "server.h"
+#include <atomic>
+#include <chrono>
+#include <fmt/format.h>
+#include <random>
+#include <thread>
+
+int main(int argc, char **argv)
+{
+    using namespace Server;
+    uint32_t clients = argc > 1 ? std::stoul(argv[1]) : std::max(1u, std::thread::hardware_concurrency());
+    double seconds = argc > 2 ? std::stod(argv[2]) : 1;
+    const char *sock = "./serverbench.sock", *path = ":memory:serverbench";
+
+    constexpr uint32_t ROWS = 100000, SIZE = 64;
+    auto rm = RecordMgr::RecordFileManager::creatTable(path, SIZE);
+    std::vector<WireRid> rids;
+    uint8_t row[SIZE] = {};
+    for (uint32_t i = 0; i < ROWS; i++)
+    {
+        auto r = rm.insertRecord(row);
+        rids.push_back({r._page, r._slot});
+    }
+    RecordMgr::RecordFileManager::closeTable(rm);
+
+    Server::Server server(sock);
+    std::thread loop([&] { server.run(); });
+
+    fmt::print("{:>8} {:>6} {:>12}\n", "clients", "depth", "gets/s");
+    for (uint32_t depth : {1, 16, 256})
+    {
+        std::atomic<bool> stop{false};
+        std::atomic<uint64_t> gets{0};
+        std::vector<std::thread> ts;
+        for (uint32_t c = 0; c < clients; c++)
+        {
+            ts.emplace_back([&, c] {
+                Client client(sock);
+                auto t = client.open(path);
+                std::mt19937 rng(c);
+                Client::Response r;
+                uint64_t n = 0;
+                while (not stop)
+                {
+                    for (uint32_t i = 0; i < depth; i++)
+                        client.send(Op::GET, t, &rids[rng() % ROWS], sizeof(WireRid));
+                    for (uint32_t i = 0; i < depth; i++)
+                        client.receive(r);
+                    n += depth;
+                }
+                gets += n;
+            });
+        }
+        std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+        stop = true;
+        for (auto &&t : ts)
+            t.join();
+        fmt::print("{:>8} {:>6} {:>12.0f}\n", clients, depth, gets / seconds);
+    }
+
+    server.stop();
+    loop.join();
+    rm = RecordMgr::RecordFileManager::openTable(path);
+    RecordMgr::RecordFileManager::dropTable(rm);
+    return 0;
+}
@@ -0,0 +1,297 @@
+// YCSB core workloads A-F on a table through RecordManager, by N threads.
+// A: 50% read 50% update, B: 95% read 5% update, C: read only, D: 95% read 5% insert of latest keys,
+// E: 95% short scan 5% insert, F: 50% read 50% read-modify-write.
+// usage: ycsbbench [workload] [threads] [records] [operations] [distribution: uniform | zipfian | latest]
+#include "histogram.h"
+#include "pagedFile.h"
+#include "record.h"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fmt/format.h>
+#include <random>
+#include <string>
+#include <thread>
+
+using namespace RecordMgr;
+
+namespace
+{
+
+constexpr uint32_t ROWSIZE = 100; // a key and a payload
+
+constexpr uint32_t MAXSCAN = 100; // length of a scan is uniform in [1, MAXSCAN]
+
+constexpr double ZIPFTHETA = 0.99; // skew of zipfian keys, as YCSB
+
+enum Op
+{
+    READ,
+    UPDATE,
+    INSERT,
+    SCAN,
+    RMW,
+    OPS
+};
+
+constexpr const char *OPNAMES[OPS] = {"read", "update", "insert", "scan", "rmw"};
+
+struct Workload
+{
+    double _mix[OPS]; // proportion of each op
+    const char *_distribution;
+};
+
+Workload workloadOf(char w)
+{
+    switch (w)
+    {
+    case 'A':
+        return {{0.5, 0.5, 0, 0, 0}, "zipfian"};
+    case 'B':
+        return {{0.95, 0.05, 0, 0, 0}, "zipfian"};
+    case 'C':
+        return {{1, 0, 0, 0, 0}, "zipfian"};
+    case 'D':
+        return {{0.95, 0, 0.05, 0, 0}, "latest"};
+    case 'E':
+        return {{0, 0, 0.05, 0.95, 0}, "zipfian"};
+    case 'F':
+        return {{0.5, 0, 0, 0, 0.5}, "zipfian"};
+    }
+    fmt::print(stderr, "unknown workload {}\n", w);
+    std::exit(1);
+}
+
+/**
+ * @brief zipfian ranks in [0, n), rank 0 is the most popular. By Gray et al., "Quickly generating
+ * billion-record synthetic databases", as the ZipfianGenerator of YCSB.
+ */
+class Zipfian
+{
+  private:
+    uint64_t _n;
+    double _alpha, _zetan, _eta, _half;
+
+    static double zeta(uint64_t n, double theta)
+    {
+        double sum = 0;
+        for (uint64_t i = 1; i <= n; i++)
+            sum += 1 / std::pow(double(i), theta);
+        return sum;
+    }
+
+  public:
+    explicit Zipfian(uint64_t n) : _n(n)
+    {
+        double zeta2 = zeta(2, ZIPFTHETA);
+        _zetan = zeta(n, ZIPFTHETA);
+        _alpha = 1 / (1 - ZIPFTHETA);
+        _eta = (1 - std::pow(2.0 / n, 1 - ZIPFTHETA)) / (1 - zeta2 / _zetan);
+        _half = 1 + std::pow(0.5, ZIPFTHETA);
+    }
+
+    uint64_t next(std::mt19937_64 &rng) const
+    {
+        double u = std::uniform_real_distribution<double>(0, 1)(rng);
+        double uz = u * _zetan;
+        if (uz < 1)
+            return 0;
+        if (uz < _half)
+            return 1;
+        return std::min<uint64_t>(_n - 1, _n * std::pow(_eta * u - _eta + 1, _alpha));
+    }
+};
+
+/**
+ * @brief FNV-1a of a rank, so popular keys are spread over the table as YCSB does
+ */
+uint64_t scramble(uint64_t v)
+{
+    uint64_t h = 0xcbf29ce484222325;
+    for (int i = 0; i < 8; i++, v >>= 8)
+        h = (h ^ (v & 0xff)) * 0x100000001b3;
+    return h;
+}
+
+/**
+ * @brief rids of keys, a key is ready when its insert is done
+ */
+class KeyMap
+{
+  private:
+    std::unique_ptr<std::atomic<uint64_t>[]> _rids; // page << 32 | slot, 0 if not ready
+    std::atomic<uint64_t> _count{0};                // keys taken by inserts
+    int _fd;
+
+  public:
+    KeyMap(uint64_t capacity, int fd) : _rids(new std::atomic<uint64_t>[capacity] {}), _fd(fd)
+    {
+    }
+
+    uint64_t take()
+    {
+        return _count.fetch_add(1);
+    }
+
+    uint64_t count() const
+    {
+        return _count.load(std::memory_order_acquire);
+    }
+
+    void put(uint64_t key, Rid r)
+    {
+        _rids[key].store(uint64_t(r._page) << 32 | r._slot, std::memory_order_release);
+    }
+
+    /**
+     * @brief rid of key, or of the nearest ready key before it
+     */
+    Rid get(uint64_t key) const
+    {
+        uint64_t v;
+        while ((v = _rids[key].load(std::memory_order_acquire)) == 0)
+            key--;
+        return {_fd, uint32_t(v >> 32), uint32_t(v)};
+    }
+};
+
+struct Worker
+{
+    Histogram _latency[OPS];
+    uint64_t _ops = 0;
+};
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    char workload = argc > 1 ? std::toupper(argv[1][0]) : 'A';
+    uint32_t threads = argc > 2 ? std::stoul(argv[2]) : std::max(1u, std::thread::hardware_concurrency());
+    uint64_t records = argc > 3 ? std::stoull(argv[3]) : 1000000;
+    uint64_t operations = argc > 4 ? std::stoull(argv[4]) : 1000000;
+    auto w = workloadOf(workload);
+    std::string distribution = argc > 5 ? argv[5] : w._distribution;
+    if (records == 0 or threads == 0) // keys are drawn from [0, records)
+    {
+        fmt::print(stderr, "threads and records should be positive\n");
+        return 1;
+    }
+    const char *path = "./ycsbbench.bin";
+    std::filesystem::remove(path);
+
+    auto rm = RecordFileManager::creatTable(path, {makeColumn("key", ColumnType::INT64),
+                                                   makeColumn("payload", ColumnType::CHAR, ROWSIZE - 8)});
+    KeyMap keys(records + operations + 1, rm.getFd());
+    uint8_t row[ROWSIZE] = {};
+    auto begin = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < records; i++)
+    {
+        auto k = keys.take();
+        memcpy(row, &k, sizeof(k));
+        keys.put(k, rm.insertRecord(row));
+    }
+    std::chrono::duration<double> load = std::chrono::steady_clock::now() - begin;
+    fmt::print("workload {}, {} threads, {} records loaded in {:.2f} s, {} operations, {} keys\n", workload, threads,
+               records, load.count(), operations, distribution);
+
+    Zipfian zipf(records);
+    auto pm = rm.getPageManager();
+    pm->resetStats();
+    std::vector<Worker> workers(threads);
+    std::vector<std::thread> pool;
+    begin = std::chrono::steady_clock::now();
+    for (uint32_t t = 0; t < threads; t++)
+    {
+        pool.emplace_back([&, t] {
+            auto &me = workers[t];
+            std::mt19937_64 rng(t + 1);
+            std::uniform_real_distribution<double> coin(0, 1);
+            uint8_t buf[ROWSIZE] = {};
+            auto nextKey = [&] {
+                auto n = keys.count();
+                if (distribution == "uniform")
+                    return rng() % n;
+                if (distribution == "latest")
+                    return n - 1 - std::min(n - 1, zipf.next(rng));
+                return scramble(zipf.next(rng)) % n;
+            };
+            for (uint64_t i = t; i < operations; i += threads)
+            {
+                double c = coin(rng);
+                int op = 0;
+                while (op + 1 < OPS and c >= w._mix[op])
+                    c -= w._mix[op++];
+                auto start = std::chrono::steady_clock::now();
+                switch (op)
+                {
+                case READ: {
+                    ArenaScope scope;
+                    rm.getRecord(keys.get(nextKey()), scope.arena());
+                    break;
+                }
+                case UPDATE:
+                    buf[8 + rng() % (ROWSIZE - 8)]++;
+                    rm.updateRecord(keys.get(nextKey()), buf);
+                    break;
+                case INSERT: {
+                    auto k = keys.take();
+                    memcpy(buf, &k, sizeof(k));
+                    keys.put(k, rm.insertRecord(buf));
+                    break;
+                }
+                case SCAN: {
+                    uint32_t len = 1 + rng() % MAXSCAN;
+                    std::lock_guard<std::recursive_mutex> lk(pm->latch()); // pages of an iterator stay
+                    auto it = RecordManager::Iterator(&rm, keys.get(nextKey()));
+                    for (uint32_t n = 0; n < len and it != rm.cend(); n++, ++it)
+                        memcpy(buf, *it, ROWSIZE);
+                    break;
+                }
+                case RMW: {
+                    auto r = keys.get(nextKey());
+                    {
+                        ArenaScope scope;
+                        memcpy(buf, rm.getRecord(r, scope.arena()), ROWSIZE);
+                    }
+                    buf[8 + rng() % (ROWSIZE - 8)]++;
+                    rm.updateRecord(r, buf);
+                    break;
+                }
+                }
+                std::chrono::nanoseconds ns = std::chrono::steady_clock::now() - start;
+                me._latency[op].record(ns.count());
+                me._ops++;
+            }
+        });
+    }
+    for (auto &&t : pool)
+        t.join();
+    std::chrono::duration<double> run = std::chrono::steady_clock::now() - begin;
+
+    Histogram all[OPS];
+    for (auto &&me : workers)
+    {
+        for (int op = 0; op < OPS; op++)
+            all[op].merge(me._latency[op]);
+    }
+    fmt::print("throughput: {:.0f} ops/s in {:.2f} s\n", operations / run.count(), run.count());
+    fmt::print("{:>8} {:>10} {:>10} {:>10} {:>10} {:>10} {:>10}\n", "op", "count", "mean us", "p50 us", "p99 us",
+               "p999 us", "max us");
+    for (int op = 0; op < OPS; op++)
+    {
+        auto &h = all[op];
+        if (h.count() == 0)
+            continue;
+        fmt::print("{:>8} {:>10} {:>10.1f} {:>10.1f} {:>10.1f} {:>10.1f} {:>10.1f}\n", OPNAMES[op], h.count(),
+                   h.mean() / 1e3, h.percentile(0.5) / 1e3, h.percentile(0.99) / 1e3, h.percentile(0.999) / 1e3,
+                   h.max() / 1e3);
+    }
+    auto st = pm->stats();
+    fmt::print("buffer pool: {} / {} pages cached, {} hits, {} misses, hit ratio {:.4f}, {} evictions, {} writes\n",
+               pm->cached(), pm->capacity(), st._hits, st._misses,
+               st._hits + st._misses ? double(st._hits) / (st._hits + st._misses) : 0.0, st._evictions, st._writes);
+    RecordFileManager::dropTable(rm);
+    return 0;
+}
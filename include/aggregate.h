@@ -0,0 +1,470 @@
+#if !defined(__SQLIGHT_AGGREGATE__)
+#define __SQLIGHT_AGGREGATE__
+
+#include "exec.h"
+#include "record.h"
+#include <atomic>
+#include <mutex>
+#include <robin_hood.h>
+#include <thread>
+
+namespace Exec
+{
+
+constexpr size_t AGGMEMORY = 64 << 20; // default memory budget of groups of a hash aggregation in bytes
+
+constexpr uint32_t AGGPARTITIONS = 32; // partitions of merge phase
+
+constexpr uint32_t AGGMORSEL = 32; // pages scanned by a worker at a time
+
+/**
+ * @brief call f(record) for every record in pages [first, last] of a table.
+ * Pages are copied by PageManager::readPage, so it could be called by many threads.
+ * @param buf a buffer of PAGESIZE aligned to PAGESIZE
+ */
+template <typename F>
+inline void scanPages(const RecordMgr::RecordManager &rm, uint32_t first, uint32_t last, uint8_t *buf, F &&f)
+{
+    auto &th = rm.getTableHeader();
+    for (auto p = first; p <= last; p++)
+    {
+        if (rm.isZonePage(p))
+            continue;
+        rm.getPageManager()->readPage({rm.getFd(), p}, buf);
+        auto bitmap = buf + sizeof(PageHeader);
+        auto base = rm.getSlotBase(buf);
+        for (uint32_t i = 0; i < th._slotsPerPage; i++)
+        {
+            if (bitmap[i / BYTEINBITS] & (MSB >> (i % BYTEINBITS)))
+                f(base + size_t(i) * th._recordSize);
+        }
+    }
+}
+
+inline void aggMerge(AggFunc f, AggState &a, const AggState &b)
+{
+    a._count += b._count;
+    switch (f)
+    {
+    case AggFunc::MIN:
+        a._i = std::min(a._i, b._i);
+        a._f = std::min(a._f, b._f);
+        break;
+    case AggFunc::MAX:
+        a._i = std::max(a._i, b._i);
+        a._f = std::max(a._f, b._f);
+        break;
+    default:
+        a._i += b._i;
+        a._f += b._f;
+    }
+}
+
+/**
+ * @brief fold one value of column c of a record into a state
+ */
+inline void aggUpdateRow(AggFunc f, const Column &c, const uint8_t *record, AggState &s)
+{
+    s._count++;
+    if (f == AggFunc::COUNT)
+        return;
+    auto v = record + c._offset;
+    if (c._type == ColumnType::FLOAT64)
+    {
+        double x;
+        memcpy(&x, v, sizeof(x));
+        s._f = f == AggFunc::MIN ? std::min(s._f, x) : (f == AggFunc::MAX ? std::max(s._f, x) : s._f + x);
+        return;
+    }
+    int64_t x;
+    if (c._type == ColumnType::INT32)
+    {
+        int32_t y;
+        memcpy(&y, v, sizeof(y));
+        x = y;
+    }
+    else
+    {
+        memcpy(&x, v, sizeof(x));
+    }
+    s._i = f == AggFunc::MIN ? std::min(s._i, x) : (f == AggFunc::MAX ? std::max(s._i, x) : s._i + x);
+}
+
+/**
+ * @brief open addressing hash table from a fixed width key to aggregate states.
+ * A group is key bytes followed by states of all aggregates.
+ */
+class GroupTable
+{
+  private:
+    uint32_t _keySize;
+    uint32_t _keyArea; // key bytes aligned for states
+    const std::vector<AggSpec> *_aggs;
+    size_t _groupSize;
+    std::vector<uint8_t> _groups;
+    std::vector<uint64_t> _hashes;
+    std::vector<uint32_t> _slots; // group index + 1, 0 for empty
+    size_t _mask = 0;
+    uint32_t _count = 0;
+
+    void grow()
+    {
+        size_t cap = _slots.empty() ? 64 : _slots.size() * 2;
+        _slots.assign(cap, 0);
+        _mask = cap - 1;
+        for (uint32_t g = 0; g < _count; g++)
+        {
+            auto pos = _hashes[g] & _mask;
+            while (_slots[pos] != 0)
+                pos = (pos + 1) & _mask;
+            _slots[pos] = g + 1;
+        }
+    }
+
+  public:
+    GroupTable(uint32_t keySize, const std::vector<AggSpec> *aggs)
+        : _keySize(keySize), _keyArea(ceil(keySize, alignof(AggState)) * alignof(AggState)), _aggs(aggs),
+          _groupSize(_keyArea + aggs->size() * sizeof(AggState))
+    {
+        grow();
+    }
+
+    static uint64_t hash(const uint8_t *key, uint32_t keySize)
+    {
+        return robin_hood::hash_bytes(key, keySize);
+    }
+
+    /**
+     * @brief states of the group of key, a new group is initialized.
+     */
+    AggState *find(const uint8_t *key, uint64_t h)
+    {
+        auto pos = h & _mask;
+        while (_slots[pos] != 0)
+        {
+            auto g = _slots[pos] - 1;
+            if (_hashes[g] == h and memcmp(group(g), key, _keySize) == 0)
+                return states(g);
+            pos = (pos + 1) & _mask;
+        }
+        auto g = _count++;
+        _slots[pos] = g + 1;
+        _hashes.push_back(h);
+        _groups.resize(_groups.size() + _groupSize);
+        memcpy(group(g), key, _keySize);
+        auto s = states(g);
+        for (size_t i = 0; i < _aggs->size(); i++)
+        {
+            new (s + i) AggState();
+            aggInit((*_aggs)[i]._func, s[i]);
+        }
+        if (_count * 2 > _slots.size())
+            grow();
+        return s;
+    }
+
+    /**
+     * @brief merge states of a group into the group of the same key, the group may be unaligned.
+     */
+    void merge(const uint8_t *group, uint64_t h)
+    {
+        auto s = find(group, h);
+        for (size_t i = 0; i < _aggs->size(); i++)
+        {
+            AggState other;
+            memcpy(&other, group + _keyArea + i * sizeof(AggState), sizeof(AggState));
+            aggMerge((*_aggs)[i]._func, s[i], other);
+        }
+    }
+
+    uint8_t *group(uint32_t g)
+    {
+        return _groups.data() + g * _groupSize;
+    }
+
+    AggState *states(uint32_t g)
+    {
+        return reinterpret_cast<AggState *>(group(g) + _keyArea);
+    }
+
+    uint64_t hashOf(uint32_t g) const
+    {
+        return _hashes[g];
+    }
+
+    uint32_t size() const
+    {
+        return _count;
+    }
+
+    size_t groupSize() const
+    {
+        return _groupSize;
+    }
+
+    /**
+     * @brief memory used in bytes
+     */
+    size_t memory() const
+    {
+        return _groups.capacity() + _hashes.capacity() * sizeof(uint64_t) + _slots.size() * sizeof(uint32_t);
+    }
+
+    void clear()
+    {
+        _groups.clear();
+        _hashes.clear();
+        _count = 0;
+        _slots.clear();
+        grow();
+    }
+};
+
+/**
+ * @brief GROUP BY of a table, COUNT / SUM / MIN / MAX / AVG over fixed width columns.
+ * Pages are scanned by worker threads, every worker pre-aggregates into its own tables, one for a partition
+ * of keys. If groups of a worker exceed its memory budget, they are spilled to a temporary table of the
+ * partition. Then partitions are merged as they are output, by workers in parallel a few at a time, and tables
+ * of a partition are freed once it is merged, so all groups are never in memory at once.
+ * Output columns are key columns then aggregates.
+ */
+class HashAggregateOp : public Operator
+{
+  private:
+    const RecordMgr::RecordManager *_rm;
+    std::vector<Column> _keys;
+    std::vector<Column> _inputs; // input column of every aggregate
+    std::vector<AggSpec> _aggs;
+    uint32_t _keySize = 0;
+    size_t _memory;
+    uint32_t _threads;
+
+    std::vector<Column> _schema;
+    std::vector<std::unique_ptr<Vector>> _vecs;
+    Batch _batch;
+
+    bool _done = false;
+    std::vector<std::vector<std::unique_ptr<GroupTable>>> _locals; // pre-aggregated tables of workers by partition
+    std::vector<std::unique_ptr<GroupTable>> _result; // final tables of partitions being output
+    uint32_t _mergers = 1;                            // partitions merged at a time
+    uint32_t _nextPart = 0;                           // next partition to merge
+    uint32_t _part = 0;                               // index of _result being output
+    uint32_t _group = 0;
+
+    std::vector<std::unique_ptr<RecordMgr::RecordManager>> _spills; // a table for a partition
+
+    void spill(std::vector<std::unique_ptr<GroupTable>> &tables)
+    {
+        // spill tables are shared by workers
+        std::lock_guard<std::recursive_mutex> lk(_rm->getPageManager()->latch());
+        for (uint32_t p = 0; p < AGGPARTITIONS; p++)
+        {
+            auto &t = *tables[p];
+            if (_spills[p] == nullptr)
+            {
+                std::vector<Column> cols = {RecordMgr::makeColumn("group", ColumnType::CHAR, t.groupSize())};
+                _spills[p] = std::make_unique<RecordMgr::RecordManager>(
+                    RecordMgr::RecordFileManager::creatTempTable(cols));
+            }
+            for (uint32_t g = 0; g < t.size(); g++)
+                _spills[p]->insertRecord(t.group(g));
+            t.clear();
+        }
+    }
+
+    void aggregate()
+    {
+        auto &th = _rm->getTableHeader();
+        auto pages = th._existsPageNum;
+        auto threads = std::max<uint32_t>(1, std::min(_threads, ceil(pages, AGGMORSEL)));
+        auto &tables = _locals;
+        tables.resize(threads);
+        for (auto &&t : tables)
+        {
+            for (uint32_t p = 0; p < AGGPARTITIONS; p++)
+                t.emplace_back(std::make_unique<GroupTable>(_keySize, &_aggs));
+        }
+        _spills.resize(AGGPARTITIONS);
+
+        // pre-aggregation
+        std::atomic<uint32_t> nextPage{FIRSTLOADPAGE};
+        auto budget = _memory / threads;
+        auto worker = [&](uint32_t w) {
+            std::unique_ptr<uint8_t, decltype(&std::free)> buf(static_cast<uint8_t *>(aligned_alloc(PAGESIZE, PAGESIZE)),
+                                                             &std::free);
+            std::vector<uint8_t> key(_keySize);
+            auto &local = tables[w];
+            uint32_t first;
+            while ((first = nextPage.fetch_add(AGGMORSEL)) <= pages)
+            {
+                auto last = std::min(pages, first + AGGMORSEL - 1);
+                scanPages(*_rm, first, last, buf.get(), [&](const uint8_t *record) {
+                    uint32_t off = 0;
+                    for (auto &&k : _keys)
+                    {
+                        memcpy(key.data() + off, record + k._offset, k._size);
+                        off += k._size;
+                    }
+                    auto h = GroupTable::hash(key.data(), _keySize);
+                    auto s = local[(h >> 32) % AGGPARTITIONS]->find(key.data(), h);
+                    for (size_t i = 0; i < _aggs.size(); i++)
+                        aggUpdateRow(_aggs[i]._func, _inputs[i], record, s[i]);
+                });
+                size_t used = 0;
+                for (auto &&t : local)
+                    used += t->memory();
+                if (used > budget)
+                    spill(local);
+            }
+        };
+        runWorkers(threads, worker);
+        _mergers = std::min(threads, AGGPARTITIONS);
+    }
+
+    /**
+     * @brief merge the next _mergers partitions in parallel into _result, after tables of the partitions output
+     * before are freed.
+     * @return false if all partitions have been merged
+     */
+    bool mergeNext()
+    {
+        _result.clear();
+        _part = _group = 0;
+        if (_nextPart == AGGPARTITIONS)
+            return false;
+        auto first = _nextPart, n = std::min(_mergers, AGGPARTITIONS - first);
+        _nextPart += n;
+        _result.resize(n);
+        auto merger = [&](uint32_t i) {
+            std::unique_ptr<uint8_t, decltype(&std::free)> buf(static_cast<uint8_t *>(aligned_alloc(PAGESIZE, PAGESIZE)),
+                                                             &std::free);
+            auto p = first + i;
+            auto result = std::make_unique<GroupTable>(_keySize, &_aggs);
+            for (auto &&t : _locals)
+            {
+                auto &local = *t[p];
+                for (uint32_t g = 0; g < local.size(); g++)
+                    result->merge(local.group(g), local.hashOf(g));
+                t[p].reset();
+            }
+            if (_spills[p])
+            {
+                auto &spill = *_spills[p];
+                scanPages(spill, FIRSTLOADPAGE, spill.getTableHeader()._existsPageNum, buf.get(),
+                          [&](const uint8_t *group) { result->merge(group, GroupTable::hash(group, _keySize)); });
+            }
+            _result[i] = std::move(result);
+        };
+        runWorkers(n, merger);
+        for (auto p = first; p < first + n; p++)
+        {
+            if (_spills[p])
+                RecordMgr::RecordFileManager::dropTable(*_spills[p]);
+            _spills[p].reset();
+        }
+        return true;
+    }
+
+    template <typename F> static void runWorkers(uint32_t n, F &f)
+    {
+        std::vector<std::thread> ts;
+        for (uint32_t i = 1; i < n; i++)
+            ts.emplace_back(f, i);
+        f(0);
+        for (auto &&t : ts)
+            t.join();
+    }
+
+  public:
+    HashAggregateOp() = delete;
+
+    /**
+     * @param keys index of group by columns of the table
+     * @param aggs aggregates over columns of the table
+     * @param threads worker threads, 0 for number of cores
+     */
+    HashAggregateOp(const RecordMgr::RecordManager *rm, std::vector<uint32_t> keys, std::vector<AggSpec> aggs,
+                    uint32_t threads = 0, size_t memory = AGGMEMORY)
+        : _rm(rm), _aggs(std::move(aggs)), _memory(memory),
+          _threads(threads ? threads : std::max(1u, std::thread::hardware_concurrency()))
+    {
+        auto &th = _rm->getTableHeader();
+        assert(th._columnCount != 0 and not keys.empty());
+        for (auto &&k : keys)
+        {
+            assert(k < th._columnCount);
+            _keys.push_back(th._columns[k]);
+            _keySize += th._columns[k]._size;
+            _schema.push_back(th._columns[k]);
+        }
+        for (auto &&a : _aggs)
+        {
+            auto &in = th._columns[a._func == AggFunc::COUNT ? 0 : a._col];
+            assert(a._func == AggFunc::COUNT or (a._col < th._columnCount and in._type != ColumnType::CHAR));
+            _inputs.push_back(in);
+            _schema.push_back(aggColumn(a, in));
+        }
+        for (auto &&c : _schema)
+        {
+            _vecs.emplace_back(std::make_unique<Vector>(c));
+            _batch._cols.push_back(_vecs.back().get());
+        }
+    }
+
+    ~HashAggregateOp()
+    {
+        for (auto &&s : _spills) // partitions not output
+        {
+            if (s)
+                RecordMgr::RecordFileManager::dropTable(*s);
+        }
+    }
+
+    const std::vector<Column> &schema() const override
+    {
+        return _schema;
+    }
+
+    Batch *next() override
+    {
+        if (not _done)
+        {
+            aggregate();
+            _done = true;
+        }
+        _batch._count = 0;
+        _batch._hasSel = false;
+        while (_batch._count < BATCHSIZE)
+        {
+            if (_part == _result.size())
+            {
+                if (not mergeNext())
+                    break;
+                continue;
+            }
+            auto &t = *_result[_part];
+            if (_group == t.size())
+            {
+                _part++;
+                _group = 0;
+                continue;
+            }
+            auto row = _batch._count++;
+            auto g = t.group(_group);
+            uint32_t off = 0;
+            for (size_t k = 0; k < _keys.size(); k++)
+            {
+                memcpy(_batch._cols[k]->raw() + size_t(row) * _keys[k]._size, g + off, _keys[k]._size);
+                off += _keys[k]._size;
+            }
+            auto s = t.states(_group++);
+            for (size_t i = 0; i < _aggs.size(); i++)
+                aggFinal(_aggs[i], _inputs[i], s[i], *_batch._cols[_keys.size() + i], row);
+        }
+        return _batch._count ? &_batch : nullptr;
+    }
+};
+
+} // namespace Exec
+
+#endif // __SQLIGHT_AGGREGATE__
@@ -0,0 +1,180 @@
+#if !defined(__SQLIGHT_ARENA__)
+#define __SQLIGHT_ARENA__
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <vector>
+
+constexpr size_t ARENABLOCK = 64 << 10; // bytes of the first block of an arena, later blocks double in size
+
+constexpr size_t ARENAMAXBLOCK = 4 << 20; // blocks stop doubling at this size, a larger allocation has its own block
+
+/**
+ * @brief monotonic memory of a thread, memory is bumped out of blocks and released all at once.
+ * Blocks are kept after a rewind, so an arena which is reused allocates nothing from the heap after warming up.
+ * Deallocation does nothing. It is a std::pmr::memory_resource, containers of std::pmr could use it.
+ * An arena is used by one thread.
+ *
+ * It is for short lived memory of a scope: record copies, the row buffer of a batch, rids of a request.
+ * Vectors of batches and hash tables of joins and aggregations stay on the heap. They live as long as their
+ * operator, grow by doubling which an arena could not give back, and are freed part by part to keep operators in
+ * their memory budgets. Groups of an aggregation are also built by several threads.
+ */
+class Arena : public std::pmr::memory_resource
+{
+  private:
+    struct Block
+    {
+        std::unique_ptr<uint8_t, decltype(&std::free)> _data;
+        size_t _size;
+    };
+
+    std::vector<Block> _blocks;
+    size_t _block = 0; // index of the block in use
+    size_t _used = 0;  // bytes used of the block in use
+
+    /**
+     * @brief move to a block which has bytes aligned, reuse the next block or insert a new one
+     */
+    void grow(size_t bytes, size_t alignment)
+    {
+        auto need = bytes + alignment;
+        if (not _blocks.empty())
+            _block++;
+        if (_block < _blocks.size() and _blocks[_block]._size >= need)
+        {
+            _used = 0;
+            return;
+        }
+        auto size = _blocks.empty() ? ARENABLOCK : std::min(_blocks.back()._size * 2, ARENAMAXBLOCK);
+        size = std::max(size, need);
+        auto p = static_cast<uint8_t *>(std::malloc(size));
+        if (p == nullptr)
+            throw std::bad_alloc();
+        _blocks.insert(_blocks.begin() + _block, Block{{p, &std::free}, size});
+        _used = 0;
+    }
+
+  protected:
+    void *do_allocate(size_t bytes, size_t alignment) override
+    {
+        if (not _blocks.empty())
+        {
+            auto &b = _blocks[_block];
+            auto off = (reinterpret_cast<uintptr_t>(b._data.get()) + _used + alignment - 1) & ~(alignment - 1);
+            off -= reinterpret_cast<uintptr_t>(b._data.get());
+            if (off + bytes <= b._size)
+            {
+                _used = off + bytes;
+                return b._data.get() + off;
+            }
+        }
+        grow(bytes, alignment);
+        return do_allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void *, size_t, size_t) override
+    {
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        return this == &other;
+    }
+
+  public:
+    struct Mark
+    {
+        size_t _block;
+        size_t _used;
+    };
+
+    Arena() = default;
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    /**
+     * @brief where the next allocation starts, memory allocated after it is released by rewind
+     */
+    Mark mark() const
+    {
+        return {_block, _used};
+    }
+
+    void rewind(Mark m)
+    {
+        assert(m._block < _blocks.size() or (m._block == 0 and m._used == 0));
+        _block = m._block;
+        _used = m._used;
+    }
+
+    /**
+     * @brief release all memory allocated, blocks are kept for later allocations
+     */
+    void reset()
+    {
+        rewind({0, 0});
+    }
+
+    /**
+     * @brief free all blocks
+     */
+    void shrink()
+    {
+        _blocks.clear();
+        reset();
+    }
+
+    /**
+     * @brief bytes of blocks
+     */
+    size_t capacity() const
+    {
+        size_t n = 0;
+        for (auto &&b : _blocks)
+            n += b._size;
+        return n;
+    }
+
+    /**
+     * @brief the arena of this thread
+     */
+    static Arena &local()
+    {
+        thread_local Arena arena;
+        return arena;
+    }
+};
+
+/**
+ * @brief memory allocated from an arena in a scope is released at the end of it, scopes could be nested.
+ */
+class ArenaScope
+{
+  private:
+    Arena &_arena;
+    Arena::Mark _mark;
+
+  public:
+    explicit ArenaScope(Arena &arena = Arena::local()) : _arena(arena), _mark(arena.mark())
+    {
+    }
+    ArenaScope(const ArenaScope &) = delete;
+
+    ~ArenaScope()
+    {
+        _arena.rewind(_mark);
+    }
+
+    Arena &arena()
+    {
+        return _arena;
+    }
+};
+
+#endif // __SQLIGHT_ARENA__
@@ -0,0 +1,349 @@
+#if !defined(__SQLIGHT_BACKUP__)
+#define __SQLIGHT_BACKUP__
+
+#include "pagedFile.h"
+#include "record.h"
+#include "wal.h"
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace PagedFile
+{
+
+constexpr uint64_t BACKUPMAGIC = 0x70756b6361626c73; // "slbackup"
+
+constexpr uint32_t BACKUPBATCH = 64; // pages read by one preadv, and written to the stream at a time
+
+enum class BackupEntry : uint32_t
+{
+    PAGE, // followed by a page
+    LOG,  // followed by a LogRecord
+    END,  // followed by _endLsn of the backup
+    UNDO, // followed by a undo LogRecord of a transaction active at _endLsn, before END
+};
+
+struct BackupHeader
+{
+    uint64_t _magic;
+    uint64_t _sinceLsn; // pages changed after it are in the backup, 0 for all pages
+};
+
+struct BackupEntryHeader
+{
+    BackupEntry _kind;
+    uint32_t _pageNum;
+};
+
+struct BackupStats
+{
+    uint64_t _pages;   // pages read
+    uint64_t _sent;    // pages in the backup
+    uint64_t _records; // log records in the backup
+    uint64_t _undone;  // undo records of transactions active at _endLsn in the backup
+    uint64_t _endLsn;  // sinceLsn of the next incremental backup
+};
+
+/**
+ * @brief online backup of a logged file to a stream, such as a file or a pipe.
+ * Pages are copied while the file is in use, then log records of the file from the oldest change
+ * which was not on disk when the backup began make the copy consistent, as recovery does.
+ * Changes of transactions active at the end of the backup are undone by restore, as rollback does.
+ * An incremental backup only has pages changed after a lsn, it is restored over the backup before it.
+ */
+class Backup
+{
+  private:
+    PageManager *_pm;
+    LogManager *_log;
+    uint32_t _pagesPerSecond; // 0 for no limit
+    bool _direct;             // read pages not in cache from disk by large reads, not one by one
+
+    int _out;
+    std::vector<uint8_t> _buf;
+
+    void put(const void *data, size_t len)
+    {
+        auto p = static_cast<const uint8_t *>(data);
+        _buf.insert(_buf.end(), p, p + len);
+        if (_buf.size() >= BACKUPBATCH * PAGESIZE)
+            drain();
+    }
+
+    void drain()
+    {
+        for (size_t off = 0; off < _buf.size();)
+        {
+            auto n = write(_out, _buf.data() + off, _buf.size() - off);
+            assert(n > 0);
+            off += n;
+        }
+        _buf.clear();
+    }
+
+    static bool readAll(int in, void *data, size_t len)
+    {
+        auto p = static_cast<uint8_t *>(data);
+        while (len)
+        {
+            auto n = read(in, p, len);
+            if (n <= 0)
+                return false;
+            p += n, len -= n;
+        }
+        return true;
+    }
+
+    /**
+     * @brief read a LogRecord of a stream into buf.
+     * @return false if the stream is broken or the checksum of the record mismatches
+     */
+    static bool readRecord(int in, std::vector<uint8_t> &buf)
+    {
+        buf.resize(sizeof(LogRecord));
+        if (not readAll(in, buf.data(), sizeof(LogRecord)))
+            return false;
+        auto size = reinterpret_cast<LogRecord *>(buf.data())->_size;
+        if (size < sizeof(LogRecord) or size > sizeof(LogRecord) + PAGESIZE)
+            return false;
+        buf.resize(size);
+        if (not readAll(in, buf.data() + sizeof(LogRecord), size - sizeof(LogRecord)))
+            return false;
+        auto r = reinterpret_cast<const LogRecord *>(buf.data());
+        return r->_checksum == logChecksum(r) and (r->_type != LogType::PAGE or r->_offset + r->_len <= PAGESIZE);
+    }
+
+    /**
+     * @brief undo records in order on a restored file which is not open, the changes are not logged but synced.
+     */
+    static void undo(std::string_view path, const std::vector<std::vector<uint8_t>> &records)
+    {
+        PageManager pm(BACKUPBATCH);
+        int fd = FileManager::openFile(path);
+        auto th = std::make_shared<TableHeader>();
+        memcpy(th.get(), RecordMgr::tableHeaderOf(pm.getPage({fd, 0})->_data), sizeof(TableHeader));
+        RecordMgr::RecordManager rm(fd, &pm, th);
+        for (auto &&r : records)
+            rm.undo(*reinterpret_cast<const LogRecord *>(r.data()));
+        pm.flushAllByFd(fd);
+        pm.syncFile(fd); // closeFile syncs only files of a logged pool
+        FileManager::closeFile(fd, pm);
+    }
+
+  public:
+    Backup(const Backup &) = delete;
+
+    /**
+     * @param pagesPerSecond rate limit of reading pages, 0 for no limit
+     * @param direct read pages by preadv of BACKUPBATCH pages, or one by one through PageManager::readPage
+     */
+    Backup(PageManager *pm, LogManager *log, uint32_t pagesPerSecond = 0, bool direct = true)
+        : _pm(pm), _log(log), _pagesPerSecond(pagesPerSecond), _direct(direct)
+    {
+        assert(log);
+    }
+
+    void setRate(uint32_t pagesPerSecond)
+    {
+        _pagesPerSecond = pagesPerSecond;
+    }
+
+    /**
+     * @brief write a backup of an open file to out.
+     * @param sinceLsn only pages changed after it, _endLsn of the last backup. 0 for a full backup
+     */
+    BackupStats run(int fd, int out, uint64_t sinceLsn = 0)
+    {
+        BackupStats st{};
+        _out = out;
+        auto fileId = _log->fileId(FileManager::getPathByFd(fd));
+        uint64_t redoLsn, start;
+        {
+            std::lock_guard<std::recursive_mutex> lk(_pm->latch()); // no change is half done
+            redoLsn = _log->nextLsn();
+            for (auto &&[p, recLsn] : _pm->dirtyPages())
+                redoLsn = p.fd == fd ? std::min(redoLsn, recLsn) : redoLsn;
+            // undo records of transactions active now are kept, they may be active at the end
+            start = _log->pin(std::min(redoLsn, _log->firstActiveLsn()));
+            redoLsn = std::max(redoLsn, start);
+        }
+        uint32_t pages = diskPages(fd); // pages appended later are made by log records
+        BackupHeader h{BACKUPMAGIC, sinceLsn};
+        put(&h, sizeof(h));
+
+        std::unique_ptr<uint8_t, decltype(&std::free)> batch(
+            static_cast<uint8_t *>(aligned_alloc(PAGESIZE, PAGESIZE * BACKUPBATCH)), &std::free);
+        auto begin = std::chrono::steady_clock::now();
+        for (uint32_t first = 0; first < pages; first += BACKUPBATCH)
+        {
+            uint32_t n = std::min(BACKUPBATCH, pages - first);
+            if (_pagesPerSecond)
+                std::this_thread::sleep_until(begin + std::chrono::microseconds(first * 1000000ull / _pagesPerSecond));
+            struct iovec iov = {batch.get(), n * PAGESIZE};
+            auto nread = _direct ? diskRead(fd, first, &iov, 1) : 0;
+            uint32_t valid = nread > 0 ? nread / PAGESIZE : 0;
+            for (uint32_t i = 0; i < n; i++)
+            {
+                auto data = batch.get() + i * PAGESIZE;
+                // a cached page is newer than disk, a page written while it is read may be torn
+                if (i >= valid or _pm->isInCache({fd, first + i}) or not verifyPage(data))
+                    _pm->readPage({fd, first + i}, data);
+                st._pages++;
+                if (sinceLsn and reinterpret_cast<PageHeader *>(data)->_lsn <= sinceLsn)
+                    continue;
+                setPageChecksum(data); // a cached page may be changed since it is written
+                BackupEntryHeader e{BackupEntry::PAGE, first + i};
+                put(&e, sizeof(e));
+                put(data, PAGESIZE);
+                st._sent++;
+            }
+        }
+
+        {
+            std::lock_guard<std::recursive_mutex> lk(_pm->latch());
+            st._endLsn = _log->nextLsn();
+        }
+        robin_hood::unordered_map<uint64_t, uint64_t> last;    // transaction -> lsn of its last undo record
+        robin_hood::unordered_map<uint64_t, uint64_t> changed; // transaction -> lsn of its first change of the file
+        _log->scan(
+            [&](const LogRecord &r) {
+                if (r._lsn >= st._endLsn or (r._type != LogType::PAGE and r._txn == 0))
+                    return;
+                switch (r._type)
+                {
+                case LogType::PAGE:
+                    if (r._fileId != fileId)
+                        return;
+                    if (r._txn)
+                        changed.emplace(r._txn, r._lsn);
+                    if (r._lsn < redoLsn)
+                        return;
+                    {
+                        BackupEntryHeader e{BackupEntry::LOG, r._pageNum};
+                        put(&e, sizeof(e));
+                        put(&r, r._size);
+                    }
+                    st._records++;
+                    return;
+                case LogType::INSERT:
+                case LogType::DELETE:
+                case LogType::UPDATE:
+                case LogType::CLR:
+                    last[r._txn] = r._lsn;
+                    return;
+                case LogType::COMMIT:
+                case LogType::ABORT:
+                    last.erase(r._txn);
+                    changed.erase(r._txn);
+                    return;
+                default:
+                    return;
+                }
+            },
+            start);
+        // undo records of the file of transactions active at the end, in the order rollback takes them
+        std::vector<uint8_t> buf;
+        auto undoneLsn = st._endLsn;
+        for (auto &&[txn, lsn] : last)
+        {
+            auto pos = changed.find(txn);
+            if (pos == changed.end())
+                continue;
+            undoneLsn = std::min(undoneLsn, pos->second - 1);
+            for (auto l = lsn; l;)
+            {
+                _log->read(l, buf);
+                auto r = reinterpret_cast<const LogRecord *>(buf.data());
+                if (r->_type == LogType::CLR)
+                {
+                    l = r->_undoNext;
+                    continue;
+                }
+                if (r->_fileId == fileId)
+                {
+                    BackupEntryHeader e{BackupEntry::UNDO, r->_pageNum};
+                    put(&e, sizeof(e));
+                    put(r, r->_size);
+                    st._undone++;
+                }
+                l = r->_prevLsn;
+            }
+        }
+        _log->unpin(start);
+        // pages undone by restore are sent again by the next incremental backup, as they may be committed later
+        st._endLsn = std::min(st._endLsn, undoneLsn);
+        BackupEntryHeader e{BackupEntry::END, 0};
+        put(&e, sizeof(e));
+        put(&st._endLsn, sizeof(st._endLsn));
+        drain();
+        return st;
+    }
+
+    /**
+     * @brief restore a backup from in to a file which is not open, an incremental one over the backup before it.
+     * Records of the backup are verified by their checksums.
+     * @return _endLsn of the backup, 0 if the stream is broken
+     */
+    static uint64_t restore(int in, std::string_view path)
+    {
+        BackupHeader h;
+        if (not readAll(in, &h, sizeof(h)) or h._magic != BACKUPMAGIC)
+            return 0;
+        int fd = open(path.data(), O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+        assert(fd != -1);
+        std::vector<uint8_t> page(PAGESIZE), buf;
+        std::vector<std::vector<uint8_t>> undone; // undo records, applied after redo
+        uint64_t end = 0;
+        while (true)
+        {
+            BackupEntryHeader e;
+            if (not readAll(in, &e, sizeof(e)))
+                break;
+            if (e._kind == BackupEntry::END)
+            {
+                readAll(in, &end, sizeof(end));
+                break;
+            }
+            if (e._kind == BackupEntry::PAGE)
+            {
+                if (not readAll(in, page.data(), PAGESIZE) or not verifyPage(page.data()))
+                    break;
+                auto n = pwrite(fd, page.data(), PAGESIZE, off_t(e._pageNum) * PAGESIZE);
+                assert(n == PAGESIZE);
+                continue;
+            }
+            if (not readRecord(in, buf))
+                break;
+            if (e._kind == BackupEntry::UNDO)
+            {
+                undone.push_back(buf);
+                continue;
+            }
+            // redo a record on a page older than it
+            auto r = reinterpret_cast<const LogRecord *>(buf.data());
+            auto nread = pread(fd, page.data(), PAGESIZE, off_t(r->_pageNum) * PAGESIZE);
+            if (nread != PAGESIZE) // beyond eof
+                memset(page.data(), 0, PAGESIZE);
+            auto ph = reinterpret_cast<PageHeader *>(page.data());
+            if (ph->_lsn >= r->_lsn)
+                continue;
+            memcpy(page.data() + r->_offset, r->image(), r->_len);
+            ph->_lsn = r->_lsn;
+            setPageChecksum(page.data());
+            auto n = pwrite(fd, page.data(), PAGESIZE, off_t(r->_pageNum) * PAGESIZE);
+            assert(n == PAGESIZE);
+        }
+        fdatasync(fd);
+        close(fd);
+        if (end and not undone.empty())
+            undo(path, undone);
+        return end;
+    }
+};
+
+} // namespace PagedFile
+
+#endif // __SQLIGHT_BACKUP__
@@ -0,0 +1,149 @@
+#if !defined(__SQLIGHT_CHECKPOINT__)
+#define __SQLIGHT_CHECKPOINT__
+
+#include "pagedFile.h"
+#include "wal.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace PagedFile
+{
+
+/**
+ * @brief fuzzy checkpoint.
+ * Dirty pages are written back gradually at a rate limit while tables are in use,
+ * the latch of PageManager is only held for one page at a time.
+ * Then the log before the checkpoint is truncated.
+ */
+class Checkpointer
+{
+  private:
+    PageManager *_pm;
+    LogManager *_log;
+    std::chrono::milliseconds _interval;
+    uint32_t _pagesPerSecond; // 0 for no limit
+
+    std::thread _thread;
+    std::mutex _mutex; // for _stop
+    std::condition_variable _cv;
+    bool _stop = true;
+    std::mutex _running; // one checkpoint at a time
+
+    std::atomic<uint64_t> _checkpoints{0};
+    std::atomic<uint64_t> _pagesWritten{0};
+
+  public:
+    Checkpointer(const Checkpointer &) = delete;
+
+    /**
+     * @param interval time between checkpoints of the background thread
+     * @param pagesPerSecond rate limit of writing dirty pages, 0 for no limit
+     */
+    Checkpointer(PageManager *pm, LogManager *log, std::chrono::milliseconds interval, uint32_t pagesPerSecond = 0)
+        : _pm(pm), _log(log), _interval(interval), _pagesPerSecond(pagesPerSecond)
+    {
+    }
+
+    ~Checkpointer()
+    {
+        stop();
+    }
+
+    void setInterval(std::chrono::milliseconds interval)
+    {
+        std::lock_guard<std::mutex> lk(_mutex);
+        _interval = interval;
+    }
+
+    void setRate(uint32_t pagesPerSecond)
+    {
+        _pagesPerSecond = pagesPerSecond;
+    }
+
+    /**
+     * @brief start the background thread, which makes a checkpoint every interval.
+     */
+    void start()
+    {
+        std::lock_guard<std::mutex> lk(_mutex);
+        if (not _stop)
+            return;
+        _stop = false;
+        _thread = std::thread([this] {
+            std::unique_lock<std::mutex> lk(_mutex);
+            while (not _cv.wait_for(lk, _interval, [this] { return _stop; }))
+            {
+                lk.unlock();
+                checkpoint();
+                lk.lock();
+            }
+        });
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lk(_mutex);
+            _stop = true;
+        }
+        _cv.notify_all();
+        if (_thread.joinable())
+            _thread.join();
+    }
+
+    /**
+     * @brief make a checkpoint on the calling thread.
+     * Pages dirty at the beginning are written back in file order, files are synced,
+     * then changes before the beginning need no redo, except those of pages still dirty, from their recLsn.
+     * @return lsn of the checkpoint record
+     */
+    uint64_t checkpoint()
+    {
+        std::lock_guard<std::mutex> running(_running);
+        uint64_t redoLsn;
+        std::vector<std::pair<Pid, uint64_t>> dirty;
+        {
+            std::lock_guard<std::recursive_mutex> lk(_pm->latch()); // no change is half done
+            redoLsn = _log->nextLsn();
+            dirty = _pm->dirtyPages();
+        }
+        std::sort(dirty.begin(), dirty.end(), [](auto &a, auto &b) {
+            return std::tie(a.first.fd, a.first.pageNum) < std::tie(b.first.fd, b.first.pageNum);
+        });
+        auto begin = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < dirty.size(); i++)
+        {
+            if (_pagesPerSecond)
+                std::this_thread::sleep_until(begin + std::chrono::microseconds(i * 1000000 / _pagesPerSecond));
+            if (_pm->writeBack(dirty[i].first))
+                _pagesWritten++;
+        }
+        // a page pending in an operation is not written back, changes of it from its recLsn are redone.
+        // Pages not dirty now have been written back, and are synced below.
+        for (auto &&[pid, recLsn] : _pm->dirtyPages())
+            redoLsn = std::min(redoLsn, recLsn);
+        _pm->syncAll();
+        auto lsn = _log->checkpoint(redoLsn);
+        _checkpoints++;
+        return lsn;
+    }
+
+    uint64_t checkpoints() const
+    {
+        return _checkpoints;
+    }
+
+    uint64_t pagesWritten() const
+    {
+        return _pagesWritten;
+    }
+};
+
+} // namespace PagedFile
+
+#endif // __SQLIGHT_CHECKPOINT__
@@ -0,0 +1,22 @@
+#if !defined(__SQLIGHT_CHECKSUM__)
+#define __SQLIGHT_CHECKSUM__
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief CRC32C (Castagnoli) of data, continued from crc of the preceding data.
+ * It uses the SSE4.2 crc32 instruction if the cpu has it, or slice-by-8 tables.
+ */
+uint32_t crc32c(const void *data, size_t len, uint32_t crc = 0);
+
+/**
+ * @brief CRC32C by slice-by-8 tables only
+ */
+uint32_t crc32cSoftware(const void *data, size_t len, uint32_t crc = 0);
+
+/**
+ * @brief whether crc32c uses the crc32 instruction
+ */
+bool crc32cHardware();
+
+#endif // __SQLIGHT_CHECKSUM__
@@ -0,0 +1,79 @@
+#if !defined(__SQLIGHT_DISK__)
+#define __SQLIGHT_DISK__
+
+#include "memfile.h"
+#include "sqlight.h"
+#include "tablespace.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace PagedFile
+{
+
+/**
+ * @brief fd of a table in a tablespace or of a memory file, which is not a fd of os.
+ */
+inline bool isVirtualFd(int fd)
+{
+    return fd >= TSFDBASE;
+}
+
+/**
+ * @brief read n pages of a file, a memory file, a table in a tablespace or a normal file, from pageNum.
+ */
+inline ssize_t diskRead(int fd, uint32_t pageNum, const struct iovec *iov, int n)
+{
+    if (MemoryFile::isVirtual(fd))
+        return MemoryFile::byFd(fd)->read(pageNum, iov, n);
+    if (Tablespace::isVirtual(fd))
+        return Tablespace::byFd(fd)->read(Tablespace::idOf(fd), pageNum, iov, n);
+    return preadv(fd, iov, n, off_t(pageNum) * PAGESIZE);
+}
+
+inline ssize_t diskRead(int fd, uint32_t pageNum, void *data)
+{
+    struct iovec iov = {data, PAGESIZE};
+    return diskRead(fd, pageNum, &iov, 1);
+}
+
+inline ssize_t diskWrite(int fd, uint32_t pageNum, const void *data)
+{
+    if (MemoryFile::isVirtual(fd))
+        return MemoryFile::byFd(fd)->write(pageNum, data);
+    if (Tablespace::isVirtual(fd))
+        return Tablespace::byFd(fd)->write(Tablespace::idOf(fd), pageNum, data);
+    return pwrite(fd, data, PAGESIZE, off_t(pageNum) * PAGESIZE);
+}
+
+/**
+ * @brief make pages written durable, nothing for a memory file.
+ */
+inline void diskSync(int fd)
+{
+    if (MemoryFile::isVirtual(fd))
+        return;
+    if (Tablespace::isVirtual(fd))
+        Tablespace::byFd(fd)->sync();
+    else
+        fdatasync(fd);
+}
+
+/**
+ * @brief pages of a file
+ */
+inline uint32_t diskPages(int fd)
+{
+    if (MemoryFile::isVirtual(fd))
+        return MemoryFile::byFd(fd)->pages();
+    if (Tablespace::isVirtual(fd))
+        return Tablespace::byFd(fd)->pages(Tablespace::idOf(fd));
+    struct stat sb;
+    fstat(fd, &sb);
+    return sb.st_size / PAGESIZE;
+}
+
+} // namespace PagedFile
+
+#endif // __SQLIGHT_DISK__
@@ -0,0 +1,970 @@
+#if !defined(__SQLIGHT_EXEC__)
+#define __SQLIGHT_EXEC__
+
+#include "bitwise.h"
+#include "record.h"
+#include "sqlight.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Vectorized pull-based execution engine.
+ * Operators exchange batches of column vectors instead of single records.
+ * next() returns a batch of up to BATCHSIZE rows, nullptr at the end.
+ * A batch may carry a selection vector, only selected rows are alive.
+ */
+namespace Exec
+{
+
+constexpr uint32_t BATCHSIZE = 1024; // rows of a batch
+
+/**
+ * @brief values of one column in a batch, stored contiguously in native type.
+ */
+class Vector
+{
+  private:
+    std::unique_ptr<uint8_t, decltype(&std::free)> _data{nullptr, &std::free};
+    Column _col;
+
+  public:
+    Vector() = delete;
+    Vector(const Vector &) = delete;
+    explicit Vector(const Column &col) : _col(col)
+    {
+        auto bytes = ceil(BATCHSIZE * _col._size, 64) * 64;
+        auto p = aligned_alloc(64, bytes);
+        assert(p != nullptr);
+        _data.reset(static_cast<uint8_t *>(p));
+    }
+
+    template <typename T> T *data()
+    {
+        return reinterpret_cast<T *>(_data.get());
+    }
+
+    template <typename T> const T *data() const
+    {
+        return reinterpret_cast<const T *>(_data.get());
+    }
+
+    uint8_t *raw()
+    {
+        return _data.get();
+    }
+
+    const uint8_t *raw() const
+    {
+        return _data.get();
+    }
+
+    const Column &column() const
+    {
+        return _col;
+    }
+
+    uint16_t width() const
+    {
+        return _col._size;
+    }
+};
+
+/**
+ * @brief a batch of rows.
+ * If _hasSel is false all rows in [0, _count) are alive,
+ * else only rows _sel[0, _selCount) are alive.
+ */
+struct Batch
+{
+    uint32_t _count = 0;
+    bool _hasSel = false;
+    uint32_t _selCount = 0;
+    uint16_t _sel[BATCHSIZE];
+    std::vector<Vector *> _cols;
+
+    /**
+     * @brief alive rows of this batch
+     */
+    uint32_t size() const
+    {
+        return _hasSel ? _selCount : _count;
+    }
+
+    /**
+     * @brief index in vectors of i-th alive row
+     */
+    uint32_t rowAt(uint32_t i) const
+    {
+        return _hasSel ? _sel[i] : i;
+    }
+};
+
+class Operator
+{
+  public:
+    virtual ~Operator() = default;
+
+    /**
+     * @brief get next batch, the batch is valid until next call.
+     * @return nullptr for no more rows
+     */
+    virtual Batch *next() = 0;
+
+    /**
+     * @brief columns of output batches
+     */
+    virtual const std::vector<Column> &schema() const = 0;
+};
+
+using OperatorPtr = std::unique_ptr<Operator>;
+
+// ---------------------------------------------------------------------------
+// rows, a row is values of columns packed in order like a record.
+
+/**
+ * @brief recompute offsets of columns packed in order.
+ * @return row size in bytes
+ */
+inline uint32_t packColumns(std::vector<Column> &cols)
+{
+    uint32_t offset = 0;
+    for (auto &&c : cols)
+    {
+        c._offset = offset;
+        offset += c._size;
+    }
+    return offset;
+}
+
+/**
+ * @brief copy values of b[row] to a packed row
+ * @param row index in vectors
+ */
+inline void storeRow(const Batch &b, uint32_t row, const std::vector<Column> &packed, uint8_t *dst)
+{
+    for (size_t c = 0; c < packed.size(); c++)
+        memcpy(dst + packed[c]._offset, b._cols[c]->raw() + size_t(row) * packed[c]._size, packed[c]._size);
+}
+
+/**
+ * @brief copy values of a packed row to out[row], from column firstCol of out.
+ */
+inline void loadRow(const uint8_t *src, const std::vector<Column> &packed, Batch &out, uint32_t firstCol,
+                    uint32_t row)
+{
+    for (size_t c = 0; c < packed.size(); c++)
+        memcpy(out._cols[firstCol + c]->raw() + size_t(row) * packed[c]._size, src + packed[c]._offset,
+               packed[c]._size);
+}
+
+/**
+ * @brief integer value of v[row] for keys
+ */
+inline int64_t intAt(const Vector *v, uint32_t row)
+{
+    if (v->column()._type == ColumnType::INT32)
+        return v->data<int32_t>()[row];
+    assert(v->column()._type == ColumnType::INT64);
+    return v->data<int64_t>()[row];
+}
+
+// ---------------------------------------------------------------------------
+// kernels, tight loops over plain arrays so that compiler could vectorize them.
+
+/**
+ * @brief copy a field of records to a dense array
+ * @param base pointer to the field of record 0
+ * @param stride record size
+ * @param idx slots of records
+ */
+template <typename T>
+inline void gather(T *__restrict dst, const uint8_t *__restrict base, uint32_t stride,
+                   const uint16_t *__restrict idx, uint32_t n)
+{
+    for (uint32_t i = 0; i < n; i++)
+        memcpy(dst + i, base + size_t(idx[i]) * stride, sizeof(T));
+}
+
+inline void gatherBytes(uint8_t *__restrict dst, const uint8_t *__restrict base, uint32_t stride, uint16_t width,
+                        const uint16_t *__restrict idx, uint32_t n)
+{
+    for (uint32_t i = 0; i < n; i++)
+        memcpy(dst + size_t(i) * width, base + size_t(idx[i]) * stride, width);
+}
+
+enum class CmpOp : uint8_t
+{
+    EQ,
+    NE,
+    LT,
+    LE,
+    GT,
+    GE,
+};
+
+template <CmpOp op, typename T> inline bool compare(T a, T b)
+{
+    switch (op)
+    {
+    case CmpOp::EQ:
+        return a == b;
+    case CmpOp::NE:
+        return a != b;
+    case CmpOp::LT:
+        return a < b;
+    case CmpOp::LE:
+        return a <= b;
+    case CmpOp::GT:
+        return a > b;
+    default:
+        return a >= b;
+    }
+}
+
+/**
+ * @brief branch free selection over all rows [0,n)
+ * @return selected rows count
+ */
+template <CmpOp op, typename T>
+inline uint32_t selectDense(const T *__restrict v, uint32_t n, T c, uint16_t *__restrict sel)
+{
+    uint32_t k = 0;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        sel[k] = i;
+        k += compare<op>(v[i], c);
+    }
+    return k;
+}
+
+/**
+ * @brief branch free selection over selected rows, sel is updated in place.
+ * @return selected rows count
+ */
+template <CmpOp op, typename T> inline uint32_t selectSparse(const T *__restrict v, uint16_t *sel, uint32_t n, T c)
+{
+    uint32_t k = 0;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        auto r = sel[i];
+        sel[k] = r;
+        k += compare<op>(v[r], c);
+    }
+    return k;
+}
+
+template <CmpOp op, typename T> inline uint32_t select(Batch &b, const T *v, T c)
+{
+    if (b._hasSel)
+        return selectSparse<op>(v, b._sel, b._selCount, c);
+    return selectDense<op>(v, b._count, c, b._sel);
+}
+
+template <typename T> inline uint32_t selectBy(CmpOp op, Batch &b, const T *v, T c)
+{
+    switch (op)
+    {
+    case CmpOp::EQ:
+        return select<CmpOp::EQ>(b, v, c);
+    case CmpOp::NE:
+        return select<CmpOp::NE>(b, v, c);
+    case CmpOp::LT:
+        return select<CmpOp::LT>(b, v, c);
+    case CmpOp::LE:
+        return select<CmpOp::LE>(b, v, c);
+    case CmpOp::GT:
+        return select<CmpOp::GT>(b, v, c);
+    default:
+        return select<CmpOp::GE>(b, v, c);
+    }
+}
+
+/**
+ * @brief rows of an integer column kept by `column op constant`
+ */
+enum class Match : uint8_t
+{
+    NONE, // no row
+    SOME, // rows which satisfy `column op bound`, bound is in range of the column
+    ALL,  // every row
+};
+
+/**
+ * @brief values of an integer column
+ */
+inline std::pair<int64_t, int64_t> intRange(ColumnType t)
+{
+    if (t == ColumnType::INT32)
+        return {std::numeric_limits<int32_t>::min(), std::numeric_limits<int32_t>::max()};
+    return {std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max()};
+}
+
+/**
+ * @brief `column op value` of an integer column whose values are in [lo, hi]
+ */
+inline Match intMatch(CmpOp op, int64_t value, int64_t lo, int64_t hi)
+{
+    switch (op)
+    {
+    case CmpOp::EQ:
+        return value < lo or value > hi ? Match::NONE : Match::SOME;
+    case CmpOp::NE:
+        return value < lo or value > hi ? Match::ALL : Match::SOME;
+    case CmpOp::LT:
+        return value > hi ? Match::ALL : (value <= lo ? Match::NONE : Match::SOME);
+    case CmpOp::LE:
+        return value >= hi ? Match::ALL : (value < lo ? Match::NONE : Match::SOME);
+    case CmpOp::GT:
+        return value < lo ? Match::ALL : (value >= hi ? Match::NONE : Match::SOME);
+    default:
+        return value <= lo ? Match::ALL : (value > hi ? Match::NONE : Match::SOME);
+    }
+}
+
+/**
+ * @brief `column op value` of an integer column whose values are in [lo, hi], by `column op bound` if it is
+ * Match::SOME. value is rounded toward the side op includes, `< 2.5` is `< 3` and `<= 2.5` is `<= 2`.
+ */
+inline Match intMatch(CmpOp op, double value, int64_t lo, int64_t hi, int64_t &bound)
+{
+    if (std::isnan(value))
+        return op == CmpOp::NE ? Match::ALL : Match::NONE;
+    auto r = op == CmpOp::LT or op == CmpOp::GE ? std::ceil(value) : std::floor(value);
+    if ((op == CmpOp::EQ or op == CmpOp::NE) and r != value)
+        return op == CmpOp::NE ? Match::ALL : Match::NONE;
+    // lo is exact in double, and so is hi + 1 which is a power of 2
+    bool below = r < double(lo), above = r >= double(hi) + 1;
+    if (below or above)
+    {
+        bool less = op == CmpOp::LT or op == CmpOp::LE;
+        if (op == CmpOp::EQ or op == CmpOp::NE)
+            return op == CmpOp::NE ? Match::ALL : Match::NONE;
+        return less == above ? Match::ALL : Match::NONE;
+    }
+    bound = static_cast<int64_t>(r);
+    return intMatch(op, bound, lo, hi);
+}
+
+// ---------------------------------------------------------------------------
+// operators
+
+/**
+ * @brief full scan of a table, read records page by page into column vectors.
+ */
+class ScanOp : public Operator
+{
+  private:
+    const RecordMgr::RecordManager *_rm;
+    std::vector<Column> _schema;
+    std::vector<std::unique_ptr<Vector>> _vecs;
+    Batch _batch;
+    uint32_t _page = FIRSTLOADPAGE;
+    uint32_t _slot = 0;
+    uint16_t _idx[BATCHSIZE];
+
+    struct Range
+    {
+        uint32_t _col; // column of table
+        uint64_t _lo;  // normalized bounds, inclusive
+        uint64_t _hi;
+    };
+    std::vector<Range> _ranges;
+    uint32_t _skipped = 0;
+
+    /**
+     * @brief whether a page could be skipped without reading it
+     */
+    bool skip(uint32_t page) const
+    {
+        if (_rm->isZonePage(page))
+            return true;
+        for (auto &&r : _ranges)
+        {
+            if (not _rm->zoneMayMatch(page, r._col, r._lo, r._hi))
+                return true;
+        }
+        return false;
+    }
+
+    void addRange(uint32_t col, CmpOp op, const uint8_t *value)
+    {
+        auto &th = _rm->getTableHeader();
+        assert(col < th._columnCount);
+        auto &c = th._columns[col];
+        auto k = normalizeKey(value, c);
+        bool exact = c._type != ColumnType::CHAR;
+        Range r{col, 0, UINT64_MAX};
+        switch (op)
+        {
+        case CmpOp::EQ:
+            r._lo = r._hi = k;
+            break;
+        case CmpOp::LT:
+            if (exact and k == 0)
+                r._lo = 1, r._hi = 0; // nothing
+            else
+                r._hi = exact ? k - 1 : k;
+            break;
+        case CmpOp::LE:
+            r._hi = k;
+            break;
+        case CmpOp::GT:
+            if (exact and k == UINT64_MAX)
+                r._lo = 1, r._hi = 0;
+            else
+                r._lo = exact ? k + 1 : k;
+            break;
+        case CmpOp::GE:
+            r._lo = k;
+            break;
+        default:
+            return;
+        }
+        _ranges.push_back(r);
+    }
+
+    /**
+     * @brief collect alive slots of a page from _slot
+     * @return number of slots collected
+     */
+    uint32_t collect(const uint8_t *bitmap, uint32_t limit)
+    {
+        auto slots = _rm->getTableHeader()._slotsPerPage;
+        uint32_t n = 0;
+        while (_slot < slots and n < limit)
+        {
+            auto byte = bitmap[_slot / BYTEINBITS];
+            if (byte == 0 and _slot % BYTEINBITS == 0)
+            {
+                _slot += BYTEINBITS;
+                continue;
+            }
+            if (byte & (MSB >> (_slot % BYTEINBITS)))
+                _idx[n++] = _slot;
+            _slot++;
+        }
+        return n;
+    }
+
+  public:
+    ScanOp() = delete;
+
+    /**
+     * @param columns index of columns to read, empty for all columns.
+     */
+    ScanOp(const RecordMgr::RecordManager *rm, std::vector<uint32_t> columns = {}) : _rm(rm)
+    {
+        auto &th = _rm->getTableHeader();
+        assert(th._columnCount != 0); // table without schema
+        if (columns.empty())
+        {
+            for (uint32_t i = 0; i < th._columnCount; i++)
+                columns.push_back(i);
+        }
+        for (auto &&i : columns)
+        {
+            assert(i < th._columnCount);
+            _schema.push_back(th._columns[i]);
+            _vecs.emplace_back(std::make_unique<Vector>(th._columns[i]));
+            _batch._cols.push_back(_vecs.back().get());
+        }
+    }
+
+    const std::vector<Column> &schema() const override
+    {
+        return _schema;
+    }
+
+    /**
+     * @brief skip pages which have no rows satisfy `column op value` by zone map of the table.
+     * Rows are not filtered, it should be used with a FilterOp of the same predicate.
+     * @param col index of column of the table
+     */
+    ScanOp &prune(uint32_t col, CmpOp op, int64_t value)
+    {
+        auto &c = _rm->getTableHeader()._columns[col];
+        assert(c._type != ColumnType::CHAR);
+        if (c._type == ColumnType::FLOAT64)
+            return prune(col, op, double(value));
+        // a constant out of range of the column keeps all rows or none, no page is skipped by it
+        auto [lo, hi] = intRange(c._type);
+        if (intMatch(op, value, lo, hi) != Match::SOME)
+            return *this;
+        if (c._type == ColumnType::INT32)
+        {
+            auto v = static_cast<int32_t>(value);
+            addRange(col, op, reinterpret_cast<const uint8_t *>(&v));
+        }
+        else
+        {
+            addRange(col, op, reinterpret_cast<const uint8_t *>(&value));
+        }
+        return *this;
+    }
+
+    /**
+     * @brief value is rounded by op for an integer column, see intMatch
+     */
+    ScanOp &prune(uint32_t col, CmpOp op, double value)
+    {
+        auto &c = _rm->getTableHeader()._columns[col];
+        assert(c._type != ColumnType::CHAR);
+        if (c._type != ColumnType::FLOAT64)
+        {
+            auto [lo, hi] = intRange(c._type);
+            int64_t bound;
+            if (intMatch(op, value, lo, hi, bound) == Match::SOME)
+                prune(col, op, bound);
+            return *this;
+        }
+        addRange(col, op, reinterpret_cast<const uint8_t *>(&value));
+        return *this;
+    }
+
+    /**
+     * @brief pages skipped by zone map
+     */
+    uint32_t skippedPages() const
+    {
+        return _skipped;
+    }
+
+    Batch *next() override
+    {
+        auto &th = _rm->getTableHeader();
+        auto pm = _rm->getPageManager();
+        _batch._count = 0;
+        _batch._hasSel = false;
+        while (_batch._count < BATCHSIZE and _page <= th._existsPageNum)
+        {
+            if (_slot == 0 and skip(_page))
+            {
+                _skipped += not _rm->isZonePage(_page);
+                _page++;
+                continue;
+            }
+            auto page = pm->getPage({_rm->getFd(), _page});
+            auto n = collect(page->_data + sizeof(PageHeader), BATCHSIZE - _batch._count);
+            auto base = _rm->getSlotBase(page->_data);
+            for (size_t c = 0; c < _schema.size(); c++)
+            {
+                auto &col = _schema[c];
+                auto dst = _vecs[c]->raw() + size_t(_batch._count) * col._size;
+                switch (col._size)
+                {
+                case 4:
+                    gather(reinterpret_cast<uint32_t *>(dst), base + col._offset, th._recordSize, _idx, n);
+                    break;
+                case 8:
+                    gather(reinterpret_cast<uint64_t *>(dst), base + col._offset, th._recordSize, _idx, n);
+                    break;
+                default:
+                    gatherBytes(dst, base + col._offset, th._recordSize, col._size, _idx, n);
+                }
+            }
+            _batch._count += n;
+            if (_slot >= th._slotsPerPage)
+            {
+                _page++;
+                _slot = 0;
+            }
+        }
+        return _batch._count ? &_batch : nullptr;
+    }
+};
+
+/**
+ * @brief keep rows which satisfy `column op value`.
+ */
+class FilterOp : public Operator
+{
+  private:
+    OperatorPtr _child;
+    uint32_t _col;
+    CmpOp _op;
+    int64_t _ivalue = 0;
+    double _fvalue;
+    Match _match = Match::SOME; // of an integer column, a constant out of its range keeps all rows or none
+
+  public:
+    FilterOp() = delete;
+    FilterOp(OperatorPtr child, uint32_t col, CmpOp op, int64_t value)
+        : _child(std::move(child)), _col(col), _op(op), _ivalue(value), _fvalue(value)
+    {
+        assert(_col < _child->schema().size());
+        auto type = _child->schema()[_col]._type;
+        assert(type != ColumnType::CHAR);
+        if (type != ColumnType::FLOAT64)
+        {
+            auto [lo, hi] = intRange(type);
+            _match = intMatch(op, value, lo, hi);
+        }
+    }
+
+    /**
+     * @brief value is rounded by op for an integer column, see intMatch
+     */
+    FilterOp(OperatorPtr child, uint32_t col, CmpOp op, double value)
+        : _child(std::move(child)), _col(col), _op(op), _fvalue(value)
+    {
+        assert(_col < _child->schema().size());
+        auto type = _child->schema()[_col]._type;
+        assert(type != ColumnType::CHAR);
+        if (type != ColumnType::FLOAT64)
+        {
+            auto [lo, hi] = intRange(type);
+            _match = intMatch(op, value, lo, hi, _ivalue);
+        }
+    }
+
+    const std::vector<Column> &schema() const override
+    {
+        return _child->schema();
+    }
+
+    Batch *next() override
+    {
+        if (_match != Match::SOME)
+            return _match == Match::ALL ? _child->next() : nullptr;
+        Batch *b;
+        while ((b = _child->next()) != nullptr)
+        {
+            auto v = b->_cols[_col];
+            uint32_t k;
+            switch (v->column()._type)
+            {
+            case ColumnType::INT32:
+                k = selectBy(_op, *b, v->data<int32_t>(), static_cast<int32_t>(_ivalue));
+                break;
+            case ColumnType::INT64:
+                k = selectBy(_op, *b, v->data<int64_t>(), _ivalue);
+                break;
+            default:
+                k = selectBy(_op, *b, v->data<double>(), _fvalue);
+            }
+            b->_hasSel = true;
+            b->_selCount = k;
+            if (k != 0)
+                return b;
+        }
+        return nullptr;
+    }
+};
+
+/**
+ * @brief output a subset of columns of child, vectors are not copied.
+ */
+class ProjectOp : public Operator
+{
+  private:
+    OperatorPtr _child;
+    std::vector<uint32_t> _columns;
+    std::vector<Column> _schema;
+    Batch _batch;
+
+  public:
+    ProjectOp() = delete;
+    ProjectOp(OperatorPtr child, std::vector<uint32_t> columns) : _child(std::move(child)), _columns(std::move(columns))
+    {
+        for (auto &&i : _columns)
+        {
+            assert(i < _child->schema().size());
+            _schema.push_back(_child->schema()[i]);
+        }
+        _batch._cols.resize(_columns.size());
+    }
+
+    const std::vector<Column> &schema() const override
+    {
+        return _schema;
+    }
+
+    Batch *next() override
+    {
+        auto b = _child->next();
+        if (b == nullptr)
+            return nullptr;
+        _batch._count = b->_count;
+        _batch._hasSel = b->_hasSel;
+        _batch._selCount = b->_selCount;
+        if (b->_hasSel)
+            memcpy(_batch._sel, b->_sel, sizeof(uint16_t) * b->_selCount);
+        for (size_t i = 0; i < _columns.size(); i++)
+            _batch._cols[i] = b->_cols[_columns[i]];
+        return &_batch;
+    }
+};
+
+/**
+ * @brief output at most n rows.
+ */
+class LimitOp : public Operator
+{
+  private:
+    OperatorPtr _child;
+    uint64_t _remain;
+
+  public:
+    LimitOp() = delete;
+    LimitOp(OperatorPtr child, uint64_t n) : _child(std::move(child)), _remain(n)
+    {
+    }
+
+    const std::vector<Column> &schema() const override
+    {
+        return _child->schema();
+    }
+
+    Batch *next() override
+    {
+        if (_remain == 0)
+            return nullptr;
+        auto b = _child->next();
+        if (b == nullptr)
+            return nullptr;
+        if (b->size() > _remain)
+        {
+            if (b->_hasSel)
+                b->_selCount = _remain;
+            else
+                b->_count = _remain;
+        }
+        _remain -= b->size();
+        return b;
+    }
+};
+
+enum class AggFunc : uint8_t
+{
+    COUNT,
+    SUM,
+    MIN,
+    MAX,
+    AVG,
+};
+
+struct AggSpec
+{
+    AggFunc _func;
+    uint32_t _col; // ignored by COUNT
+};
+
+/**
+ * @brief running state of an aggregate. Integer columns accumulate in _i, float columns in _f.
+ */
+struct AggState
+{
+    uint64_t _count = 0;
+    int64_t _i = 0;
+    double _f = 0;
+};
+
+/**
+ * @brief output column of an aggregate over a input column.
+ * COUNT returns INT64, AVG returns FLOAT64, others keep integer or float of input.
+ */
+inline Column aggColumn(AggSpec spec, const Column &in)
+{
+    Column c{};
+    bool isFloat = in._type == ColumnType::FLOAT64;
+    if (spec._func == AggFunc::COUNT)
+        isFloat = false;
+    else if (spec._func == AggFunc::AVG)
+        isFloat = true;
+    c._type = isFloat ? ColumnType::FLOAT64 : ColumnType::INT64;
+    c._size = columnWidth(c._type);
+    static const char *names[] = {"count", "sum", "min", "max", "avg"};
+    fmt::format_to_n(c._name, MAXCOLUMNNAME - 1, "{}({})", names[int(spec._func)], in._name);
+    return c;
+}
+
+inline void aggInit(AggFunc f, AggState &s)
+{
+    s._count = 0;
+    s._i = f == AggFunc::MIN ? std::numeric_limits<int64_t>::max()
+                             : (f == AggFunc::MAX ? std::numeric_limits<int64_t>::min() : 0);
+    s._f = f == AggFunc::MIN ? std::numeric_limits<double>::infinity()
+                             : (f == AggFunc::MAX ? -std::numeric_limits<double>::infinity() : 0);
+}
+
+template <typename T, typename Acc> inline Acc sumDense(const T *__restrict v, uint32_t n)
+{
+    Acc s = 0;
+    for (uint32_t i = 0; i < n; i++)
+        s += v[i];
+    return s;
+}
+
+template <typename T> inline T minDense(const T *__restrict v, uint32_t n, T m)
+{
+    for (uint32_t i = 0; i < n; i++)
+        m = v[i] < m ? v[i] : m;
+    return m;
+}
+
+template <typename T> inline T maxDense(const T *__restrict v, uint32_t n, T m)
+{
+    for (uint32_t i = 0; i < n; i++)
+        m = v[i] > m ? v[i] : m;
+    return m;
+}
+
+template <typename T, typename Acc> inline Acc sumSparse(const T *__restrict v, const uint16_t *__restrict sel, uint32_t n)
+{
+    Acc s = 0;
+    for (uint32_t i = 0; i < n; i++)
+        s += v[sel[i]];
+    return s;
+}
+
+template <typename T> inline T minSparse(const T *__restrict v, const uint16_t *__restrict sel, uint32_t n, T m)
+{
+    for (uint32_t i = 0; i < n; i++)
+        m = v[sel[i]] < m ? v[sel[i]] : m;
+    return m;
+}
+
+template <typename T> inline T maxSparse(const T *__restrict v, const uint16_t *__restrict sel, uint32_t n, T m)
+{
+    for (uint32_t i = 0; i < n; i++)
+        m = v[sel[i]] > m ? v[sel[i]] : m;
+    return m;
+}
+
+/**
+ * @brief fold alive rows of a vector into an aggregate state.
+ */
+template <typename T, typename Acc> inline void aggUpdate(AggFunc f, const Batch &b, const T *v, Acc &acc)
+{
+    auto n = b.size();
+    switch (f)
+    {
+    case AggFunc::SUM:
+    case AggFunc::AVG:
+        acc += b._hasSel ? sumSparse<T, Acc>(v, b._sel, n) : sumDense<T, Acc>(v, n);
+        break;
+    case AggFunc::MIN:
+        acc = std::min<Acc>(acc, b._hasSel ? minSparse<T>(v, b._sel, n, std::numeric_limits<T>::max())
+                                           : minDense<T>(v, n, std::numeric_limits<T>::max()));
+        break;
+    case AggFunc::MAX:
+        acc = std::max<Acc>(acc, b._hasSel ? maxSparse<T>(v, b._sel, n, std::numeric_limits<T>::lowest())
+                                           : maxDense<T>(v, n, std::numeric_limits<T>::lowest()));
+        break;
+    default:
+        break;
+    }
+}
+
+inline void aggUpdate(AggSpec spec, const Batch &b, AggState &s)
+{
+    s._count += b.size();
+    if (spec._func == AggFunc::COUNT or b.size() == 0)
+        return;
+    auto v = b._cols[spec._col];
+    switch (v->column()._type)
+    {
+    case ColumnType::INT32:
+        aggUpdate<int32_t, int64_t>(spec._func, b, v->data<int32_t>(), s._i);
+        break;
+    case ColumnType::INT64:
+        aggUpdate<int64_t, int64_t>(spec._func, b, v->data<int64_t>(), s._i);
+        break;
+    default:
+        aggUpdate<double, double>(spec._func, b, v->data<double>(), s._f);
+    }
+}
+
+/**
+ * @brief write the result of an aggregate state to out[row].
+ * @param in input column of the aggregate
+ */
+inline void aggFinal(AggSpec spec, const Column &in, const AggState &s, Vector &out, uint32_t row)
+{
+    bool isFloat = in._type == ColumnType::FLOAT64;
+    switch (spec._func)
+    {
+    case AggFunc::COUNT:
+        out.data<int64_t>()[row] = s._count;
+        break;
+    case AggFunc::AVG:
+        out.data<double>()[row] = s._count == 0 ? 0 : (isFloat ? s._f : double(s._i)) / s._count;
+        break;
+    default: // MIN and MAX of no row are 0, not the initial value of the state
+        if (isFloat)
+            out.data<double>()[row] = s._count == 0 ? 0 : s._f;
+        else
+            out.data<int64_t>()[row] = s._count == 0 ? 0 : s._i;
+    }
+}
+
+/**
+ * @brief aggregate all rows of child without grouping, output one row.
+ * There is no NULL, so no row is output if child has no row and MIN or MAX is asked, as they have no value.
+ */
+class AggregateOp : public Operator
+{
+  private:
+    OperatorPtr _child;
+    std::vector<AggSpec> _aggs;
+    std::vector<Column> _schema;
+    std::vector<std::unique_ptr<Vector>> _vecs;
+    Batch _batch;
+    bool _done = false;
+
+  public:
+    AggregateOp() = delete;
+    AggregateOp(OperatorPtr child, std::vector<AggSpec> aggs) : _child(std::move(child)), _aggs(std::move(aggs))
+    {
+        for (auto &&a : _aggs)
+        {
+            assert(a._func == AggFunc::COUNT or a._col < _child->schema().size());
+            auto &in = _child->schema()[a._func == AggFunc::COUNT ? 0 : a._col];
+            assert(a._func == AggFunc::COUNT or in._type != ColumnType::CHAR);
+            _schema.push_back(aggColumn(a, in));
+            _vecs.emplace_back(std::make_unique<Vector>(_schema.back()));
+            _batch._cols.push_back(_vecs.back().get());
+        }
+    }
+
+    const std::vector<Column> &schema() const override
+    {
+        return _schema;
+    }
+
+    Batch *next() override
+    {
+        if (_done)
+            return nullptr;
+        _done = true;
+        std::vector<AggState> states(_aggs.size());
+        for (size_t i = 0; i < _aggs.size(); i++)
+            aggInit(_aggs[i]._func, states[i]);
+        Batch *b;
+        while ((b = _child->next()) != nullptr)
+        {
+            for (size_t i = 0; i < _aggs.size(); i++)
+                aggUpdate(_aggs[i], *b, states[i]);
+        }
+        auto minmax = [](const AggSpec &a) { return a._func == AggFunc::MIN or a._func == AggFunc::MAX; };
+        if (not states.empty() and states[0]._count == 0 and std::any_of(_aggs.begin(), _aggs.end(), minmax))
+            return nullptr;
+        for (size_t i = 0; i < _aggs.size(); i++)
+        {
+            auto &in = _child->schema()[_aggs[i]._func == AggFunc::COUNT ? 0 : _aggs[i]._col];
+            aggFinal(_aggs[i], in, states[i], *_vecs[i], 0);
+        }
+        _batch._count = 1;
+        _batch._hasSel = false;
+        return &_batch;
+    }
+};
+
+} // namespace Exec
+
+#endif // __SQLIGHT_EXEC__
@@ -0,0 +1,117 @@
+#if !defined(__SQLIGHT_HISTOGRAM__)
+#define __SQLIGHT_HISTOGRAM__
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+constexpr int HISTSUBBITS = 11; // 2048 sub-buckets of a power of two, 3 significant digits
+
+/**
+ * @brief histogram of values such as latencies in ns, in the layout of HdrHistogram.
+ * Values below 2^HISTSUBBITS have their own bucket, a larger value is kept with its top HISTSUBBITS bits,
+ * so error of a percentile is under 1 / 2^(HISTSUBBITS - 1) of it. Recording is a few instructions,
+ * a histogram per thread is merged after a run.
+ */
+class Histogram
+{
+  private:
+    static constexpr uint64_t HALF = 1ull << (HISTSUBBITS - 1);
+    static constexpr uint32_t BUCKETS = (64 - HISTSUBBITS + 2) * HALF;
+
+    std::vector<uint64_t> _counts = std::vector<uint64_t>(BUCKETS);
+    uint64_t _total = 0;
+    uint64_t _sum = 0;
+    uint64_t _min = UINT64_MAX;
+    uint64_t _max = 0;
+
+    static uint32_t indexOf(uint64_t v)
+    {
+        if (v < 2 * HALF)
+            return v;
+        int shift = 63 - __builtin_clzll(v) - (HISTSUBBITS - 1);
+        return (shift + 1) * HALF + (v >> shift) - HALF;
+    }
+
+    /**
+     * @brief the largest value of a bucket
+     */
+    static uint64_t highestOf(uint32_t index)
+    {
+        if (index < 2 * HALF)
+            return index;
+        int shift = index / HALF - 1;
+        uint64_t low = (index % HALF + HALF) << shift;
+        return low + (1ull << shift) - 1;
+    }
+
+  public:
+    void record(uint64_t v)
+    {
+        _counts[indexOf(v)]++;
+        _total++;
+        _sum += v;
+        _min = std::min(_min, v);
+        _max = std::max(_max, v);
+    }
+
+    void merge(const Histogram &h)
+    {
+        for (uint32_t i = 0; i < BUCKETS; i++)
+            _counts[i] += h._counts[i];
+        _total += h._total;
+        _sum += h._sum;
+        _min = std::min(_min, h._min);
+        _max = std::max(_max, h._max);
+    }
+
+    void reset()
+    {
+        std::fill(_counts.begin(), _counts.end(), 0);
+        _total = _sum = _max = 0;
+        _min = UINT64_MAX;
+    }
+
+    /**
+     * @param q in [0, 1], such as 0.99 for p99
+     * @return the smallest value which q of values are not greater than, within the error. 0 if it is empty
+     */
+    uint64_t percentile(double q) const
+    {
+        if (_total == 0)
+            return 0;
+        auto rank = std::max<uint64_t>(1, std::ceil(q * _total));
+        uint64_t seen = 0;
+        for (uint32_t i = 0; i < BUCKETS; i++)
+        {
+            seen += _counts[i];
+            if (seen >= rank)
+                return std::min(highestOf(i), _max);
+        }
+        return _max;
+    }
+
+    uint64_t count() const
+    {
+        return _total;
+    }
+
+    uint64_t min() const
+    {
+        return _total ? _min : 0;
+    }
+
+    uint64_t max() const
+    {
+        return _max;
+    }
+
+    double mean() const
+    {
+        return _total ? double(_sum) / _total : 0;
+    }
+};
+
+#endif // __SQLIGHT_HISTOGRAM__
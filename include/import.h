@@ -0,0 +1,60 @@
+#if !defined(__SQLIGHT_IMPORT__)
+#define __SQLIGHT_IMPORT__
+
+#include "record.h"
+#include <cstdint>
+#include <string_view>
+
+namespace Import
+{
+
+constexpr uint64_t IMPORTCHUNK = 16 << 20; // bytes of input parsed by a worker at a time
+
+constexpr uint32_t IMPORTBATCH = 4096; // records inserted by one RecordManager::insertRecords
+
+enum class Format
+{
+    CSV,   // fields separated by ',', a field may be quoted by '"' and "" in it is '"'
+    TSV,   // fields separated by '\t', \t, \n, \r and \\ in a field are a tab, line breaks and a backslash
+    BINARY // records of the table layout one after another, TableHeader::_recordSize bytes each
+};
+
+struct Options
+{
+    Format _format = Format::CSV;
+    bool _header = false; // the first line of a text file is skipped
+    uint32_t _threads = 0; // parsing workers, 0 for all cpus
+};
+
+struct Stats
+{
+    uint64_t _rows;        // records inserted
+    uint64_t _errors;      // lines or records skipped, such as a bad number or a wrong count of fields
+    uint64_t _bytes;       // bytes of the file
+    uint64_t _errorOffset; // byte offset of the first line or record skipped, if there are errors
+    uint32_t _errorColumn; // column of its first bad field, the column count for a wrong field count or a partial record
+};
+
+struct Masks
+{
+    uint64_t _newline; // bit i is set if p[i] is '\n'
+    uint64_t _quote;
+    uint64_t _delim;
+};
+
+/**
+ * @brief positions of '\n', '"' and delim in 64 bytes from p, 64 bytes must be readable. By SSE2 on x86-64.
+ */
+Masks scan64(const char *p, char delim);
+
+/**
+ * @brief bulk load a file into a table with a schema.
+ * The file is mapped into memory and cut into chunks at line ends, workers parse chunks in parallel into
+ * batches of records which are inserted by RecordManager::insertRecords. Order of rows between chunks is not kept.
+ * A line break in a quoted CSV field is allowed, chunks are cut out of quotes.
+ */
+Stats importFile(std::string_view path, RecordMgr::RecordManager &rm, const Options &opt = {});
+
+} // namespace Import
+
+#endif // __SQLIGHT_IMPORT__
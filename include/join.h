@@ -0,0 +1,490 @@
+#if !defined(__SQLIGHT_JOIN__)
+#define __SQLIGHT_JOIN__
+
+#include "exec.h"
+#include "record.h"
+#include <robin_hood.h>
+
+namespace Exec
+{
+
+constexpr size_t JOINMEMORY = 64 << 20; // default memory budget of build side of a hash join in bytes
+
+constexpr uint32_t JOINFANOUT = 16; // partitions of a spilled hash join
+
+constexpr uint32_t JOINMAXLEVEL = 4; // stop partitioning after JOINMAXLEVEL times
+
+/**
+ * @brief open addressing hash table from a integer key to rows.
+ * Rows of the same key are chained by row index.
+ */
+class JoinHashTable
+{
+  private:
+    static constexpr uint32_t NONE = -1;
+    struct Slot
+    {
+        int64_t _key;
+        uint32_t _head;
+    };
+    std::vector<Slot> _slots;
+    std::vector<uint32_t> _next;
+    size_t _mask = 0;
+
+    size_t home(int64_t key) const
+    {
+        return robin_hood::hash_int(key) & _mask;
+    }
+
+  public:
+    /**
+     * @brief clear table and make room for n rows.
+     */
+    void reset(size_t n)
+    {
+        size_t cap = 16;
+        while (cap < n * 2)
+            cap <<= 1;
+        _slots.assign(cap, Slot{0, NONE});
+        _mask = cap - 1;
+        _next.clear();
+        _next.reserve(n);
+    }
+
+    /**
+     * @brief insert row, rows must be inserted in order 0, 1, 2, ...
+     */
+    void insert(int64_t key, uint32_t row)
+    {
+        assert(row == _next.size());
+        auto pos = home(key);
+        while (_slots[pos]._head != NONE and _slots[pos]._key != key)
+            pos = (pos + 1) & _mask;
+        _next.push_back(_slots[pos]._head);
+        _slots[pos]._key = key;
+        _slots[pos]._head = row;
+    }
+
+    /**
+     * @brief first row of key
+     * @return NONE if not found
+     */
+    uint32_t find(int64_t key) const
+    {
+        auto pos = home(key);
+        while (_slots[pos]._head != NONE)
+        {
+            if (_slots[pos]._key == key)
+                return _slots[pos]._head;
+            pos = (pos + 1) & _mask;
+        }
+        return NONE;
+    }
+
+    uint32_t next(uint32_t row) const
+    {
+        return _next[row];
+    }
+
+    static bool end(uint32_t row)
+    {
+        return row == NONE;
+    }
+};
+
+/**
+ * @brief make output vectors of a join, columns of left then columns of right.
+ */
+inline void joinSchema(const std::vector<Column> &left, const std::vector<Column> &right, std::vector<Column> &schema,
+                       std::vector<std::unique_ptr<Vector>> &vecs, Batch &out)
+{
+    schema = left;
+    schema.insert(schema.end(), right.begin(), right.end());
+    for (auto &&c : schema)
+    {
+        vecs.emplace_back(std::make_unique<Vector>(c));
+        out._cols.push_back(vecs.back().get());
+    }
+}
+
+/**
+ * @brief copy b[row] to columns from firstCol of out[outRow]
+ */
+inline void copyValues(const Batch &b, uint32_t row, Batch &out, uint32_t firstCol, uint32_t outRow)
+{
+    for (size_t c = 0; c < b._cols.size(); c++)
+    {
+        auto w = b._cols[c]->width();
+        memcpy(out._cols[firstCol + c]->raw() + size_t(outRow) * w, b._cols[c]->raw() + size_t(row) * w, w);
+    }
+}
+
+/**
+ * @brief inner equal join on integer keys, output columns of probe side then build side.
+ * Build side is loaded into a hash table. If it exceeds the memory budget, both sides are partitioned into
+ * temporary tables by hash of key (grace hash join) and every partition pair is joined recursively.
+ */
+class HashJoinOp : public Operator
+{
+  private:
+    OperatorPtr _build;
+    OperatorPtr _probe;
+    uint32_t _buildKey;
+    uint32_t _probeKey;
+    size_t _memory;
+    uint32_t _level;
+
+    std::vector<Column> _schema;
+    std::vector<std::unique_ptr<Vector>> _vecs;
+    Batch _out;
+
+    bool _built = false;
+
+    // in memory
+    std::vector<Column> _packed; // build row layout
+    uint32_t _rowSize;
+    std::vector<uint8_t> _rows;
+    uint32_t _rowCount = 0;
+    JoinHashTable _ht;
+    Batch *_pb = nullptr; // current probe batch
+    uint32_t _pi = 0;     // next alive row of _pb
+    uint32_t _cur = 0;    // current probe row
+    uint32_t _match = -1; // next build row matches _cur
+
+    // spilled
+    bool _spilled = false;
+    std::vector<std::unique_ptr<RecordMgr::RecordManager>> _buildParts;
+    std::vector<std::unique_ptr<RecordMgr::RecordManager>> _probeParts;
+    uint32_t _part = 0;
+    OperatorPtr _sub;
+
+    uint32_t partitionOf(int64_t key) const
+    {
+        return robin_hood::hash_int(key ^ (0x9e3779b97f4a7c15ULL * (_level + 1))) % JOINFANOUT;
+    }
+
+    std::vector<std::unique_ptr<RecordMgr::RecordManager>> creatPartitions(const std::vector<Column> &schema)
+    {
+        std::vector<std::unique_ptr<RecordMgr::RecordManager>> parts;
+        for (uint32_t i = 0; i < JOINFANOUT; i++)
+            parts.emplace_back(
+                std::make_unique<RecordMgr::RecordManager>(RecordMgr::RecordFileManager::creatTempTable(schema)));
+        return parts;
+    }
+
+    void spill()
+    {
+        _spilled = true;
+        _buildParts = creatPartitions(_build->schema());
+        for (uint32_t i = 0; i < _rowCount; i++)
+        {
+            auto row = _rows.data() + size_t(i) * _rowSize;
+            int64_t key;
+            if (_packed[_buildKey]._type == ColumnType::INT32)
+                key = *reinterpret_cast<const int32_t *>(row + _packed[_buildKey]._offset);
+            else
+                key = *reinterpret_cast<const int64_t *>(row + _packed[_buildKey]._offset);
+            _buildParts[partitionOf(key)]->insertRecord(row);
+        }
+        _rows.clear();
+        _rows.shrink_to_fit();
+        _rowCount = 0;
+    }
+
+    void partition(Operator &op, uint32_t key, std::vector<std::unique_ptr<RecordMgr::RecordManager>> &parts,
+                   const std::vector<Column> &packed, uint32_t rowSize)
+    {
+        std::vector<uint8_t> row(rowSize);
+        Batch *b;
+        while ((b = op.next()) != nullptr)
+        {
+            for (uint32_t i = 0; i < b->size(); i++)
+            {
+                auto r = b->rowAt(i);
+                storeRow(*b, r, packed, row.data());
+                parts[partitionOf(intAt(b->_cols[key], r))]->insertRecord(row.data());
+            }
+        }
+    }
+
+    void build()
+    {
+        _built = true;
+        _packed = _build->schema();
+        _rowSize = packColumns(_packed);
+        Batch *b;
+        while (not _spilled and (b = _build->next()) != nullptr)
+        {
+            for (uint32_t i = 0; i < b->size(); i++)
+            {
+                _rows.resize(_rows.size() + _rowSize);
+                storeRow(*b, b->rowAt(i), _packed, _rows.data() + size_t(_rowCount++) * _rowSize);
+            }
+            if (_rows.size() > _memory and _level < JOINMAXLEVEL)
+                spill();
+        }
+        if (_spilled)
+        {
+            // rest of build side and whole probe side go to partitions
+            partition(*_build, _buildKey, _buildParts, _packed, _rowSize);
+            auto probePacked = _probe->schema();
+            auto probeRowSize = packColumns(probePacked);
+            _probeParts = creatPartitions(_probe->schema());
+            partition(*_probe, _probeKey, _probeParts, probePacked, probeRowSize);
+            return;
+        }
+        _ht.reset(_rowCount);
+        auto &kc = _packed[_buildKey];
+        for (uint32_t i = 0; i < _rowCount; i++)
+        {
+            auto p = _rows.data() + size_t(i) * _rowSize + kc._offset;
+            _ht.insert(kc._type == ColumnType::INT32 ? *reinterpret_cast<const int32_t *>(p)
+                                                     : *reinterpret_cast<const int64_t *>(p),
+                       i);
+        }
+    }
+
+    Batch *probe()
+    {
+        _out._count = 0;
+        auto probeCols = _probe->schema().size();
+        while (_out._count < BATCHSIZE)
+        {
+            if (not JoinHashTable::end(_match))
+            {
+                copyValues(*_pb, _cur, _out, 0, _out._count);
+                loadRow(_rows.data() + size_t(_match) * _rowSize, _packed, _out, probeCols, _out._count);
+                _out._count++;
+                _match = _ht.next(_match);
+                continue;
+            }
+            if (_pb == nullptr or _pi >= _pb->size())
+            {
+                _pb = _probe->next();
+                _pi = 0;
+                if (_pb == nullptr)
+                    break;
+                continue;
+            }
+            _cur = _pb->rowAt(_pi++);
+            _match = _ht.find(intAt(_pb->_cols[_probeKey], _cur));
+        }
+        return _out._count ? &_out : nullptr;
+    }
+
+    void dropPartition(uint32_t i)
+    {
+        RecordMgr::RecordFileManager::dropTable(*_buildParts[i]);
+        RecordMgr::RecordFileManager::dropTable(*_probeParts[i]);
+        _buildParts[i].reset();
+        _probeParts[i].reset();
+    }
+
+    Batch *nextPartition()
+    {
+        while (true)
+        {
+            if (_sub)
+            {
+                auto b = _sub->next();
+                if (b != nullptr)
+                    return b;
+                _sub.reset();
+                dropPartition(_part - 1);
+            }
+            if (_part == JOINFANOUT)
+                return nullptr;
+            auto i = _part++;
+            if (_buildParts[i]->getTotalRecord() == 0 or _probeParts[i]->getTotalRecord() == 0)
+            {
+                dropPartition(i);
+                continue;
+            }
+            _sub = std::make_unique<HashJoinOp>(std::make_unique<ScanOp>(_buildParts[i].get()), _buildKey,
+                                                std::make_unique<ScanOp>(_probeParts[i].get()), _probeKey, _memory,
+                                                _level + 1);
+        }
+    }
+
+  public:
+    HashJoinOp() = delete;
+    HashJoinOp(const HashJoinOp &) = delete;
+
+    /**
+     * @param buildKey index of key column of build side, INT32 or INT64
+     * @param probeKey index of key column of probe side, INT32 or INT64
+     * @param memory memory budget of build side in bytes
+     */
+    HashJoinOp(OperatorPtr build, uint32_t buildKey, OperatorPtr probe, uint32_t probeKey, size_t memory = JOINMEMORY,
+               uint32_t level = 0)
+        : _build(std::move(build)), _probe(std::move(probe)), _buildKey(buildKey), _probeKey(probeKey),
+          _memory(memory), _level(level)
+    {
+        assert(_buildKey < _build->schema().size() and _probeKey < _probe->schema().size());
+        joinSchema(_probe->schema(), _build->schema(), _schema, _vecs, _out);
+    }
+
+    ~HashJoinOp()
+    {
+        _sub.reset();
+        for (uint32_t i = 0; i < _buildParts.size(); i++)
+        {
+            if (_buildParts[i])
+                dropPartition(i);
+        }
+    }
+
+    const std::vector<Column> &schema() const override
+    {
+        return _schema;
+    }
+
+    Batch *next() override
+    {
+        if (not _built)
+            build();
+        if (_spilled)
+            return nextPartition();
+        return probe();
+    }
+};
+
+/**
+ * @brief inner equal join of two inputs sorted ascending by integer keys.
+ * Output columns of left side then right side. Rows of right side with the same key are buffered.
+ */
+class SortMergeJoinOp : public Operator
+{
+  private:
+    OperatorPtr _left;
+    OperatorPtr _right;
+    uint32_t _leftKey;
+    uint32_t _rightKey;
+
+    std::vector<Column> _schema;
+    std::vector<std::unique_ptr<Vector>> _vecs;
+    Batch _out;
+
+    Batch *_lb = nullptr;
+    uint32_t _li = 0;
+    bool _leftDone = false;
+    Batch *_rb = nullptr;
+    uint32_t _ri = 0;
+    bool _rightDone = false;
+
+    // right rows of current key
+    std::vector<Column> _packed;
+    uint32_t _rowSize;
+    std::vector<uint8_t> _group;
+    uint32_t _groupRows = 0;
+    int64_t _groupKey = 0;
+    bool _hasGroup = false;
+
+    bool _emitting = false;
+    uint32_t _lcur = 0; // left row of emitting
+    uint32_t _gi = 0;   // next group row of emitting
+    bool _finished = false;
+
+    static bool available(Operator &op, Batch *&b, uint32_t &i, bool &done)
+    {
+        while (b == nullptr or i >= b->size())
+        {
+            if (done)
+                return false;
+            b = op.next();
+            i = 0;
+            if (b == nullptr)
+            {
+                done = true;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief skip right rows less than key, buffer rows of next key of right side
+     * @return false if right side is exhausted
+     */
+    bool loadGroup(int64_t key)
+    {
+        _hasGroup = false;
+        while (available(*_right, _rb, _ri, _rightDone) and intAt(_rb->_cols[_rightKey], _rb->rowAt(_ri)) < key)
+            _ri++;
+        if (not available(*_right, _rb, _ri, _rightDone))
+            return false;
+        _groupKey = intAt(_rb->_cols[_rightKey], _rb->rowAt(_ri));
+        _groupRows = 0;
+        _group.clear();
+        while (available(*_right, _rb, _ri, _rightDone) and
+               intAt(_rb->_cols[_rightKey], _rb->rowAt(_ri)) == _groupKey)
+        {
+            _group.resize(_group.size() + _rowSize);
+            storeRow(*_rb, _rb->rowAt(_ri), _packed, _group.data() + size_t(_groupRows++) * _rowSize);
+            _ri++;
+        }
+        _hasGroup = true;
+        return true;
+    }
+
+  public:
+    SortMergeJoinOp() = delete;
+    SortMergeJoinOp(OperatorPtr left, uint32_t leftKey, OperatorPtr right, uint32_t rightKey)
+        : _left(std::move(left)), _right(std::move(right)), _leftKey(leftKey), _rightKey(rightKey)
+    {
+        assert(_leftKey < _left->schema().size() and _rightKey < _right->schema().size());
+        joinSchema(_left->schema(), _right->schema(), _schema, _vecs, _out);
+        _packed = _right->schema();
+        _rowSize = packColumns(_packed);
+    }
+
+    const std::vector<Column> &schema() const override
+    {
+        return _schema;
+    }
+
+    Batch *next() override
+    {
+        _out._count = 0;
+        auto leftCols = _left->schema().size();
+        while (not _finished and _out._count < BATCHSIZE)
+        {
+            if (_emitting)
+            {
+                if (_gi < _groupRows)
+                {
+                    copyValues(*_lb, _lcur, _out, 0, _out._count);
+                    loadRow(_group.data() + size_t(_gi++) * _rowSize, _packed, _out, leftCols, _out._count);
+                    _out._count++;
+                    continue;
+                }
+                _emitting = false;
+            }
+            if (not available(*_left, _lb, _li, _leftDone))
+            {
+                _finished = true;
+                break;
+            }
+            auto key = intAt(_lb->_cols[_leftKey], _lb->rowAt(_li));
+            if (_hasGroup and key == _groupKey)
+            {
+                _lcur = _lb->rowAt(_li++);
+                _gi = 0;
+                _emitting = true;
+            }
+            else if (_hasGroup and key < _groupKey)
+            {
+                _li++;
+            }
+            else if (not loadGroup(key))
+            {
+                _finished = true;
+            }
+        }
+        return _out._count ? &_out : nullptr;
+    }
+};
+
+} // namespace Exec
+
+#endif // __SQLIGHT_JOIN__
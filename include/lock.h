@@ -0,0 +1,491 @@
+#if !defined(__SQLIGHT_LOCK__)
+#define __SQLIGHT_LOCK__
+
+#include "record.h"
+#include "recovery.h"
+#include "sqlight.h"
+#include "wal.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// two phase locking of records and pages
+namespace RecordMgr
+{
+
+constexpr uint32_t LOCKPARTITIONS = 64; // partitions of the lock table
+
+constexpr uint32_t LOCKESCALATION = 64; // record locks of a transaction on a page before it locks the page
+
+constexpr uint32_t PAGELOCK = UINT32_MAX; // Rid::_slot of a page lock
+
+constexpr auto LOCKRECHECK = std::chrono::milliseconds(10); // a waiter checks deadlock again after it
+
+/**
+ * @brief IS and IX are intention locks on a page, taken before S and X locks on its records.
+ */
+enum class LockMode : uint8_t
+{
+    IS,
+    IX,
+    S,
+    X
+};
+
+inline bool compatible(LockMode a, LockMode b)
+{
+    static constexpr bool table[4][4] = {{true, true, true, false},
+                                         {true, true, false, false},
+                                         {true, false, true, false},
+                                         {false, false, false, false}};
+    return table[int(a)][int(b)];
+}
+
+/**
+ * @brief the weakest mode which covers both, S and IX make X as there is no SIX.
+ */
+inline LockMode combine(LockMode a, LockMode b)
+{
+    if (a == b)
+        return a;
+    if (a == LockMode::X or b == LockMode::X)
+        return LockMode::X;
+    if (a == LockMode::IS)
+        return b;
+    if (b == LockMode::IS)
+        return a;
+    return LockMode::X;
+}
+
+/**
+ * @brief lock manager of records and pages.
+ * Locks are held until releaseAll, and a waiter which would close a cycle of the wait-for graph
+ * is the deadlock victim, its caller should roll back the transaction (by RecordMgr::rollback or
+ * MvccManager::abort), then call releaseAll.
+ * A transaction which locks LOCKESCALATION records of a page locks the page instead.
+ * A transaction id is used by one thread at a time.
+ */
+class LockManager
+{
+  private:
+    struct Request
+    {
+        uint64_t _txn;
+        LockMode _mode;
+    };
+
+    struct LockHead
+    {
+        std::vector<Request> _granted;
+        std::deque<Request> _waiting;
+    };
+
+    struct Partition
+    {
+        std::mutex _mutex;
+        std::condition_variable _cv;
+        robin_hood::unordered_node_map<Rid, LockHead, RidHash> _locks; // heads are kept in place while waiting
+    };
+
+    struct PageState
+    {
+        uint32_t _records = 0;  // record locks held on the page
+        bool _exclusive = false; // any of them is X
+        bool _escalated = false;
+    };
+
+    struct TxnLocks
+    {
+        robin_hood::unordered_map<Rid, LockMode, RidHash> _held;
+        robin_hood::unordered_map<Pid, PageState, PagedFile::PidHash> _pages;
+    };
+
+    Partition _partitions[LOCKPARTITIONS];
+    uint32_t _escalation;
+
+    std::mutex _graphMutex; // for _waitsFor
+    robin_hood::unordered_map<uint64_t, std::vector<uint64_t>> _waitsFor;
+
+    std::mutex _txnMutex; // for _txns, a TxnLocks is used by its transaction only
+    robin_hood::unordered_map<uint64_t, std::unique_ptr<TxnLocks>> _txns;
+
+    std::atomic<uint64_t> _waits{0};
+    std::atomic<uint64_t> _deadlocks{0};
+    std::atomic<uint64_t> _escalations{0};
+
+    Partition &partitionOf(Rid id)
+    {
+        return _partitions[RidHash()(id) % LOCKPARTITIONS];
+    }
+
+    TxnLocks &locksOf(uint64_t txn)
+    {
+        std::lock_guard<std::mutex> lk(_txnMutex);
+        auto &t = _txns[txn];
+        if (t == nullptr)
+            t = std::make_unique<TxnLocks>();
+        return *t;
+    }
+
+    /**
+     * @brief transactions txn waits for: incompatible holders, and incompatible waiters before it.
+     */
+    static std::vector<uint64_t> blockers(const LockHead &h, uint64_t txn, LockMode mode)
+    {
+        std::vector<uint64_t> res;
+        for (auto &&g : h._granted)
+        {
+            if (g._txn != txn and not compatible(g._mode, mode))
+                res.push_back(g._txn);
+        }
+        for (auto &&w : h._waiting)
+        {
+            if (w._txn == txn)
+                break;
+            if (not compatible(w._mode, mode))
+                res.push_back(w._txn);
+        }
+        return res;
+    }
+
+    /**
+     * @brief whether txn is reachable from its blockers, _graphMutex must be held
+     */
+    bool inCycle(uint64_t txn)
+    {
+        std::vector<uint64_t> stack(_waitsFor[txn]);
+        robin_hood::unordered_set<uint64_t> seen;
+        while (not stack.empty())
+        {
+            auto t = stack.back();
+            stack.pop_back();
+            if (t == txn)
+                return true;
+            if (not seen.insert(t).second)
+                continue;
+            auto pos = _waitsFor.find(t);
+            if (pos != _waitsFor.end())
+                stack.insert(stack.end(), pos->second.begin(), pos->second.end());
+        }
+        return false;
+    }
+
+    /**
+     * @brief acquire a lock on id, or a stronger mode of a lock held.
+     * An upgrade waits before other waiters.
+     * @return false if txn is a deadlock victim
+     */
+    bool acquire(uint64_t txn, Rid id, LockMode mode, TxnLocks &tl)
+    {
+        auto &p = partitionOf(id);
+        std::unique_lock<std::mutex> lk(p._mutex);
+        auto &h = p._locks[id];
+        auto held = tl._held.find(id);
+        auto upgrade = held != tl._held.end();
+        if (upgrade)
+        {
+            mode = combine(held->second, mode);
+            if (mode == held->second)
+                return true;
+        }
+        auto grant = [&] {
+            if (upgrade)
+            {
+                for (auto &&g : h._granted)
+                    g._mode = g._txn == txn ? mode : g._mode;
+            }
+            else
+                h._granted.push_back({txn, mode});
+            tl._held[id] = mode;
+        };
+        if (blockers(h, txn, mode).empty() and (upgrade or h._waiting.empty()))
+        {
+            grant();
+            return true;
+        }
+        _waits++;
+        if (upgrade)
+            h._waiting.push_front({txn, mode});
+        else
+            h._waiting.push_back({txn, mode});
+        auto leave = [&] {
+            for (auto i = h._waiting.begin(); i != h._waiting.end(); ++i)
+            {
+                if (i->_txn == txn)
+                {
+                    h._waiting.erase(i);
+                    break;
+                }
+            }
+            std::lock_guard<std::mutex> glk(_graphMutex);
+            _waitsFor.erase(txn);
+        };
+        while (true)
+        {
+            auto b = blockers(h, txn, mode);
+            if (b.empty())
+            {
+                leave();
+                grant();
+                p._cv.notify_all(); // waiters behind it may be compatible
+                return true;
+            }
+            bool victim;
+            {
+                std::lock_guard<std::mutex> glk(_graphMutex);
+                _waitsFor[txn] = std::move(b);
+                victim = inCycle(txn);
+            }
+            if (victim)
+            {
+                _deadlocks++;
+                leave();
+                if (h._granted.empty() and h._waiting.empty())
+                    p._locks.erase(id);
+                p._cv.notify_all();
+                return false;
+            }
+            p._cv.wait_for(lk, LOCKRECHECK);
+        }
+    }
+
+    void release(uint64_t txn, Rid id)
+    {
+        auto &p = partitionOf(id);
+        std::lock_guard<std::mutex> lk(p._mutex);
+        auto pos = p._locks.find(id);
+        auto &g = pos->second._granted;
+        for (auto i = g.begin(); i != g.end(); ++i)
+        {
+            if (i->_txn == txn)
+            {
+                g.erase(i);
+                break;
+            }
+        }
+        if (g.empty() and pos->second._waiting.empty())
+            p._locks.erase(pos);
+        p._cv.notify_all();
+    }
+
+    /**
+     * @brief lock page of a record in S or X, then release record locks of the page
+     */
+    bool escalate(uint64_t txn, Pid page, PageState &ps, TxnLocks &tl)
+    {
+        if (not acquire(txn, {page.fd, page.pageNum, PAGELOCK}, ps._exclusive ? LockMode::X : LockMode::S, tl))
+            return false;
+        std::vector<Rid> records;
+        for (auto &&[id, mode] : tl._held)
+        {
+            if (id._fd == page.fd and id._page == page.pageNum and id._slot != PAGELOCK)
+                records.push_back(id);
+        }
+        for (auto &&id : records)
+        {
+            release(txn, id);
+            tl._held.erase(id);
+        }
+        ps._records = 0;
+        ps._escalated = true;
+        _escalations++;
+        return true;
+    }
+
+  public:
+    LockManager(const LockManager &) = delete;
+
+    /**
+     * @param escalation record locks of a transaction on a page before it locks the page, 0 for never
+     */
+    explicit LockManager(uint32_t escalation = LOCKESCALATION) : _escalation(escalation)
+    {
+    }
+
+    /**
+     * @brief lock a record in S or X, its page is locked in IS or IX first.
+     * @return false if txn is a deadlock victim
+     */
+    bool lockRecord(uint64_t txn, Rid r, LockMode mode)
+    {
+        assert(mode == LockMode::S or mode == LockMode::X);
+        auto &tl = locksOf(txn);
+        Pid page{r._fd, r._page};
+        auto &ps = tl._pages[page];
+        auto exclusive = mode == LockMode::X;
+        if (ps._escalated)
+        {
+            if (ps._exclusive or not exclusive)
+                return true;
+            if (not acquire(txn, {r._fd, r._page, PAGELOCK}, LockMode::X, tl))
+                return false;
+            ps._exclusive = true;
+            return true;
+        }
+        if (not acquire(txn, {r._fd, r._page, PAGELOCK}, exclusive ? LockMode::IX : LockMode::IS, tl))
+            return false;
+        auto before = tl._held.count(r);
+        if (not acquire(txn, r, mode, tl))
+            return false;
+        ps._records += before == 0;
+        ps._exclusive |= exclusive;
+        if (_escalation and ps._records >= _escalation)
+            return escalate(txn, page, ps, tl);
+        return true;
+    }
+
+    /**
+     * @return false if txn is a deadlock victim
+     */
+    bool lockPage(uint64_t txn, Pid page, LockMode mode)
+    {
+        auto &tl = locksOf(txn);
+        return acquire(txn, {page.fd, page.pageNum, PAGELOCK}, mode, tl);
+    }
+
+    /**
+     * @brief release all locks of txn, at its commit or after its rollback
+     */
+    void releaseAll(uint64_t txn)
+    {
+        std::unique_ptr<TxnLocks> tl;
+        {
+            std::lock_guard<std::mutex> lk(_txnMutex);
+            auto pos = _txns.find(txn);
+            if (pos == _txns.end())
+                return;
+            tl = std::move(pos->second);
+            _txns.erase(pos);
+        }
+        for (auto &&[id, mode] : tl->_held)
+            release(txn, id);
+    }
+
+    /**
+     * @brief whether txn holds a lock on a record or page in mode or a stronger one
+     */
+    bool holds(uint64_t txn, Rid id, LockMode mode)
+    {
+        auto &tl = locksOf(txn);
+        for (auto slot : {id._slot, PAGELOCK})
+        {
+            auto pos = tl._held.find({id._fd, id._page, slot});
+            if (pos != tl._held.end() and combine(pos->second, mode) == pos->second)
+                return true;
+        }
+        return false;
+    }
+
+    uint64_t waits() const
+    {
+        return _waits;
+    }
+
+    uint64_t deadlocks() const
+    {
+        return _deadlocks;
+    }
+
+    uint64_t escalations() const
+    {
+        return _escalations;
+    }
+};
+
+/**
+ * @brief changes of a table by transactions of the log under two phase locking.
+ * A change locks its record in X for the transaction of the calling thread, which is begun if there is none.
+ * Changes themselves still take the latch of the PageManager one at a time; the locks let transactions of
+ * several threads interleave on a table without seeing each other's uncommitted records.
+ * A change returns false if the transaction is a deadlock victim, then call abort.
+ */
+class LockedTable
+{
+  private:
+    RecordManager &_rm;
+    LockManager &_lm;
+    PagedFile::LogManager &_log;
+
+    uint64_t txn()
+    {
+        return _log.current() ? _log.current() : _log.begin();
+    }
+
+  public:
+    /**
+     * @param rm a table opened after log is attached to its pool, so abort could roll back its changes
+     */
+    LockedTable(RecordManager &rm, LockManager &lm, PagedFile::LogManager &log) : _rm(rm), _lm(lm), _log(log)
+    {
+        assert(rm.getLog() == &log);
+    }
+
+    /**
+     * @brief copy record r to out under a S lock
+     */
+    bool read(Rid r, void *out)
+    {
+        if (not _lm.lockRecord(txn(), r, LockMode::S))
+            return false;
+        ArenaScope scope;
+        memcpy(out, _rm.getRecord(r, scope.arena()), _rm.getTableHeader()._recordSize);
+        return true;
+    }
+
+    /**
+     * @brief the record inserted is locked after it is inserted, nobody else could have locked its new rid.
+     */
+    bool insert(const void *data, Rid &r)
+    {
+        auto t = txn();
+        r = _rm.insertRecord(data);
+        return _lm.lockRecord(t, r, LockMode::X);
+    }
+
+    bool update(Rid r, const void *data)
+    {
+        if (not _lm.lockRecord(txn(), r, LockMode::X))
+            return false;
+        _rm.updateRecord(r, data);
+        return true;
+    }
+
+    bool remove(Rid r)
+    {
+        if (not _lm.lockRecord(txn(), r, LockMode::X))
+            return false;
+        _rm.deleteRecord(r);
+        return true;
+    }
+
+    /**
+     * @brief commit the transaction of the calling thread, then release its locks
+     */
+    void commit()
+    {
+        auto t = _log.current();
+        _log.commit();
+        if (t)
+            _lm.releaseAll(t);
+    }
+
+    /**
+     * @brief roll back the transaction of the calling thread, then release its locks
+     */
+    void abort()
+    {
+        auto t = _log.current();
+        if (t == 0)
+            return;
+        rollback(_log, t);
+        _lm.releaseAll(t);
+    }
+};
+
+} // namespace RecordMgr
+
+#endif // __SQLIGHT_LOCK__
@@ -0,0 +1,158 @@
+#if !defined(__SQLIGHT_MEMFILE__)
+#define __SQLIGHT_MEMFILE__
+
+#include "sqlight.h"
+#include <atomic>
+#include <mutex>
+#include <robin_hood.h>
+#include <string>
+#include <string_view>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+
+namespace PagedFile
+{
+
+constexpr int MEMFDBASE = 1 << 30; // virtual fds of memory files start from it, above the ones of tablespaces
+
+constexpr uint32_t MEMMAXFILES = 1 << 16; // memory files which exist at a time
+
+constexpr std::string_view MEMPREFIX = ":memory:"; // a memory file is ":memory:<name>"
+
+constexpr uint64_t MEMARENA = 1ull << 36; // bytes of address space reserved for pages of memory files, 64 GiB
+
+constexpr uint64_t MEMBUDGET = 1ull << 30; // default bytes of pages in memory, pages over it spill to a file
+
+constexpr uint32_t SPILLED = 1u << 31; // a page in the spill file, the rest of its entry is the page in the file
+
+/**
+ * @brief a file whose pages are in anonymous memory, for tables which are dropped before exit.
+ * Pages are frames of an arena reserved once, a frame is taken from a free list or the end of the arena,
+ * so neither a new page nor a write back makes a syscall. Memory is committed by the kernel on first touch.
+ * When frames of all memory files exceed the budget, new pages of a file go to its own temporary file.
+ * A memory file has a virtual fd, the cache of PageManager reads and writes it as a file on disk.
+ */
+class MemoryFile
+{
+  private:
+    std::string _name;
+    uint32_t _index;
+    std::mutex _mutex;
+    std::vector<uint32_t> _pages; // page number -> 1 + frame, SPILLED | page in spill file, or 0 for a zero page
+    int _spillFd = -1;
+    uint32_t _spillPages = 0;
+
+    // frames of the arena, shared by all memory files
+    static std::mutex _frameMutex;
+    static uint8_t *_arena;
+    static uint32_t _end; // frames taken from the arena
+    static std::vector<uint32_t> _freeFrames;
+    static uint64_t _budget;
+    static std::string _spillDir;
+
+    static robin_hood::unordered_map<std::string, MemoryFile *> &names();
+    static std::atomic<MemoryFile *> *files(); // by index, read without a lock by diskRead / diskWrite
+
+    static uint8_t *frame(uint32_t f)
+    {
+        return _arena + uint64_t(f) * PAGESIZE;
+    }
+
+    /**
+     * @return a free frame, or UINT32_MAX if frames are over the budget
+     */
+    static uint32_t allocFrame();
+
+    /**
+     * @brief location of a page which is never written, _mutex must be held.
+     */
+    uint32_t place(uint32_t pageNum);
+
+    MemoryFile(std::string_view name, uint32_t index) : _name(name), _index(index)
+    {
+    }
+
+    ~MemoryFile();
+
+  public:
+    MemoryFile(const MemoryFile &) = delete;
+
+    static bool isMemory(std::string_view path)
+    {
+        return path.substr(0, MEMPREFIX.size()) == MEMPREFIX;
+    }
+
+    static bool isVirtual(int fd)
+    {
+        return fd >= MEMFDBASE;
+    }
+
+    static MemoryFile *byFd(int fd)
+    {
+        return files()[fd - MEMFDBASE].load(std::memory_order_acquire);
+    }
+
+    /**
+     * @return nullptr if path is not a memory file which exists
+     */
+    static MemoryFile *find(std::string_view path);
+
+    static MemoryFile *create(std::string_view path);
+
+    /**
+     * @brief delete a memory file, its frames are free and its spill file is removed.
+     */
+    static void drop(std::string_view path);
+
+    /**
+     * @brief bytes of pages of all memory files in memory, pages over it spill to files.
+     * It does not move pages already in memory.
+     */
+    static void setBudget(uint64_t bytes);
+
+    /**
+     * @brief directory of spill files.
+     */
+    static void setSpillDir(std::string_view dir)
+    {
+        _spillDir = dir;
+    }
+
+    /**
+     * @brief bytes of frames in use by all memory files
+     */
+    static uint64_t used();
+
+    int fd() const
+    {
+        return MEMFDBASE + _index;
+    }
+
+    std::string path() const
+    {
+        return std::string(MEMPREFIX) + _name;
+    }
+
+    /**
+     * @brief read n pages from pageNum, pages never written are zero.
+     * @return bytes read
+     */
+    ssize_t read(uint32_t pageNum, const struct iovec *iov, int n);
+
+    ssize_t write(uint32_t pageNum, const void *data);
+
+    /**
+     * @brief pages of the file, including pages never written before the last one written
+     */
+    uint32_t pages();
+
+    /**
+     * @brief pages in the spill file
+     */
+    uint32_t spilled();
+};
+
+} // namespace PagedFile
+
+#endif // __SQLIGHT_MEMFILE__
@@ -0,0 +1,510 @@
+#if !defined(__SQLIGHT_MVCC__)
+#define __SQLIGHT_MVCC__
+
+#include "pagedFile.h"
+#include "record.h"
+#include "wal.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
+// multi-version concurrency control
+namespace RecordMgr
+{
+
+constexpr uint32_t MVCCSHARDS = 64; // partitions of the version store
+
+constexpr uint32_t MVCCGCINTERVAL = 1024; // commits between garbage collections
+
+constexpr uint64_t ABORTED = UINT64_MAX; // Transaction::_commitTs of an aborted transaction
+
+/**
+ * @brief a transaction of MvccManager, it is used by one thread.
+ * It reads a snapshot of committed records at _startTs.
+ */
+struct Transaction
+{
+    uint64_t _startTs;
+    std::atomic<uint64_t> _commitTs{0}; // 0 while it is active
+    std::vector<Rid> _writes;           // records changed, in order
+};
+
+using TxnPtr = std::shared_ptr<Transaction>;
+
+/**
+ * @brief MVCC over tables, old versions of records are kept in memory as undo chains.
+ * Records in a table are the newest versions, a record without undo chain is visible to all.
+ * A version is visible to a transaction if its writer committed before the transaction started.
+ * Writers of a record conflict if the first is active or committed after the second started (first updater wins).
+ * A deleted record stays in its table until no snapshot could see it.
+ * Lock order is the latch of PageManager, then a shard.
+ */
+class MvccManager
+{
+  private:
+    struct Version
+    {
+        TxnPtr _writer;                   // nullptr for a version older than all snapshots
+        bool _deleted = false;            // the record does not exist in this version
+        std::unique_ptr<uint8_t[]> _data; // nullptr for the newest version, which is in the table
+        std::unique_ptr<Version> _older;
+    };
+
+    struct Shard
+    {
+        std::mutex _mutex;
+        robin_hood::unordered_map<Rid, std::unique_ptr<Version>, RidHash> _chains;
+    };
+
+    PagedFile::LogManager *_log;
+    Shard _shards[MVCCSHARDS];
+
+    std::mutex _clockMutex; // for _clock and _snapshots
+    uint64_t _clock = 0;    // last commit timestamp
+    std::multiset<uint64_t> _snapshots;
+    uint64_t _commits = 0;
+
+    std::mutex _tablesMutex;
+    robin_hood::unordered_map<int, RecordManager> _tables; // tables changed, for deleting records
+
+    std::atomic<int64_t> _versions{0}; // old versions kept
+
+    std::mutex _pinMutex;                                                 // for _pinned
+    robin_hood::unordered_map<Pid, uint32_t, PagedFile::PidHash> _pinned; // pages copied by iterators, with counts
+
+    Shard &shardOf(Rid r)
+    {
+        return _shards[RidHash()(r) % MVCCSHARDS];
+    }
+
+    static bool visible(const TxnPtr &writer, const Transaction *txn)
+    {
+        if (writer == nullptr or writer.get() == txn)
+            return true;
+        auto ts = writer->_commitTs.load();
+        return ts != 0 and ts != ABORTED and ts <= txn->_startTs;
+    }
+
+    /**
+     * @brief version of record r visible to txn, shard of r must be held.
+     * @param current the record in table
+     * @return nullptr if not visible
+     */
+    const uint8_t *resolve(const Transaction *txn, Shard &s, Rid r, const uint8_t *current)
+    {
+        auto pos = s._chains.find(r);
+        if (pos == s._chains.end())
+            return current;
+        for (auto v = pos->second.get(); v; v = v->_older.get())
+        {
+            if (visible(v->_writer, txn))
+                return v->_deleted ? nullptr : (v->_data ? v->_data.get() : current);
+        }
+        return nullptr;
+    }
+
+    void track(RecordManager &rm)
+    {
+        std::lock_guard<std::mutex> lk(_tablesMutex);
+        if (not _tables.count(rm.getFd()))
+            _tables.emplace(rm.getFd(), rm);
+    }
+
+    RecordManager tableOf(int fd)
+    {
+        std::lock_guard<std::mutex> lk(_tablesMutex);
+        return _tables.at(fd);
+    }
+
+    /**
+     * @brief records of a page copied by an iterator are not removed from the table, as the copy would show them
+     * without undo chains. Pin it before the copy.
+     */
+    void pin(Pid p)
+    {
+        std::lock_guard<std::mutex> lk(_pinMutex);
+        _pinned[p]++;
+    }
+
+    void unpin(Pid p)
+    {
+        std::lock_guard<std::mutex> lk(_pinMutex);
+        auto pos = _pinned.find(p);
+        if (--pos->second == 0)
+            _pinned.erase(pos);
+    }
+
+    // latch must be held, so a page is pinned either before this or before a copy after the removal
+    bool pinned(Pid p)
+    {
+        std::lock_guard<std::mutex> lk(_pinMutex);
+        return _pinned.count(p);
+    }
+
+    /**
+     * @brief begin a log transaction for the first write of a transaction, after the write is known not to
+     * conflict, so commit and abort which end it for a transaction with writes always find it.
+     */
+    void beginWrite()
+    {
+        if (_log and _log->current() == 0)
+            _log->begin();
+    }
+
+    /**
+     * @brief make txn the writer of record r, its old version is pushed to undo chain.
+     * Latch and shard of r must be held.
+     * @return false if it conflicts with another writer, or the record is deleted
+     */
+    bool claim(const TxnPtr &txn, RecordManager &rm, Shard &s, Rid r)
+    {
+        auto &head = s._chains[r];
+        if (head == nullptr)
+            head = std::make_unique<Version>();
+        if (head->_writer != txn)
+        {
+            auto &w = head->_writer;
+            if (w and (w->_commitTs == 0 or w->_commitTs == ABORTED or w->_commitTs > txn->_startTs))
+                return false;
+            if (head->_deleted)
+                return false;
+            auto v = std::make_unique<Version>();
+            v->_writer = txn;
+            head->_data = rm.getRecord(r);
+            v->_older = std::move(head);
+            head = std::move(v);
+            _versions++;
+            txn->_writes.push_back(r);
+        }
+        return not head->_deleted;
+    }
+
+  public:
+    MvccManager(const MvccManager &) = delete;
+
+    /**
+     * @param log changes of a transaction are also a transaction of the log if it is not nullptr
+     */
+    explicit MvccManager(PagedFile::LogManager *log = nullptr) : _log(log)
+    {
+    }
+
+    TxnPtr begin()
+    {
+        auto txn = std::make_shared<Transaction>();
+        std::lock_guard<std::mutex> lk(_clockMutex);
+        txn->_startTs = _clock;
+        _snapshots.insert(txn->_startTs);
+        return txn;
+    }
+
+    /**
+     * @brief changes are durable before they are visible.
+     */
+    void commit(const TxnPtr &txn)
+    {
+        assert(txn->_commitTs == 0);
+        if (_log and not txn->_writes.empty())
+            _log->commit();
+        bool gc;
+        {
+            std::lock_guard<std::mutex> lk(_clockMutex);
+            txn->_commitTs = ++_clock;
+            _snapshots.erase(_snapshots.find(txn->_startTs));
+            gc = ++_commits % MVCCGCINTERVAL == 0;
+        }
+        if (gc)
+            collect();
+    }
+
+    /**
+     * @brief restore records changed by txn from undo chains.
+     * A record inserted by txn on a page pinned by an iterator is left deleted in its chain, for collect.
+     */
+    void abort(const TxnPtr &txn)
+    {
+        assert(txn->_commitTs == 0);
+        txn->_commitTs = ABORTED;
+        for (auto i = txn->_writes.rbegin(); i != txn->_writes.rend(); ++i)
+        {
+            auto rm = tableOf(i->_fd);
+            std::lock_guard<std::recursive_mutex> latch(rm.getPageManager()->latch());
+            auto &s = shardOf(*i);
+            std::lock_guard<std::mutex> lk(s._mutex);
+            auto pos = s._chains.find(*i);
+            auto &head = pos->second;
+            assert(head->_writer == txn);
+            auto older = std::move(head->_older);
+            if (older->_deleted and pinned({i->_fd, i->_page}))
+                head = std::move(older);
+            else if (older->_deleted) // inserted by txn
+            {
+                rm.deleteRecord(*i);
+                s._chains.erase(pos);
+            }
+            else
+            {
+                rm.updateRecord(*i, older->_data.get());
+                older->_data.reset();
+                head = std::move(older);
+            }
+            _versions--;
+        }
+        if (_log and not txn->_writes.empty())
+            _log->commit(); // the changes and their restores are both durable
+        std::lock_guard<std::mutex> lk(_clockMutex);
+        _snapshots.erase(_snapshots.find(txn->_startTs));
+    }
+
+    /**
+     * @brief copy version of record r visible to txn to out.
+     * @return false if no version is visible
+     */
+    bool read(const TxnPtr &txn, const RecordManager &rm, Rid r, void *out)
+    {
+        std::lock_guard<std::recursive_mutex> latch(rm.getPageManager()->latch());
+        auto &s = shardOf(r);
+        std::lock_guard<std::mutex> lk(s._mutex);
+        const uint8_t *current = rm.isRecord(r) ? rm.getRecordPointer(r) : nullptr;
+        auto v = resolve(txn.get(), s, r, current);
+        if (v)
+            memcpy(out, v, rm.getTableHeader()._recordSize);
+        return v != nullptr;
+    }
+
+    Rid insert(const TxnPtr &txn, RecordManager &rm, const void *data)
+    {
+        beginWrite();
+        track(rm);
+        std::lock_guard<std::recursive_mutex> latch(rm.getPageManager()->latch());
+        auto r = rm.insertRecord(data);
+        auto &s = shardOf(r);
+        std::lock_guard<std::mutex> lk(s._mutex);
+        auto &head = s._chains[r];
+        assert(head == nullptr);
+        head = std::make_unique<Version>();
+        head->_writer = txn;
+        head->_older = std::make_unique<Version>();
+        head->_older->_deleted = true;
+        _versions++;
+        txn->_writes.push_back(r);
+        return r;
+    }
+
+    /**
+     * @return false on conflict, txn should be aborted
+     */
+    bool update(const TxnPtr &txn, RecordManager &rm, Rid r, const void *data)
+    {
+        track(rm);
+        std::lock_guard<std::recursive_mutex> latch(rm.getPageManager()->latch());
+        auto &s = shardOf(r);
+        std::lock_guard<std::mutex> lk(s._mutex);
+        if (not claim(txn, rm, s, r))
+            return false;
+        beginWrite();
+        rm.updateRecord(r, data);
+        return true;
+    }
+
+    /**
+     * @brief the record is deleted from its table by collect, after no snapshot could see it.
+     * @return false on conflict, txn should be aborted
+     */
+    bool remove(const TxnPtr &txn, RecordManager &rm, Rid r)
+    {
+        track(rm);
+        std::lock_guard<std::recursive_mutex> latch(rm.getPageManager()->latch());
+        auto &s = shardOf(r);
+        std::lock_guard<std::mutex> lk(s._mutex);
+        if (not claim(txn, rm, s, r))
+            return false;
+        beginWrite();
+        s._chains[r]->_deleted = true;
+        return true;
+    }
+
+    /**
+     * @brief free versions no snapshot could see, and delete records deleted before all snapshots.
+     * @return versions freed
+     */
+    size_t collect()
+    {
+        uint64_t oldest;
+        {
+            std::lock_guard<std::mutex> lk(_clockMutex);
+            oldest = _snapshots.empty() ? _clock : *_snapshots.begin();
+        }
+        auto old = [&](const TxnPtr &w) {
+            return w == nullptr or (w->_commitTs != 0 and w->_commitTs != ABORTED and w->_commitTs <= oldest);
+        };
+        size_t freed = 0;
+        std::vector<Rid> deleted;
+        for (auto &&s : _shards)
+        {
+            std::lock_guard<std::mutex> lk(s._mutex);
+            for (auto i = s._chains.begin(); i != s._chains.end();)
+            {
+                auto v = i->second.get();
+                while (v and not old(v->_writer))
+                    v = v->_older.get();
+                if (v == nullptr)
+                {
+                    ++i;
+                    continue;
+                }
+                for (auto o = v->_older.get(); o; o = o->_older.get())
+                    freed++;
+                v->_older.reset();
+                if (v == i->second.get() and not v->_deleted) // newest version is visible to all
+                {
+                    i = s._chains.erase(i);
+                    continue;
+                }
+                if (v == i->second.get())
+                    deleted.push_back(i->first);
+                ++i;
+            }
+        }
+        // records deleted are removed from tables with the latch, then their chains
+        for (auto &&r : deleted)
+        {
+            auto rm = tableOf(r._fd);
+            std::lock_guard<std::recursive_mutex> latch(rm.getPageManager()->latch());
+            auto &s = shardOf(r);
+            std::lock_guard<std::mutex> lk(s._mutex);
+            auto pos = s._chains.find(r);
+            if (pos == s._chains.end() or not pos->second->_deleted or pos->second->_older or
+                not old(pos->second->_writer) or pinned({r._fd, r._page}))
+                continue;
+            rm.deleteRecord(r);
+            s._chains.erase(pos);
+        }
+        _versions -= freed;
+        return freed;
+    }
+
+    /**
+     * @brief old versions kept in memory
+     */
+    int64_t versions() const
+    {
+        return _versions;
+    }
+
+    /**
+     * @brief iterator of records visible to a transaction.
+     * A page is copied at a time, so writers are not blocked by it. The page is pinned while it is copied,
+     * so records of the copy are not removed with their undo chains before they are resolved.
+     */
+    class Iterator
+    {
+      private:
+        MvccManager *_mvcc;
+        TxnPtr _txn;
+        const RecordManager *_rm;
+        std::unique_ptr<uint8_t, decltype(&std::free)> _page{nullptr, &std::free};
+        std::vector<uint8_t> _record;
+        Rid _r;
+        bool _end = false;
+        bool _pinning = false; // page _r._page is pinned
+
+        void unpin()
+        {
+            if (_pinning)
+                _mvcc->unpin({_r._fd, _r._page});
+            _pinning = false;
+        }
+
+        // find the next visible record from slot _r._slot of page _r._page
+        void seek()
+        {
+            auto &th = _rm->getTableHeader();
+            auto recordSize = th._recordSize;
+            while (_r._page <= th._existsPageNum)
+            {
+                if (_r._slot == 0)
+                {
+                    if (_rm->isZonePage(_r._page))
+                    {
+                        _r._page++;
+                        continue;
+                    }
+                    _mvcc->pin({_r._fd, _r._page});
+                    _pinning = true;
+                    _rm->getPageManager()->readPage({_r._fd, _r._page}, _page.get());
+                }
+                auto bm = BitMap(_page.get() + sizeof(PageHeader), _rm->getBitmapSize());
+                auto base = _rm->getSlotBase(_page.get());
+                for (auto pos = bm.nextBit(_r._slot, true); pos < th._slotsPerPage; pos = bm.nextBit(pos + 1, true))
+                {
+                    Rid r{_r._fd, _r._page, pos};
+                    auto &s = _mvcc->shardOf(r);
+                    std::lock_guard<std::mutex> lk(s._mutex);
+                    auto v = _mvcc->resolve(_txn.get(), s, r, base + pos * recordSize);
+                    if (v)
+                    {
+                        _record.assign(v, v + recordSize);
+                        _r._slot = pos;
+                        return;
+                    }
+                }
+                unpin();
+                _r._page++;
+                _r._slot = 0;
+            }
+            _end = true;
+        }
+
+      public:
+        Iterator(MvccManager *mvcc, TxnPtr txn, const RecordManager *rm)
+            : _mvcc(mvcc), _txn(std::move(txn)), _rm(rm), _r{rm->getFd(), rm->firstDataPage(), 0}
+        {
+            _page.reset(static_cast<uint8_t *>(aligned_alloc(PAGESIZE, PAGESIZE)));
+            seek();
+        }
+
+        Iterator(const Iterator &) = delete;
+
+        ~Iterator()
+        {
+            unpin();
+        }
+
+        bool end() const
+        {
+            return _end;
+        }
+
+        Iterator &operator++()
+        {
+            _r._slot++;
+            seek();
+            return *this;
+        }
+
+        Rid getRid() const
+        {
+            return _r;
+        }
+
+        const uint8_t *operator*() const
+        {
+            return _record.data();
+        }
+    };
+
+    /**
+     * @brief records of a table visible to txn
+     */
+    Iterator scan(const TxnPtr &txn, const RecordManager &rm)
+    {
+        return Iterator(this, txn, &rm);
+    }
+};
+
+} // namespace RecordMgr
+
+#endif // __SQLIGHT_MVCC__
@@ -0,0 +1,201 @@
+#if !defined(__SQLIGHT_OPTIMIZER__)
+#define __SQLIGHT_OPTIMIZER__
+
+#include "exec.h"
+#include "record.h"
+#include <array>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief statistics of tables collected by analyze, and a cost model which chooses access paths and join orders.
+ * Statistics of a table are kept in a file next to it, the path of the table with STATSSUFFIX.
+ */
+namespace Optimizer
+{
+
+constexpr uint32_t STATSBUCKETS = 32; // buckets of an equi-depth histogram
+
+constexpr uint32_t STATSSAMPLE = 1024; // data pages read by analyze, a smaller table is read entirely
+
+constexpr int HLLBITS = 12; // a HyperLogLog has 2^HLLBITS registers, standard error is about 1.6%
+
+// costs in units of reading a page sequentially from disk
+constexpr double SEQPAGECOST = 1;
+
+constexpr double RANDPAGECOST = 4; // a page read out of order
+
+constexpr double CACHEDPAGECOST = 0.05; // a page in the page cache
+
+constexpr double ROWCOST = 0.01; // evaluating a predicate on a row
+
+/**
+ * @brief distinct count estimation of a stream of hashes, in 2^HLLBITS bytes.
+ */
+class HyperLogLog
+{
+  private:
+    std::array<uint8_t, 1 << HLLBITS> _registers{};
+
+  public:
+    void add(uint64_t hash)
+    {
+        auto idx = hash >> (64 - HLLBITS);
+        uint8_t rank = __builtin_clzll((hash << HLLBITS) | (1ull << (HLLBITS - 1))) + 1;
+        _registers[idx] = std::max(_registers[idx], rank);
+    }
+
+    void merge(const HyperLogLog &other)
+    {
+        for (size_t i = 0; i < _registers.size(); i++)
+            _registers[i] = std::max(_registers[i], other._registers[i]);
+    }
+
+    double estimate() const;
+};
+
+struct ColumnStats
+{
+    uint64_t _distinct;   // estimated distinct values in the table
+    float _nullFraction;  // fraction of empty values, a CHAR of all '\0', there is no NULL in a record
+    float _pageSpread;    // average fraction of rows between min and max of a page, small if the column is clustered
+    uint32_t _buckets;    // buckets of the histogram, 0 if no row was sampled
+    uint32_t _reserved;
+    uint64_t _bounds[STATSBUCKETS + 1]; // normalized keys, _bounds[0] is min, bucket i is (_bounds[i], _bounds[i+1]]
+
+    /**
+     * @brief estimated fraction of rows whose normalized key <= key
+     */
+    double cdf(uint64_t key) const;
+
+    /**
+     * @brief estimated fraction of rows which satisfy `column op key`
+     */
+    double selectivity(Exec::CmpOp op, uint64_t key, bool exact) const;
+};
+
+struct TableStats
+{
+    uint64_t _rows;          // records when analyzed
+    uint32_t _pages;         // data pages when analyzed
+    uint32_t _sampledPages;  // data pages read by analyze
+    uint64_t _sampledRows;
+    uint32_t _columnCount;
+    uint32_t _reserved;
+    ColumnStats _columns[MAXCOLUMNS];
+};
+
+/**
+ * @brief sample pages of a table and build statistics of every column, they are kept by saveStats.
+ * @param samplePages data pages to read, pages are chosen at random
+ */
+TableStats analyze(const RecordMgr::RecordManager &rm, uint32_t samplePages = STATSSAMPLE);
+
+/**
+ * @brief keep statistics of a table in its statistics file, path is the path which the table is opened by
+ */
+void saveStats(std::string_view table, const TableStats &stats);
+
+/**
+ * @return false if the table has no statistics
+ */
+bool loadStats(std::string_view table, TableStats &stats);
+
+/**
+ * @brief remove statistics of a table, RecordFileManager::deleteTable removes them with the table
+ */
+void dropStats(std::string_view table);
+
+/**
+ * @brief fraction of data pages of a table in its pool, by a sample of pages
+ */
+double residency(const RecordMgr::RecordManager &rm);
+
+enum class Access
+{
+    FULLSCAN, // read all pages
+    ZONESCAN  // read zone pages and pages whose zone entries overlap the predicate
+};
+
+struct AccessPath
+{
+    Access _access;
+    double _rows;  // estimated rows out of the predicate
+    double _pages; // estimated data pages read
+    double _cost;
+};
+
+/**
+ * @brief the cheapest way to get rows of `column op value` from a table.
+ * A value of an integer column is rounded by op and compared to the range of the column, see Exec::intMatch.
+ * @param stats statistics of the table, or nullptr to guess from the table header
+ */
+AccessPath chooseAccess(const RecordMgr::RecordManager &rm, const TableStats *stats, uint32_t col, Exec::CmpOp op,
+                        double value);
+
+AccessPath chooseAccess(const RecordMgr::RecordManager &rm, const TableStats *stats, uint32_t col, Exec::CmpOp op,
+                        int64_t value);
+
+/**
+ * @brief operators which produce rows of `column op value` by the cheapest access path, all columns of the table
+ */
+Exec::OperatorPtr planScan(const RecordMgr::RecordManager &rm, const TableStats *stats, uint32_t col,
+                           Exec::CmpOp op, double value, AccessPath *path = nullptr);
+
+Exec::OperatorPtr planScan(const RecordMgr::RecordManager &rm, const TableStats *stats, uint32_t col,
+                           Exec::CmpOp op, int64_t value, AccessPath *path = nullptr);
+
+/**
+ * @brief an input of an equi-join on one key
+ */
+struct Relation
+{
+    double _rows;
+    double _distinct; // distinct values of the join key
+};
+
+/**
+ * @brief estimated result of joining two relations on their keys, by containment of the smaller key set
+ */
+inline Relation joinEstimate(const Relation &a, const Relation &b)
+{
+    auto d = std::max({a._distinct, b._distinct, 1.0});
+    return {a._rows * b._rows / d, std::min(a._distinct, b._distinct)};
+}
+
+/**
+ * @brief a left deep order of relations joined on the same key, which keeps intermediate results small.
+ * Each join should build its hash table from the smaller input, see HashJoinOp.
+ * @return indexes of relations in join order
+ */
+std::vector<uint32_t> joinOrder(const std::vector<Relation> &rels);
+
+/**
+ * @brief an input of planJoin, rows of _op joined on its column _key, INT32 or INT64
+ */
+struct JoinInput
+{
+    Exec::OperatorPtr _op;
+    uint32_t _key;
+    Relation _rel; // estimated size, see relationOf
+};
+
+/**
+ * @brief hash joins of inputs on the same key, left deep in the order of joinOrder.
+ * Every join builds its hash table from its smaller input, so columns of the result are not in order of inputs.
+ * @param columns if not nullptr, index of the first column of every input in the result
+ */
+Exec::OperatorPtr planJoin(std::vector<JoinInput> inputs, std::vector<uint32_t> *columns = nullptr);
+
+/**
+ * @brief a relation of a column of an analyzed table, after a predicate of selectivity
+ */
+inline Relation relationOf(const TableStats &stats, uint32_t col, double selectivity = 1)
+{
+    auto rows = stats._rows * selectivity;
+    return {rows, std::min(double(stats._columns[col]._distinct), std::max(rows, 1.0))};
+}
+
+} // namespace Optimizer
+
+#endif // __SQLIGHT_OPTIMIZER__
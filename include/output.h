@@ -0,0 +1,199 @@
+#if !defined(__SQLIGHT_OUTPUT__)
+#define __SQLIGHT_OUTPUT__
+
+#include "exec.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fmt/format.h>
+#include <unistd.h>
+
+namespace Exec
+{
+
+constexpr size_t OUTPUTFLUSH = 1 << 20; // bytes formatted before a write to the output
+
+enum class OutputFormat
+{
+    CSV,   // fields separated by ',', a CHAR field with ',', '"' or a line break is quoted
+    TSV,   // fields separated by '\t', \t, \n, \r and \\ escape a tab, line breaks and a backslash in a CHAR field
+    BINARY // rows of columns packed in order, the table layout if all columns are selected
+};
+
+/**
+ * @brief format rows of batches into a buffer which is written to a fd in large blocks.
+ * The buffer is reused, rows are streamed as batches come so a result is never materialized.
+ */
+class ResultWriter
+{
+  private:
+    int _fd;
+    OutputFormat _format;
+    fmt::memory_buffer _buf;
+    uint64_t _rows = 0;
+    bool _failed = false;
+
+    /**
+     * @brief append a TSV field, a tab, line break or backslash is escaped
+     */
+    void escape(const char *p, const char *e)
+    {
+        for (; p < e; p++)
+        {
+            char x = *p == '\t' ? 't' : *p == '\n' ? 'n' : *p == '\r' ? 'r' : *p == '\\' ? '\\' : 0;
+            if (x)
+                _buf.push_back('\\');
+            _buf.push_back(x ? x : *p);
+        }
+    }
+
+    void text(const Vector *v, uint32_t row)
+    {
+        auto &c = v->column();
+        switch (c._type)
+        {
+        case ColumnType::INT32: {
+            fmt::format_int s(v->data<int32_t>()[row]);
+            _buf.append(s.data(), s.data() + s.size());
+            break;
+        }
+        case ColumnType::INT64: {
+            fmt::format_int s(v->data<int64_t>()[row]);
+            _buf.append(s.data(), s.data() + s.size());
+            break;
+        }
+        case ColumnType::FLOAT64:
+            fmt::format_to(std::back_inserter(_buf), "{}", v->data<double>()[row]);
+            break;
+        default: {
+            auto p = reinterpret_cast<const char *>(v->raw()) + size_t(row) * c._size;
+            auto e = p + strnlen(p, c._size);
+            if (_format == OutputFormat::TSV)
+            {
+                escape(p, e);
+                break;
+            }
+            auto special = [](char x) { return x == ',' or x == '"' or x == '\n' or x == '\r'; };
+            if (std::none_of(p, e, special))
+            {
+                _buf.append(p, e);
+                break;
+            }
+            _buf.push_back('"');
+            for (; p < e; p++)
+            {
+                if (*p == '"')
+                    _buf.push_back('"');
+                _buf.push_back(*p);
+            }
+            _buf.push_back('"');
+        }
+        }
+    }
+
+  public:
+    ResultWriter() = delete;
+    ResultWriter(const ResultWriter &) = delete;
+    ResultWriter(int fd, OutputFormat format) : _fd(fd), _format(format)
+    {
+        _buf.reserve(OUTPUTFLUSH + OUTPUTFLUSH / 4);
+    }
+
+    ~ResultWriter()
+    {
+        flush();
+    }
+
+    /**
+     * @brief a line of column names, nothing for binary
+     */
+    void header(const std::vector<Column> &schema)
+    {
+        if (_format == OutputFormat::BINARY)
+            return;
+        auto delim = _format == OutputFormat::CSV ? ',' : '\t';
+        for (size_t i = 0; i < schema.size(); i++)
+        {
+            if (i)
+                _buf.push_back(delim);
+            _buf.append(schema[i]._name, schema[i]._name + strnlen(schema[i]._name, MAXCOLUMNNAME));
+        }
+        _buf.push_back('\n');
+    }
+
+    /**
+     * @brief append alive rows of a batch, the buffer is written out when it is full
+     */
+    void write(const Batch &b)
+    {
+        auto delim = _format == OutputFormat::CSV ? ',' : '\t';
+        for (uint32_t i = 0; i < b.size(); i++)
+        {
+            auto row = b.rowAt(i);
+            for (size_t c = 0; c < b._cols.size(); c++)
+            {
+                auto v = b._cols[c];
+                if (_format == OutputFormat::BINARY)
+                {
+                    auto p = v->raw() + size_t(row) * v->width();
+                    _buf.append(p, p + v->width());
+                    continue;
+                }
+                if (c)
+                    _buf.push_back(delim);
+                text(v, row);
+            }
+            if (_format != OutputFormat::BINARY)
+                _buf.push_back('\n');
+            if (_buf.size() >= OUTPUTFLUSH)
+                flush();
+        }
+        _rows += b.size();
+    }
+
+    /**
+     * @brief write all rows of an operator
+     * @return rows written
+     */
+    uint64_t drain(Operator &op)
+    {
+        for (const Batch *b; not _failed and (b = op.next());)
+            write(*b);
+        flush();
+        return _rows;
+    }
+
+    /**
+     * @brief write buffered bytes to the fd, a closed pipe or a full disk fails the writer and later rows are
+     * dropped
+     */
+    void flush()
+    {
+        size_t done = 0;
+        while (not _failed and done < _buf.size())
+        {
+            auto n = ::write(_fd, _buf.data() + done, _buf.size() - done);
+            if (n < 0 and errno == EINTR)
+                continue;
+            if (n <= 0)
+                _failed = true;
+            else
+                done += n;
+        }
+        _buf.clear();
+    }
+
+    uint64_t rows() const
+    {
+        return _rows;
+    }
+
+    bool failed() const
+    {
+        return _failed;
+    }
+};
+
+} // namespace Exec
+
+#endif // __SQLIGHT_OUTPUT__
@@ -1,23 +1,65 @@
 #if !defined(__SQLIGHT_PAGEDFILE__)
 #define __SQLIGHT_PAGEDFILE__
 
+#include "checksum.h"
+#include "disk.h"
 #include "sqlight.h"
+#include "trace.h"
+#include "wal.h"
+#include <atomic>
 #include <cassert>
+#include <cstddef>
 #include <cstdlib>
 #include <fcntl.h>
 #include <fmt/format.h>
 #include <list>
 #include <memory>
+#include <mutex>
 #include <queue>
 #include <robin_hood.h>
 #include <string>
 #include <string_view>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <vector>
 
 namespace PagedFile
 {
 
+constexpr uint32_t PREFETCHSHARE = 4; // PageManager::prefetch loads at most 1/PREFETCHSHARE of the cache
+
+constexpr uint32_t EVICTSCAN = 16; // pages looked at from the tail of LRU for one whose log is durable
+
+/**
+ * @brief CRC32C of a page, without PageHeader::_checksum.
+ */
+inline uint32_t pageChecksum(const uint8_t *data)
+{
+    constexpr uint32_t off = offsetof(PageHeader, _checksum), end = off + sizeof(PageHeader::_checksum);
+    return crc32c(data + end, PAGESIZE - end, crc32c(data, off));
+}
+
+inline void setPageChecksum(uint8_t *data)
+{
+    reinterpret_cast<PageHeader *>(data)->_checksum = pageChecksum(data);
+}
+
+/**
+ * @brief whether a page read from disk is intact, a page never written is all zero.
+ */
+inline bool verifyPage(const uint8_t *data)
+{
+    if (reinterpret_cast<const PageHeader *>(data)->_checksum == pageChecksum(data))
+        return true;
+    for (uint32_t i = 0; i < PAGESIZE; i++)
+    {
+        if (data[i])
+            return false;
+    }
+    return true;
+}
+
 struct PidHash
 {
     size_t operator()(const Pid &p) const
@@ -35,6 +77,33 @@ struct Page
     Pid _id;
     uint8_t *_data; // pointer to cache
     bool _dirty;
+    bool _pending;    // changed by a operation which is not logged yet, could not be evicted
+    uint64_t _lsn;    // lsn of the last log record of this page, 0 if it is not logged
+    uint64_t _recLsn; // lsn of the first log record since this page was written back
+};
+
+/**
+ * @brief bind memory to a NUMA node, pages of it which are touched later are allocated on the node.
+ * @return false if it could not be bound, such as on a kernel without NUMA
+ */
+bool bindToNode(void *addr, size_t len, int node);
+
+/**
+ * @return NUMA node of the cpu running this thread
+ */
+int currentNode();
+
+/**
+ * @return NUMA nodes of this machine, 1 without NUMA
+ */
+int numaNodes();
+
+struct PoolStats
+{
+    uint64_t _hits;      // pages found in cache
+    uint64_t _misses;    // pages read from disk
+    uint64_t _evictions; // pages evicted to make room for another page
+    uint64_t _writes;    // pages written back
 };
 
 /**
@@ -46,7 +115,9 @@ class PageManager
 {
   private:
     std::unique_ptr<uint8_t, decltype(&std::free)> _cache{nullptr, &std::free};
-    Page _page[CACHESIZE];
+    std::unique_ptr<Page[]> _page;
+    uint32_t _capacity; // pages of cache
+    int _node;          // NUMA node of cache, -1 for no binding
 
     std::list<Page *> _usedPage;
 
@@ -54,6 +125,17 @@ class PageManager
 
     std::priority_queue<Page *, std::vector<Page *>, std::greater<Page *>> _unusedPage;
 
+    // public methods are thread safe, but a Page * is only safe to use by one thread at a time.
+    std::recursive_mutex _latch;
+
+    LogManager *_log = nullptr;
+
+    robin_hood::unordered_set<int> _unsynced; // files written since last sync
+
+    bool _verify = true; // verify checksums of pages read from disk
+
+    std::atomic<uint64_t> _hits{0}, _misses{0}, _evictions{0}, _writes{0};
+
     /**
      * @brief write back a page to disk
      *
@@ -63,46 +145,235 @@ class PageManager
     {
         if (p->_dirty)
         {
-            lseek(p->_id.fd, p->_id.pageNum * PAGESIZE, SEEK_SET);
-            auto wsize = write(p->_id.fd, p->_data, PAGESIZE);
+            TRACE_SCOPE("PageManager::writeToDisk");
+            if (_log and p->_lsn) // write ahead
+                _log->flush(p->_lsn);
+            setPageChecksum(p->_data);
+            auto wsize = diskWrite(p->_id.fd, p->_id.pageNum, p->_data);
             assert(wsize == PAGESIZE);
+            _writes.fetch_add(1, std::memory_order_relaxed);
+            _unsynced.insert(p->_id.fd);
             p->_dirty = false;
+            p->_recLsn = 0;
         }
     }
 
+    /**
+     * @brief make log records of dirty pages of a file durable before they are written back, so writeToDisk does
+     * not wait for the log while holding the latch
+     * @param fd -1 for all files
+     */
+    void flushLog(int fd = -1)
+    {
+        LogManager *log;
+        uint64_t lsn = 0;
+        {
+            std::lock_guard<std::recursive_mutex> lk(_latch);
+            log = _log;
+            for (auto &&p : _usedPage)
+            {
+                if (p->_dirty and (fd == -1 or p->_id.fd == fd))
+                    lsn = std::max(lsn, p->_lsn);
+            }
+        }
+        if (log and lsn)
+            log->flush(lsn);
+    }
+
     ssize_t readFromDisk(Page *p)
     {
-        lseek(p->_id.fd, p->_id.pageNum * PAGESIZE, SEEK_SET);
-        return read(p->_id.fd, p->_data, PAGESIZE);
+        TRACE_SCOPE("PageManager::readFromDisk");
+        auto nread = diskRead(p->_id.fd, p->_id.pageNum, p->_data);
+        if (nread == PAGESIZE)
+            mustVerify(p->_id, p->_data);
+        return nread;
+    }
+
+    /**
+     * @brief take a free frame for page p, evict the least recently used page if cache is full.
+     * The frame is not loaded.
+     */
+    Page *allocPage(Pid p)
+    {
+        if (_unusedPage.empty())
+        {
+            TRACE_SCOPE("PageManager::evict");
+            // the least recently used page which is clean or whose log records are durable, so eviction does not
+            // wait for the log, else the least recently used page which is not pending
+            auto durable = _log ? _log->flushedLsn() : 0;
+            auto victim = _usedPage.rend(), oldest = _usedPage.rend();
+            uint32_t looked = 0;
+            for (auto i = _usedPage.rbegin(); i != _usedPage.rend() and looked < EVICTSCAN; ++i)
+            {
+                if ((*i)->_pending)
+                    continue;
+                looked++;
+                if (oldest == _usedPage.rend())
+                    oldest = i;
+                if (not(*i)->_dirty or not _log or (*i)->_lsn < durable)
+                {
+                    victim = i;
+                    break;
+                }
+            }
+            if (victim == _usedPage.rend())
+                victim = oldest;
+            if (victim == _usedPage.rend())
+            {
+                // every page is changed by the operation of this thread, which holds the latch,
+                // its records are appended as a group now so the pages could be written back
+                if (_log == nullptr)
+                {
+                    fmt::print(stderr, "no page could be evicted from a cache of {} pages\n", _capacity);
+                    std::abort();
+                }
+                _log->appendOp();
+                victim = _usedPage.rbegin();
+            }
+            flush(*victim, true);
+            _evictions.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        assert(not _unusedPage.empty());
+        auto ans = _unusedPage.top();
+        _unusedPage.pop();
+
+        ans->_dirty = false;
+        ans->_pending = false;
+        ans->_lsn = ans->_recLsn = 0;
+        ans->_id = p;
+        _usedPage.push_front(ans);
+        _hashm[p] = _usedPage.begin();
+        return ans;
     }
 
   public:
     PageManager(const PageManager &) = delete;
 
-    PageManager()
+    /**
+     * @param capacity pages of cache
+     * @param node NUMA node which memory of cache is bound to, -1 for the default policy of os
+     */
+    explicit PageManager(uint32_t capacity = CACHESIZE, int node = -1)
+        : _page(new Page[capacity]), _capacity(capacity), _node(node)
     {
-        auto p = aligned_alloc(4096, PAGESIZE * CACHESIZE); // for direct_io
+        assert(capacity > 0);
+        auto p = aligned_alloc(4096, size_t(PAGESIZE) * capacity); // for direct_io
         assert(p != nullptr);
         _cache.reset(static_cast<uint8_t *>(p));
-        for (int i = 0; i < CACHESIZE; i++)
+        if (node >= 0 and not bindToNode(p, size_t(PAGESIZE) * capacity, node))
+            _node = -1;
+        for (uint32_t i = 0; i < capacity; i++)
         {
-            _page[i]._data = _cache.get() + i * PAGESIZE;
+            _page[i]._data = _cache.get() + size_t(i) * PAGESIZE;
             _page[i]._dirty = false;
+            _page[i]._pending = false;
+            _page[i]._lsn = _page[i]._recLsn = 0;
             _unusedPage.emplace(&(_page[i]));
         }
     }
     ~PageManager()
     {
         flushAll(false);
+        for (auto &&fd : _unsynced) // allocations of tablespaces are written by sync
+        {
+            if (isVirtualFd(fd))
+                diskSync(fd);
+        }
+    }
+
+    /**
+     * @brief write ahead log of pages, a page is written back after its log records are durable.
+     * Pages are not logged without it.
+     */
+    void attachLog(LogManager *log)
+    {
+        std::lock_guard<std::recursive_mutex> lk(_latch);
+        _log = log;
+    }
+
+    LogManager *getLog() const
+    {
+        return _log;
+    }
+
+    uint32_t capacity() const
+    {
+        return _capacity;
+    }
+
+    /**
+     * @brief counters since the PageManager is created or resetStats
+     */
+    PoolStats stats() const
+    {
+        return {_hits.load(std::memory_order_relaxed), _misses.load(std::memory_order_relaxed),
+                _evictions.load(std::memory_order_relaxed), _writes.load(std::memory_order_relaxed)};
+    }
+
+    void resetStats()
+    {
+        _hits = _misses = _evictions = _writes = 0;
+    }
+
+    /**
+     * @brief pages in cache
+     */
+    uint32_t cached()
+    {
+        std::lock_guard<std::recursive_mutex> lk(_latch);
+        return _hashm.size();
+    }
+
+    /**
+     * @return NUMA node of cache, -1 if it is not bound
+     */
+    int node() const
+    {
+        return _node;
+    }
+
+    /**
+     * @brief verify checksums of pages read from disk or not, checksums are always written.
+     */
+    void setVerify(bool verify)
+    {
+        _verify = verify;
+    }
+
+    /**
+     * @brief verify the checksum of a page read from disk, a mismatch is reported.
+     * @return false if the page is corrupted, such as by a torn write, recovery rebuilds it from the log
+     */
+    bool verify(Pid p, const uint8_t *data)
+    {
+        if (_verify and not verifyPage(data))
+        {
+            fmt::print(stderr, "checksum mismatch of page {} of fd {}\n", p.pageNum, p.fd);
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief a corrupted page out of recovery is fatal, as a torn write or bit rot would spread by changes of it.
+     */
+    void mustVerify(Pid p, const uint8_t *data)
+    {
+        if (not verify(p, data))
+            std::abort();
     }
 
     bool isInCache(Pid p)
     {
+        std::lock_guard<std::recursive_mutex> lk(_latch);
         return _hashm.count(p);
     }
 
     Page *getPage(Pid p)
     {
+        TRACE_SCOPE("PageManager::getPage");
+        std::lock_guard<std::recursive_mutex> lk(_latch);
         Page *ans = nullptr;
         auto pos = _hashm.find(p);
         if (pos != _hashm.end())
@@ -111,22 +382,12 @@ class PageManager
             _usedPage.erase(pos->second);
             _usedPage.push_front(ans);
             _hashm[p] = _usedPage.begin();
+            _hits.fetch_add(1, std::memory_order_relaxed);
         }
         else
         {
-            if (_unusedPage.empty())
-            {
-                flush(_usedPage.back(), true);
-            }
-
-            assert(not _unusedPage.empty());
-            ans = _unusedPage.top();
-            _unusedPage.pop();
-
-            ans->_dirty = false;
-            ans->_id = p;
-            _usedPage.push_front(ans);
-            _hashm[p] = _usedPage.begin();
+            _misses.fetch_add(1, std::memory_order_relaxed);
+            ans = allocPage(p);
             auto nread = readFromDisk(ans);
             assert(nread == 0 or nread == PAGESIZE);
             if (nread == 0) // beyond eof
@@ -135,6 +396,117 @@ class PageManager
         return ans;
     }
 
+    /**
+     * @brief copy a page to dst.
+     * A page not in cache is read from disk directly without caching it, dst must be aligned to PAGESIZE.
+     */
+    void readPage(Pid p, uint8_t *dst)
+    {
+        TRACE_SCOPE("PageManager::readPage");
+        {
+            std::lock_guard<std::recursive_mutex> lk(_latch);
+            auto pos = _hashm.find(p);
+            if (pos != _hashm.end())
+            {
+                memcpy(dst, (*pos->second)->_data, PAGESIZE);
+                _hits.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+        }
+        _misses.fetch_add(1, std::memory_order_relaxed);
+        auto nread = diskRead(p.fd, p.pageNum, dst);
+        assert(nread == 0 or nread == PAGESIZE);
+        if (nread == 0) // beyond eof
+            memset(dst, 0, PAGESIZE);
+        else
+            mustVerify(p, dst);
+    }
+
+    /**
+     * @brief latch of this PageManager.
+     * Hold it to use Page * got from this PageManager while other threads are using it.
+     */
+    std::recursive_mutex &latch()
+    {
+        return _latch;
+    }
+
+    /**
+     * @brief get a zeroed page without reading it from disk, for appending pages beyond eof.
+     * Old content of the page is discarded if it is cached.
+     */
+    Page *newPage(Pid p)
+    {
+        std::lock_guard<std::recursive_mutex> lk(_latch);
+        auto pos = _hashm.find(p);
+        auto ans = pos != _hashm.end() ? getPage(p) : allocPage(p);
+        memset(ans->_data, 0, PAGESIZE);
+        ans->_dirty = true;
+        return ans;
+    }
+
+    /**
+     * @brief load pages [first, first + count) of a file into cache.
+     * Missing pages which are adjacent are read by one preadv. At most 1/PREFETCHSHARE of the cache is loaded,
+     * so pages loaded are not evicted by each other in a small cache, the rest are left to getPage.
+     */
+    void prefetch(int fd, uint32_t first, uint32_t count)
+    {
+        TRACE_SCOPE("PageManager::prefetch");
+        std::lock_guard<std::recursive_mutex> lk(_latch);
+        count = std::min(count, std::max(1u, _capacity / PREFETCHSHARE));
+        constexpr uint32_t MAXIOV = 64;
+        struct iovec iov[MAXIOV];
+        Page *frames[MAXIOV];
+        uint32_t i = 0;
+        while (i < count)
+        {
+            if (isInCache({fd, first + i}))
+            {
+                i++;
+                continue;
+            }
+            uint32_t start = first + i, n = 0;
+            while (i < count and n < MAXIOV and not isInCache({fd, first + i}))
+            {
+                frames[n] = allocPage({fd, first + i});
+                iov[n].iov_base = frames[n]->_data;
+                iov[n].iov_len = PAGESIZE;
+                n++, i++;
+            }
+            auto nread = diskRead(fd, start, iov, n);
+            assert(nread >= 0 and nread % PAGESIZE == 0);
+            _misses.fetch_add(n, std::memory_order_relaxed);
+            for (uint32_t k = 0; k < nread / PAGESIZE; k++)
+                mustVerify(frames[k]->_id, frames[k]->_data);
+            for (uint32_t k = nread / PAGESIZE; k < n; k++) // beyond eof
+                memset(frames[k]->_data, 0, PAGESIZE);
+        }
+    }
+
+    /**
+     * @brief load pages of a file into cache, pages are sorted and distinct.
+     * Missing pages are read under the latch in page order, a run of adjacent pages by one preadv. Tables are
+     * opened with O_DIRECT and nothing is read ahead by the os, the gain is fewer reads and a sequential order.
+     */
+    void prefetchPages(int fd, const uint32_t *pages, uint32_t n)
+    {
+        TRACE_SCOPE("PageManager::prefetchPages");
+        std::lock_guard<std::recursive_mutex> lk(_latch);
+        std::vector<std::pair<uint32_t, uint32_t>> runs; // first page and count of adjacent missing pages
+        for (uint32_t i = 0; i < n; i++)
+        {
+            if (isInCache({fd, pages[i]}))
+                continue;
+            if (not runs.empty() and runs.back().first + runs.back().second == pages[i])
+                runs.back().second++;
+            else
+                runs.push_back({pages[i], 1});
+        }
+        for (auto &&[first, count] : runs)
+            prefetch(fd, first, count);
+    }
+
     /**
      * @brief write back a page to disk ,maybe remove it from cache
      *
@@ -143,6 +515,7 @@ class PageManager
      */
     void flush(Page *p, bool release = false)
     {
+        std::lock_guard<std::recursive_mutex> lk(_latch);
         writeToDisk(p);
         if (release)
         {
@@ -153,8 +526,64 @@ class PageManager
         }
     }
 
+    /**
+     * @brief dirty pages which are logged, with their recLsn. For checkpoints.
+     */
+    std::vector<std::pair<Pid, uint64_t>> dirtyPages()
+    {
+        std::lock_guard<std::recursive_mutex> lk(_latch);
+        std::vector<std::pair<Pid, uint64_t>> ans;
+        for (auto &&i : _usedPage)
+        {
+            if (i->_dirty and i->_recLsn)
+                ans.emplace_back(i->_id, i->_recLsn);
+        }
+        return ans;
+    }
+
+    /**
+     * @brief write back a page if it is cached and dirty, the page stays in cache.
+     * @return whether it is written
+     */
+    bool writeBack(Pid p)
+    {
+        std::lock_guard<std::recursive_mutex> lk(_latch);
+        auto pos = _hashm.find(p);
+        if (pos == _hashm.end() or not(*pos->second)->_dirty or (*pos->second)->_pending)
+            return false;
+        writeToDisk(*pos->second);
+        return true;
+    }
+
+    /**
+     * @brief fdatasync files written since last sync, without holding the latch.
+     */
+    void syncAll()
+    {
+        std::vector<int> fds;
+        {
+            std::lock_guard<std::recursive_mutex> lk(_latch);
+            fds.assign(_unsynced.begin(), _unsynced.end());
+            _unsynced.clear();
+        }
+        for (auto &&fd : fds)
+            diskSync(fd);
+    }
+
+    /**
+     * @brief fdatasync a file if it is written since last sync.
+     */
+    void syncFile(int fd)
+    {
+        std::lock_guard<std::recursive_mutex> lk(_latch);
+        if (_unsynced.erase(fd))
+            diskSync(fd);
+    }
+
     void flushAll(bool release = false)
     {
+        flushLog();
+        std::lock_guard<std::recursive_mutex> lk(_latch);
         for (auto &&i : _usedPage)
         {
             writeToDisk(i);
@@ -171,8 +600,34 @@ class PageManager
         }
     }
 
+    /**
+     * @brief release all pages of a file from cache without write back.
+     * For temporary files which are going to be deleted.
+     */
+    void discardAllByFd(int fd)
+    {
+        std::lock_guard<std::recursive_mutex> lk(_latch);
+        _unsynced.erase(fd);
+        auto i = _usedPage.begin();
+        while (i != _usedPage.end())
+        {
+            if ((*i)->_id.fd == fd)
+            {
+                (*i)->_dirty = false;
+                _hashm.erase((*i)->_id);
+                _unusedPage.emplace(*i);
+                i = _usedPage.erase(i);
+                continue;
+            }
+            ++i;
+        }
+    }
+
     void flushAllByFd(int fd, bool release = false)
     {
+        TRACE_SCOPE("PageManager::flushAllByFd");
+        flushLog(fd);
+        std::lock_guard<std::recursive_mutex> lk(_latch);
         // if (FileManager::getPathByFd(fd).empty()) //! not found 错误：‘FileManager’未声明
         // return;
         auto i = _usedPage.begin();
@@ -197,10 +652,47 @@ class PageManager
 /**
  * @brief Get a Page Manager object for fiel cache.
  * One PageManager can manage more than one file.
+ * It is the local pool of the NUMA node of this thread if there is one, or the default pool.
  * @return PageManager& reference
  */
 PageManager *getPageManager();
 
+/**
+ * @brief create a named pool of pages, such as "hot" for critical tables and "archive" for bulk jobs,
+ * so tables of a pool never evict pages of another pool.
+ * @param capacity memory quota of the pool, in pages
+ * @param node NUMA node which memory of the pool is bound to, -1 for no binding
+ * @param local the pool is preferred by getPageManager for threads running on node
+ */
+PageManager *createPool(std::string_view name, uint32_t capacity, int node = -1, bool local = false);
+
+/**
+ * @return nullptr if there is no such pool, "default" is the pool of getPageManager
+ */
+PageManager *getPool(std::string_view name);
+
+/**
+ * @brief destroy a pool after all files of it are closed, pages of it are written back.
+ */
+void dropPool(std::string_view name);
+
+/**
+ * @brief cache pages of a table or a file in a pool when it is created or opened.
+ * A file which is open stays in its pool until it is closed.
+ */
+void assignPool(std::string_view path, std::string_view name);
+
+/**
+ * @return pool for a file to be opened, assigned to path by assignPool, or getPageManager()
+ */
+PageManager *choosePool(std::string_view path);
+
+/**
+ * @return pool chosen when path was opened, which caches it until it is deleted, or choosePool(path) if it has not
+ * been opened
+ */
+PageManager *poolOf(std::string_view path);
+
 void destoryAllPageManager();
 
 /**
@@ -214,8 +706,37 @@ class FileManager
     // ? maybe useless
     static robin_hood::unordered_map<std::string, int> _path2fd;
     static robin_hood::unordered_map<int, std::string> _fd2path;
+    static robin_hood::unordered_map<std::string, PageManager *> _path2pool; // chosen when a file is opened
+    static std::string _tempDir;
 
   public:
+    /**
+     * @brief set directory of temporary files, default is current directory.
+     */
+    static void setTempDir(std::string_view dir)
+    {
+        _tempDir = dir;
+        MemoryFile::setSpillDir(dir);
+    }
+
+    /**
+     * @brief get a unused path for a temporary file in temporary directory.
+     */
+    static std::string tempPath()
+    {
+        static std::atomic<uint64_t> cnt{0};
+        return fmt::format("{}/sqlight-{}-{}.tmp", _tempDir, getpid(), cnt++);
+    }
+
+    /**
+     * @brief get a unused path for a memory file.
+     */
+    static std::string memoryPath()
+    {
+        static std::atomic<uint64_t> cnt{0};
+        return fmt::format("{}sqlight-{}", MEMPREFIX, cnt++);
+    }
+
     static int getFdByPath(std::string_view path)
     {
         auto pos = _path2fd.find(path.data());
@@ -240,6 +761,15 @@ class FileManager
      */
     static std::string isFile(std::string_view path)
     {
+        if (MemoryFile::isMemory(path))
+            return MemoryFile::find(path) ? std::string(path) : "";
+        if (auto [space, name] = Tablespace::split(path); not name.empty())
+        {
+            auto ts = Tablespace::open(space);
+            if (ts == nullptr or ts->find(name) == 0)
+                return "";
+            return ts->path() + std::string(TSSEP) + name;
+        }
         struct stat st;
         if (stat(path.data(), &st) == 0 and S_ISREG(st.st_mode))
         {
@@ -261,13 +791,50 @@ class FileManager
         {
             return pos->second;
         }
-        int fd = open(path.data(), O_RDWR | O_DIRECT | O_ASYNC);
+        int fd;
+        if (MemoryFile::isMemory(path))
+            fd = MemoryFile::find(path)->fd();
+        else if (auto [space, name] = Tablespace::split(path); not name.empty())
+        {
+            auto ts = Tablespace::open(space);
+            fd = ts->fdOf(ts->find(name));
+        }
+        else
+            fd = open(path.data(), O_RDWR | O_DIRECT | O_ASYNC);
         assert(fd != -1);
         _path2fd[fpath] = fd;
         _fd2path[fd] = fpath;
+        _path2pool[fpath] = choosePool(path);
         return fd;
     }
 
+    /**
+     * @return pool chosen when a file was opened, nullptr if it has not been opened since it was created
+     * @param fpath full path, see isFile
+     */
+    static PageManager *poolOfPath(const std::string &fpath)
+    {
+        auto pos = _path2pool.find(fpath);
+        return pos == _path2pool.end() ? nullptr : pos->second;
+    }
+
+    /**
+     * @return pool of an open file
+     */
+    static PageManager *poolOfFd(int fd)
+    {
+        return _path2pool.at(_fd2path.at(fd));
+    }
+
+    /**
+     * @brief forget files of a pool which is dropped
+     */
+    static void forgetPool(PageManager *pm)
+    {
+        for (auto i = _path2pool.begin(); i != _path2pool.end();)
+            i = i->second == pm ? _path2pool.erase(i) : std::next(i);
+    }
+
     /**
      * @brief close a file.
      * All pages must have been write back to disk before close.
@@ -279,8 +846,11 @@ class FileManager
         auto pos = _fd2path.find(fd);
         assert(pos != _fd2path.end());
         pm.flushAllByFd(fd, true);
+        if (pm.getLog() or isVirtualFd(fd)) // metadata of a tablespace is written by sync
+            pm.syncFile(fd);
 
-        close(fd);
+        if (not isVirtualFd(fd))
+            close(fd);
         _path2fd.erase(pos->second);
         _fd2path.erase(pos);
     }
@@ -288,6 +858,16 @@ class FileManager
     {
         auto fpath = isFile(path);
         assert(fpath.empty()); // file already exists
+        if (MemoryFile::isMemory(path))
+        {
+            MemoryFile::create(path);
+            return;
+        }
+        if (auto [space, name] = Tablespace::split(path); not name.empty())
+        {
+            Tablespace::open(space, true)->create(name);
+            return;
+        }
         int fd = open(path.data(), O_CREAT, S_IRUSR | S_IWUSR);
         assert(fd != -1);
         close(fd);
@@ -297,6 +877,18 @@ class FileManager
         auto fpath = isFile(path);
         assert(fpath.size());
         assert(_path2fd.count(fpath) == 0);
+        _path2pool.erase(fpath);
+        if (MemoryFile::isMemory(path))
+        {
+            MemoryFile::drop(path);
+            return;
+        }
+        if (auto [space, name] = Tablespace::split(path); not name.empty())
+        {
+            auto ts = Tablespace::open(space);
+            ts->drop(ts->find(name));
+            return;
+        }
         unlink(path.data());
     }
 };
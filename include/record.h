@@ -1,78 +1,184 @@
 #if !defined(__SQLIGHT_RECORD__)
 #define __SQLIGHT_RECORD__
 
+#include "arena.h"
 #include "bitwise.h"
 #include "pagedFile.h"
 #include "sqlight.h"
+#include <algorithm>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <vector>
 // Record Manager
 namespace RecordMgr
 {
 
+constexpr uint32_t OPPAGESHARE = 8; // an operation of insertRecords fills at most 1/OPPAGESHARE of the cache
+
+constexpr uint32_t MULTIGETPAGES = 256; // pages read in a batch by RecordManager::getRecords, at most 1/4 of the pool
+
+/**
+ * @brief size of a zone entry of a page in bytes
+ * @param zoneColumns bitmask of columns with zone map
+ */
+static uint32_t calZoneEntrySize(uint32_t zoneColumns)
+{
+    return 2 * sizeof(uint32_t) + 2 * sizeof(uint64_t) * __builtin_popcount(zoneColumns);
+}
+
+/**
+ * @brief TableHeader of a table, which is in the first page after PageHeader.
+ */
+inline TableHeader *tableHeaderOf(uint8_t *firstPage)
+{
+    return reinterpret_cast<TableHeader *>(firstPage + sizeof(PageHeader));
+}
+
+struct RidHash
+{
+    size_t operator()(const Rid &r) const
+    {
+        auto h = PagedFile::PidHash()({r._fd, r._page});
+        h ^= robin_hood::hash_int(r._slot) + 0x9e3779b9 + (h << 6) + (h >> 2);
+        return h;
+    }
+};
+
 /**
  * @brief Record manager of a table
  *
  */
 class RecordManager
 {
+    friend class RecordFileManager;
+
   private:
     int _fd;
     PagedFile::PageManager *_pm;
-    TableHeader _th;
+    std::shared_ptr<TableHeader> _th; // shared by copies of a RecordManager of the same table
+    PagedFile::LogManager *_log;       // nullptr for a table without logging
+    uint32_t _fileId;                  // id of the table in log records
+
+    /**
+     * @brief a change of the table.
+     * The latch of PageManager is held, and log records of the change are appended as a group.
+     */
+    class Op
+    {
+      private:
+        std::lock_guard<std::recursive_mutex> _lk;
+        PagedFile::LogManager *_log;
+
+      public:
+        explicit Op(const RecordManager *rm) : _lk(rm->_pm->latch()), _log(rm->_log)
+        {
+            if (_log)
+                _log->beginOp();
+        }
+        ~Op()
+        {
+            if (_log)
+                _log->endOp();
+        }
+    };
+
+    /**
+     * @brief bytes [ptr, ptr + len) of page p have been changed.
+     */
+    void logChange(PagedFile::Page *p, const void *ptr, uint32_t len)
+    {
+        p->_dirty = true;
+        if (_log)
+            _log->logPage(p, _fileId, static_cast<const uint8_t *>(ptr) - p->_data, len);
+    }
+
+    /**
+     * @brief how to undo a change of a record, before is the old record.
+     */
+    void logUndo(PagedFile::LogType type, Rid r, const uint8_t *before = nullptr)
+    {
+        if (_log)
+            _log->logUndo(type, _fileId, r._page, r._slot, before, before ? _th->_recordSize : 0);
+    }
+
+    void writeTableHeader()
+    {
+        Op op(this);
+        auto p = _pm->getPage({_fd, 0});
+        memcpy(tableHeaderOf(p->_data), _th.get(), sizeof(TableHeader));
+        logChange(p, tableHeaderOf(p->_data), sizeof(TableHeader));
+    }
 
     void setFileHeader(uint32_t _existsPageNum, uint32_t _nextPage, uint32_t totalRecord)
     {
-        this->_th._existsPageNum = _existsPageNum;
-        this->_th._nextPage = _nextPage;
-        this->_th._totalRecords = totalRecord;
+        this->_th->_existsPageNum = _existsPageNum;
+        this->_th->_nextPage = _nextPage;
+        this->_th->_totalRecords = totalRecord;
         auto p = _pm->getPage({_fd, 0});
-        auto th = reinterpret_cast<TableHeader *>(p->_data);
+        auto th = tableHeaderOf(p->_data);
         if (th->_existsPageNum != _existsPageNum or th->_nextPage != _nextPage or th->_totalRecords != totalRecord)
-            p->_dirty = true;
-        th->_existsPageNum = _existsPageNum;
-        th->_nextPage = _nextPage;
-        th->_totalRecords = totalRecord;
+        {
+            th->_existsPageNum = _existsPageNum;
+            th->_nextPage = _nextPage;
+            th->_totalRecords = totalRecord;
+            // _existsPageNum, _slotsPerPage, _nextPage, _totalRecords
+            logChange(p, &th->_existsPageNum, 4 * sizeof(uint32_t));
+        }
+    }
+
+    /**
+     * @brief mark a free slot of page p used
+     */
+    void takeSlot(PagedFile::Page *p, uint32_t slot)
+    {
+        auto ph = reinterpret_cast<PageHeader *>(p->_data);
+        auto bm = BitMap(p->_data + sizeof(PageHeader), getBitmapSize());
+        assert(not bm.get(slot));
+        bm.set(slot);
+        if (ph->_nextSlot == slot)
+            ph->_nextSlot = bm.nextBit(slot + 1);
+        logChange(p, p->_data + sizeof(PageHeader) + slot / BYTEINBITS, 1);
+        logChange(p, &ph->_nextSlot, sizeof(ph->_nextSlot));
     }
 
     Rid getFreeSlot()
     {
-        if (_th._existsPageNum == 0 and _th._nextPage == 1)
+        TRACE_SCOPE("RecordManager::getFreeSlot");
+        if (_th->_existsPageNum == 0 and _th->_nextPage == 1)
         {
-            setFileHeader(1, 1, _th._totalRecords);
+            setFileHeader(1, 1, _th->_totalRecords);
         }
         Rid rid;
         rid._fd = this->_fd;
-        auto p = _pm->getPage({_fd, _th._nextPage});
+        auto p = _pm->getPage({_fd, _th->_nextPage});
         auto ph = reinterpret_cast<PageHeader *>(p->_data);
-        auto bm = BitMap(p->_data + sizeof(PageHeader), ceil(_th._slotsPerPage, BYTEINBITS));
-        if (ph->_nextSlot < _th._slotsPerPage)
+        if (ph->_nextSlot < _th->_slotsPerPage)
         {
-            rid._page = this->_th._nextPage;
+            rid._page = this->_th->_nextPage;
             rid._slot = ph->_nextSlot;
-            bm.set(rid._slot);
-            ph->_nextSlot = bm.nextBit(ph->_nextSlot + 1);
-            p->_dirty = true;
+            takeSlot(p, rid._slot);
         }
         else
         {
             // this page is full
-            auto npid = _th._nextPage; // bug fixed
+            auto npid = _th->_nextPage; // bug fixed
             while (true)
             {
-                auto np = _pm->getPage({_fd, ++npid});
+                if (isZonePage(++npid))
+                    continue;
+                auto np = _pm->getPage({_fd, npid});
                 auto nph = reinterpret_cast<PageHeader *>(np->_data);
-                if (nph->_nextSlot < _th._slotsPerPage)
+                if (nph->_nextSlot < _th->_slotsPerPage)
                 {
                     rid._page = npid;
                     rid._slot = nph->_nextSlot;
-                    auto bm = BitMap(np->_data + sizeof(PageHeader), ceil(_th._slotsPerPage, BYTEINBITS));
-                    bm.set(nph->_nextSlot);
-                    nph->_nextSlot = bm.nextBit(nph->_nextSlot + 1);
-                    np->_dirty = true;
+                    takeSlot(np, rid._slot);
                     break;
                 }
             }
         }
-        setFileHeader(std::max(_th._existsPageNum, rid._page), rid._page, _th._totalRecords + 1);
+        setFileHeader(std::max(_th->_existsPageNum, rid._page), rid._page, _th->_totalRecords + 1);
         return rid;
     }
 
@@ -81,12 +187,136 @@ class RecordManager
     {
         auto p = _pm->getPage({r._fd, r._page});
         auto ph = reinterpret_cast<PageHeader *>(p->_data);
-        auto bm = BitMap(p->_data + sizeof(PageHeader), ceil(_th._slotsPerPage, BYTEINBITS));
+        auto bm = BitMap(p->_data + sizeof(PageHeader), ceil(_th->_slotsPerPage, BYTEINBITS));
         assert(bm.get(r._slot));
         ph->_nextSlot = std::min(ph->_nextSlot, r._slot);
         bm.reset(r._slot);
-        p->_dirty = true;
-        setFileHeader(_th._existsPageNum, std::min(_th._nextPage, r._page), _th._totalRecords - 1);
+        logChange(p, p->_data + sizeof(PageHeader) + r._slot / BYTEINBITS, 1);
+        logChange(p, &ph->_nextSlot, sizeof(ph->_nextSlot));
+        setFileHeader(_th->_existsPageNum, std::min(_th->_nextPage, r._page), _th->_totalRecords - 1);
+    }
+
+    // zone map: if TableHeader::_zoneSpan != 0, page 1 + k * _zoneSpan is a zone page,
+    // it keeps a ZoneEntry for every page in [1 + k * _zoneSpan, (k + 1) * _zoneSpan].
+    // A ZoneEntry is followed by min and max of every column in TableHeader::_zoneColumns.
+    struct ZoneEntry
+    {
+        uint32_t _count; // records of the page
+        uint32_t _reserved;
+    };
+
+    /**
+     * @brief index of a column in zone entries
+     * @return -1 if the column has no zone map
+     */
+    int zoneIndex(uint32_t col) const
+    {
+        if (not(_th->_zoneColumns & (1u << col)))
+            return -1;
+        return __builtin_popcount(_th->_zoneColumns & ((1u << col) - 1));
+    }
+
+    /**
+     * @brief normalized values of zone columns of a record
+     */
+    void zoneKeys(const uint8_t *record, uint64_t *keys) const
+    {
+        int n = 0;
+        for (uint32_t c = 0; c < _th->_columnCount; c++)
+        {
+            if (_th->_zoneColumns & (1u << c))
+                keys[n++] = normalizeKey(record + _th->_columns[c]._offset, _th->_columns[c]);
+        }
+    }
+
+    uint32_t zonePageOf(uint32_t page) const
+    {
+        return (page - 1) / _th->_zoneSpan * _th->_zoneSpan + 1;
+    }
+
+    ZoneEntry *getZoneEntry(uint32_t page) const
+    {
+        auto zp = _pm->getPage({_fd, zonePageOf(page)});
+        auto entrySize = calZoneEntrySize(_th->_zoneColumns);
+        return reinterpret_cast<ZoneEntry *>(zp->_data + sizeof(PageHeader) + (page - 1) % _th->_zoneSpan * entrySize);
+    }
+
+    void markZoneDirty(uint32_t page)
+    {
+        auto zp = _pm->getPage({_fd, zonePageOf(page)});
+        logChange(zp, getZoneEntry(page), calZoneEntrySize(_th->_zoneColumns));
+    }
+
+    static uint64_t *zoneBounds(ZoneEntry *e)
+    {
+        return reinterpret_cast<uint64_t *>(e + 1); // min, max of every zone column
+    }
+
+    void zoneAdd(uint32_t page, const uint64_t *keys)
+    {
+        auto e = getZoneEntry(page);
+        auto b = zoneBounds(e);
+        auto n = __builtin_popcount(_th->_zoneColumns);
+        for (int i = 0; i < n; i++)
+        {
+            b[i * 2] = e->_count == 0 ? keys[i] : std::min(b[i * 2], keys[i]);
+            b[i * 2 + 1] = e->_count == 0 ? keys[i] : std::max(b[i * 2 + 1], keys[i]);
+        }
+        e->_count++;
+        markZoneDirty(page);
+    }
+
+    /**
+     * @brief rebuild zone entry of a page from its records
+     */
+    void zoneRecompute(uint32_t page)
+    {
+        auto n = __builtin_popcount(_th->_zoneColumns);
+        std::vector<uint64_t> keys(n), bounds(n * 2);
+        uint32_t count = 0;
+        auto p = _pm->getPage({_fd, page});
+        auto bm = BitMap(p->_data + sizeof(PageHeader), getBitmapSize());
+        auto base = getSlotBase(p->_data);
+        for (uint32_t i = 0; i < _th->_slotsPerPage; i++)
+        {
+            if (not bm.get(i))
+                continue;
+            zoneKeys(base + i * _th->_recordSize, keys.data());
+            for (int k = 0; k < n; k++)
+            {
+                bounds[k * 2] = count == 0 ? keys[k] : std::min(bounds[k * 2], keys[k]);
+                bounds[k * 2 + 1] = count == 0 ? keys[k] : std::max(bounds[k * 2 + 1], keys[k]);
+            }
+            count++;
+        }
+        auto e = getZoneEntry(page);
+        e->_count = count;
+        memcpy(zoneBounds(e), bounds.data(), bounds.size() * sizeof(uint64_t));
+        markZoneDirty(page);
+    }
+
+    /**
+     * @brief old values of a record are gone, page entry is rebuilt only if an old value was a bound.
+     * @param removed true for a deleted record, false for a updated record.
+     */
+    void zoneRemove(uint32_t page, const uint64_t *oldKeys, bool removed)
+    {
+        auto e = getZoneEntry(page);
+        auto b = zoneBounds(e);
+        auto n = __builtin_popcount(_th->_zoneColumns);
+        bool bound = false;
+        for (int i = 0; i < n; i++)
+            bound = bound or oldKeys[i] == b[i * 2] or oldKeys[i] == b[i * 2 + 1];
+        if (bound)
+        {
+            zoneRecompute(page);
+            return;
+        }
+        if (removed)
+        {
+            e->_count--;
+            markZoneDirty(page);
+        }
     }
 
     const uint8_t *readSlot(Rid r) const
@@ -94,10 +324,10 @@ class RecordManager
         assert(r._page >= 1);
         auto p = _pm->getPage({r._fd, r._page});
         auto ph = reinterpret_cast<PageHeader *>(p->_data);
-        auto bm = BitMap(p->_data + sizeof(PageHeader), ceil(_th._slotsPerPage, BYTEINBITS));
+        auto bm = BitMap(p->_data + sizeof(PageHeader), ceil(_th->_slotsPerPage, BYTEINBITS));
         assert(bm.get(r._slot));
         const uint8_t *pointer =
-            p->_data + sizeof(PageHeader) + ceil(_th._slotsPerPage, BYTEINBITS) + _th._recordSize * r._slot;
+            p->_data + sizeof(PageHeader) + ceil(_th->_slotsPerPage, BYTEINBITS) + _th->_recordSize * r._slot;
         return pointer;
     }
 
@@ -105,17 +335,48 @@ class RecordManager
     {
         assert(r._page >= 1);
         auto p = _pm->getPage({r._fd, r._page});
-        auto bm = BitMap(p->_data + sizeof(PageHeader), ceil(_th._slotsPerPage, BYTEINBITS));
+        auto bm = BitMap(p->_data + sizeof(PageHeader), ceil(_th->_slotsPerPage, BYTEINBITS));
         assert(bm.get(r._slot));
         uint8_t *pointer =
-            p->_data + sizeof(PageHeader) + ceil(_th._slotsPerPage, BYTEINBITS) + _th._recordSize * r._slot;
-        p->_dirty = true;
-        memcpy(pointer, data, _th._recordSize);
+            p->_data + sizeof(PageHeader) + ceil(_th->_slotsPerPage, BYTEINBITS) + _th->_recordSize * r._slot;
+        memcpy(pointer, data, _th->_recordSize);
+        logChange(p, pointer, _th->_recordSize);
+    }
+
+    /**
+     * @brief write a record into a slot just taken
+     */
+    void putRecord(Rid rid, const uint8_t *data)
+    {
+        logUndo(PagedFile::LogType::INSERT, rid);
+        writeSlot(rid, data);
+        if (hasZoneMap())
+        {
+            uint64_t keys[MAXCOLUMNS];
+            zoneKeys(data, keys);
+            zoneAdd(rid._page, keys);
+        }
+    }
+
+    /**
+     * @brief insert a record into slot r, or another slot if r has been used.
+     */
+    Rid insertRecordAt(Rid r, const uint8_t *data)
+    {
+        Op op(this);
+        if (r._page > _th->_existsPageNum or isRecord(r))
+            return insertRecord(data);
+        takeSlot(_pm->getPage({_fd, r._page}), r._slot);
+        setFileHeader(_th->_existsPageNum, _th->_nextPage, _th->_totalRecords + 1);
+        putRecord(r, data);
+        return r;
     }
 
   public:
     RecordManager() = delete;
-    RecordManager(int fd, PagedFile::PageManager *pm, TableHeader th) : _pm(pm), _fd(fd), _th(th)
+    RecordManager(int fd, PagedFile::PageManager *pm, std::shared_ptr<TableHeader> th,
+                  PagedFile::LogManager *log = nullptr, uint32_t fileId = 0)
+        : _pm(pm), _fd(fd), _th(std::move(th)), _log(log), _fileId(fileId)
     {
         ;
     }
@@ -128,7 +389,7 @@ class RecordManager
     bool isRecord(Rid r) const
     {
         auto p = _pm->getPage({r._fd, r._page});
-        auto bm = BitMap(p->_data + sizeof(PageHeader), ceil(_th._slotsPerPage, BYTEINBITS));
+        auto bm = BitMap(p->_data + sizeof(PageHeader), ceil(_th->_slotsPerPage, BYTEINBITS));
         return bm.get(r._slot);
     }
 
@@ -141,27 +402,239 @@ class RecordManager
     // get record copy
     std::unique_ptr<uint8_t[]> getRecord(Rid r) const
     {
-        auto ptr = std::make_unique<uint8_t[]>(_th._recordSize);
+        TRACE_SCOPE("RecordManager::getRecord");
+        std::lock_guard<std::recursive_mutex> lk(_pm->latch());
+        auto ptr = std::make_unique<uint8_t[]>(_th->_recordSize);
         auto p = readSlot(r);
-        memcpy(ptr.get(), p, _th._recordSize);
+        memcpy(ptr.get(), p, _th->_recordSize);
+        return ptr;
+    }
+
+    /**
+     * @brief get record copy allocated from mr, such as the arena of a query, nothing is allocated from the heap
+     */
+    uint8_t *getRecord(Rid r, std::pmr::memory_resource &mr) const
+    {
+        TRACE_SCOPE("RecordManager::getRecord");
+        std::lock_guard<std::recursive_mutex> lk(_pm->latch());
+        auto ptr = static_cast<uint8_t *>(mr.allocate(_th->_recordSize, alignof(std::max_align_t)));
+        memcpy(ptr, readSlot(r), _th->_recordSize);
         return ptr;
     }
 
+    /**
+     * @brief visit records of many rids, each page is got once and missing pages are read in batches.
+     * f(i, record) is called once for every rids[i] in page order, record is nullptr if rids[i] is not a record.
+     * A record is only valid in f, while the latch of the pool is held.
+     */
+    template <typename F> void getRecords(const Rid *rids, uint32_t n, F &&f) const
+    {
+        TRACE_SCOPE("RecordManager::getRecords");
+        std::vector<uint32_t> order(n);
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            return rids[a]._page != rids[b]._page ? rids[a]._page < rids[b]._page : rids[a]._slot < rids[b]._slot;
+        });
+        auto valid = [&](uint32_t page) {
+            return page >= FIRSTLOADPAGE and page <= _th->_existsPageNum and not isZonePage(page);
+        };
+        auto bitmapSize = ceil(_th->_slotsPerPage, BYTEINBITS);
+        auto batch = std::max<uint32_t>(1, std::min(MULTIGETPAGES, _pm->capacity() / 4));
+        std::vector<uint32_t> pages;
+        uint32_t i = 0;
+        while (i < n)
+        {
+            // rids of the next batch of pages, which are read together
+            pages.clear();
+            uint32_t end = i;
+            for (; end < n; end++)
+            {
+                auto page = rids[order[end]]._page;
+                if (not valid(page) or (not pages.empty() and pages.back() == page))
+                    continue;
+                if (pages.size() == batch)
+                    break;
+                pages.push_back(page);
+            }
+            _pm->prefetchPages(_fd, pages.data(), pages.size());
+            std::lock_guard<std::recursive_mutex> lk(_pm->latch());
+            uint8_t *data = nullptr;
+            for (uint32_t page = 0; i < end; i++)
+            {
+                auto &r = rids[order[i]];
+                if (not valid(r._page) or r._slot >= _th->_slotsPerPage)
+                {
+                    f(order[i], static_cast<const uint8_t *>(nullptr));
+                    continue;
+                }
+                if (r._page != page)
+                    page = r._page, data = _pm->getPage({_fd, page})->_data;
+                const uint8_t *record = nullptr;
+                if (BitMap(data + sizeof(PageHeader), bitmapSize).get(r._slot))
+                    record = data + sizeof(PageHeader) + bitmapSize + _th->_recordSize * r._slot;
+                f(order[i], record);
+            }
+        }
+    }
+
+    /**
+     * @brief copy records of many rids to out in the order of rids, by getRecords with a callback.
+     * Bytes of a rid which is not a record are zero.
+     * @return records found
+     */
+    uint32_t getRecords(const Rid *rids, uint32_t n, uint8_t *out) const
+    {
+        uint32_t found = 0;
+        auto size = _th->_recordSize;
+        getRecords(rids, n, [&](uint32_t i, const uint8_t *record) {
+            if (record)
+                memcpy(out + size_t(i) * size, record, size), found++;
+            else
+                memset(out + size_t(i) * size, 0, size);
+        });
+        return found;
+    }
+
     Rid insertRecord(const void *data)
     {
+        TRACE_SCOPE("RecordManager::insertRecord");
+        Op op(this);
         auto rid = getFreeSlot();
-        writeSlot(rid, static_cast<const uint8_t *>(data));
+        putRecord(rid, static_cast<const uint8_t *>(data));
         return rid;
     }
 
+    /**
+     * @brief insert n records stored one after another, by operations which fill at most 1/OPPAGESHARE of the
+     * cache each, as pages changed by an operation could not be evicted until it ends.
+     * Free slots of a page are filled in a row, the table header is written once a page.
+     * @param rids rids of the records if it is not nullptr
+     */
+    void insertRecords(const void *data, uint32_t n, Rid *rids = nullptr)
+    {
+        TRACE_SCOPE("RecordManager::insertRecords");
+        auto src = static_cast<const uint8_t *>(data);
+        auto opPages = std::max(1u, _pm->capacity() / OPPAGESHARE);
+        std::optional<Op> op;
+        for (uint32_t i = 0, pages = 0; i < n; pages++)
+        {
+            if (pages % opPages == 0)
+            {
+                op.reset();
+                op.emplace(this);
+            }
+            auto rid = getFreeSlot();
+            putRecord(rid, src + size_t(i) * _th->_recordSize);
+            if (rids)
+                rids[i] = rid;
+            uint32_t added = 1;
+            auto p = _pm->getPage({_fd, rid._page});
+            auto ph = reinterpret_cast<PageHeader *>(p->_data);
+            for (i++; i < n and ph->_nextSlot < _th->_slotsPerPage; i++, added++)
+            {
+                rid._slot = ph->_nextSlot;
+                takeSlot(p, rid._slot);
+                putRecord(rid, src + size_t(i) * _th->_recordSize);
+                if (rids)
+                    rids[i] = rid;
+            }
+            setFileHeader(_th->_existsPageNum, _th->_nextPage, _th->_totalRecords + added - 1);
+        }
+    }
+
     void deleteRecord(Rid r)
     {
+        TRACE_SCOPE("RecordManager::deleteRecord");
+        Op op(this);
+        uint64_t keys[MAXCOLUMNS];
+        logUndo(PagedFile::LogType::DELETE, r, readSlot(r));
+        if (hasZoneMap())
+            zoneKeys(readSlot(r), keys);
         deleteSlot(r);
+        if (hasZoneMap())
+            zoneRemove(r._page, keys, true);
     }
 
     void updateRecord(Rid r, const void *data)
     {
+        TRACE_SCOPE("RecordManager::updateRecord");
+        Op op(this);
+        uint64_t keys[MAXCOLUMNS];
+        logUndo(PagedFile::LogType::UPDATE, r, readSlot(r));
+        if (hasZoneMap())
+            zoneKeys(readSlot(r), keys);
         writeSlot(r, static_cast<const uint8_t *>(data));
+        if (hasZoneMap())
+        {
+            zoneRemove(r._page, keys, false);
+            zoneKeys(static_cast<const uint8_t *>(data), keys);
+            auto e = getZoneEntry(r._page);
+            e->_count--; // zoneAdd counts it again
+            zoneAdd(r._page, keys);
+        }
+    }
+
+    /**
+     * @brief undo a INSERT, DELETE or UPDATE log record of this table, see rollback.
+     */
+    void undo(const PagedFile::LogRecord &r)
+    {
+        Rid rid{_fd, r._pageNum, r._offset};
+        switch (r._type)
+        {
+        case PagedFile::LogType::INSERT:
+            deleteRecord(rid);
+            break;
+        case PagedFile::LogType::DELETE:
+            insertRecordAt(rid, r.image());
+            break;
+        case PagedFile::LogType::UPDATE:
+            updateRecord(rid, r.image());
+            break;
+        default:
+            assert(false);
+        }
+    }
+
+    bool hasZoneMap() const
+    {
+        return _th->_zoneSpan != 0;
+    }
+
+    /**
+     * @brief whether a page is a zone map page, which has no records
+     */
+    bool isZonePage(uint32_t page) const
+    {
+        return hasZoneMap() and (page - 1) % _th->_zoneSpan == 0;
+    }
+
+    uint32_t firstDataPage() const
+    {
+        return hasZoneMap() ? FIRSTLOADPAGE + 1 : FIRSTLOADPAGE;
+    }
+
+    /**
+     * @brief check zone map of a page, whether it may have records with normalized value of column col in [lo, hi].
+     * Only the zone page is read.
+     * @return false if the page could be skipped
+     */
+    bool zoneMayMatch(uint32_t page, uint32_t col, uint64_t lo, uint64_t hi) const
+    {
+        auto i = zoneIndex(col);
+        if (i < 0)
+            return true;
+        auto e = getZoneEntry(page);
+        auto b = zoneBounds(e);
+        return e->_count != 0 and b[i * 2] <= hi and b[i * 2 + 1] >= lo;
+    }
+
+    /**
+     * @brief records of a page by zone map, only the zone page is read.
+     */
+    uint32_t zoneCount(uint32_t page) const
+    {
+        return hasZoneMap() ? getZoneEntry(page)->_count : -1;
     }
 
     void flush(uint32_t pageNum, bool release = false)
@@ -182,7 +655,7 @@ class RecordManager
 
     uint32_t getTotalRecord() const
     {
-        return _th._totalRecords;
+        return _th->_totalRecords;
     }
 
     int getFd() const
@@ -190,6 +663,49 @@ class RecordManager
         return _fd;
     }
 
+    /**
+     * @brief log of the pool when the table was opened, nullptr if changes are not logged
+     */
+    PagedFile::LogManager *getLog() const
+    {
+        return _log;
+    }
+
+    const TableHeader &getTableHeader() const
+    {
+        return *_th;
+    }
+
+    /**
+     * @brief index of a column by name
+     * @return -1 if not found
+     */
+    int getColumnIndex(std::string_view name) const
+    {
+        for (uint32_t i = 0; i < _th->_columnCount; i++)
+        {
+            if (name == _th->_columns[i]._name)
+                return i;
+        }
+        return -1;
+    }
+
+    /**
+     * @brief size of slot bitmap of a page in bytes
+     */
+    uint32_t getBitmapSize() const
+    {
+        return ceil(_th->_slotsPerPage, BYTEINBITS);
+    }
+
+    /**
+     * @brief pointer to the first slot of a page
+     */
+    const uint8_t *getSlotBase(const uint8_t *pageData) const
+    {
+        return pageData + sizeof(PageHeader) + getBitmapSize();
+    }
+
     PagedFile::PageManager *getPageManager() const
     {
         return _pm;
@@ -208,43 +724,31 @@ class RecordManager
         }
         Iterator &operator++()
         {
+            TRACE_SCOPE("RecordManager::Iterator::next");
             auto p = _rm->getPageManager()->getPage({_r._fd, _r._page});
-            auto bm = BitMap(p->_data + sizeof(PageHeader), ceil(_rm->_th._recordSize, BYTEINBITS));
+            auto bm = BitMap(p->_data + sizeof(PageHeader), _rm->getBitmapSize());
             auto pos = bm.nextBit(_r._slot + 1, true);
-            if (pos < _rm->_th._slotsPerPage)
+            if (pos < _rm->_th->_slotsPerPage)
             {
                 _r._slot = pos;
+                return *this;
             }
-            else
+            while (_r._page < _rm->_th->_existsPageNum)
             {
-                if (_r._page == _rm->_th._existsPageNum) // bug fixed
+                if (_rm->isZonePage(++_r._page))
+                    continue;
+                auto npage = _rm->getPageManager()->getPage({_r._fd, _r._page});
+                auto nbm = BitMap(npage->_data + sizeof(PageHeader), _rm->getBitmapSize());
+                auto npos = nbm.nextBit(0, true);
+                if (npos < _rm->_th->_slotsPerPage)
                 {
-                    // end of all record
-                    _r._slot = -1;
-                }
-                else
-                {
-                    auto npid = _r._page;
-                    while (++npid <= _rm->_th._existsPageNum)
-                    {
-                        auto npage = _rm->getPageManager()->getPage({_r._fd, npid});
-                        auto nbm = BitMap(npage->_data + sizeof(PageHeader), ceil(_rm->_th._recordSize, BYTEINBITS));
-                        auto npos = nbm.nextBit(0, true);
-                        if (npos < _rm->_th._existsPageNum)
-                        {
-                            _r._page = npid;
-                            _r._slot = npos; // bug fixed
-                            break;
-                        }
-                        else if (npid == _rm->_th._existsPageNum)
-                        {
-                            _r._page = npid;
-                            _r._slot = -1;
-                            break;
-                        }
-                    }
+                    _r._slot = npos;
+                    return *this;
                 }
             }
+            // end of all record
+            _r._page = _rm->_th->_existsPageNum;
+            _r._slot = -1;
             return *this;
         }
         Iterator operator++(int) const
@@ -274,11 +778,11 @@ class RecordManager
 
     Iterator cbegin() const
     {
-        if (_th._existsPageNum == 0)
+        if (_th->_existsPageNum < firstDataPage())
             return cend();
         Rid r;
         r._fd = _fd;
-        r._page = 1;
+        r._page = firstDataPage();
         r._slot = 0;
 
         auto it = Iterator(this, r);
@@ -295,12 +799,26 @@ class RecordManager
     {
         Rid r;
         r._fd = _fd;
-        r._page = _th._existsPageNum;
+        r._page = _th->_existsPageNum;
         r._slot = -1;
         return Iterator(this, r);
     }
 };
 
+/**
+ * @brief make a column for RecordFileManager::creatTable.
+ * @param size width in bytes, only used by ColumnType::CHAR
+ */
+inline Column makeColumn(std::string_view name, ColumnType type, uint16_t size = 0)
+{
+    Column c{};
+    assert(name.size() < MAXCOLUMNNAME);
+    memcpy(c._name, name.data(), name.size());
+    c._type = type;
+    c._size = columnWidth(type, size);
+    return c;
+}
+
 // sizeof(bitmap) = ceil(n/8) = (n + 8 - 1)/8
 // sizeof(PageHeader) + sizeof(bitmap) + n * recordSize <= PAGESIZE
 static uint32_t calSlotsPerPage(uint32_t recordSize)
@@ -314,39 +832,168 @@ static uint32_t calSlotsPerPage(uint32_t recordSize)
  */
 class RecordFileManager
 {
+  private:
+    struct OpenTable
+    {
+        std::shared_ptr<TableHeader> _header; // shared by RecordManagers of a table
+        PagedFile::PageManager *_pm;          // pool of the table while it is open
+    };
+
+    // open tables by fd
+    static robin_hood::unordered_map<int, OpenTable> _tables;
+
+    /**
+     * @param logged false for a table which is not logged even if PageManager has a log
+     */
+    static RecordManager makeManager(int fd, const OpenTable &t, bool logged)
+    {
+        auto pm = t._pm;
+        auto log = logged and not PagedFile::MemoryFile::isVirtual(fd) ? pm->getLog() : nullptr;
+        uint32_t fileId = log ? log->fileId(PagedFile::FileManager::getPathByFd(fd)) : 0;
+        return RecordManager(fd, pm, t._header, log, fileId);
+    }
+
+    static RecordManager makeTable(std::string_view path, const TableHeader &th, bool logged)
+    {
+        PagedFile::FileManager::createFile(path);
+        int fd = PagedFile::FileManager::openFile(path);
+        auto &t = _tables[fd] = {std::make_shared<TableHeader>(th), PagedFile::FileManager::poolOfFd(fd)};
+        auto rm = makeManager(fd, t, logged);
+        rm.writeTableHeader();
+        return rm;
+    }
+
+    /**
+     * @brief header of a table with a schema, columns are packed in order.
+     */
+    static TableHeader schemaHeader(const std::vector<Column> &columns, const std::vector<uint32_t> &zoneColumns)
+    {
+        assert(not columns.empty() and columns.size() <= MAXCOLUMNS);
+        TableHeader th{};
+        for (auto &&c : columns)
+        {
+            auto &col = th._columns[th._columnCount++];
+            col = c;
+            col._size = columnWidth(c._type, c._size);
+            col._offset = th._recordSize;
+            th._recordSize += col._size;
+        }
+        assert(th._recordSize <= MAXRECORDSIZE);
+        th._slotsPerPage = calSlotsPerPage(th._recordSize);
+        th._nextPage = FIRSTLOADPAGE;
+        for (auto &&c : zoneColumns)
+        {
+            assert(c < th._columnCount);
+            th._zoneColumns |= 1u << c;
+        }
+        if (th._zoneColumns)
+        {
+            th._zoneSpan = (PAGESIZE - sizeof(PageHeader)) / calZoneEntrySize(th._zoneColumns);
+            th._nextPage = FIRSTLOADPAGE + 1; // first page is a zone page
+        }
+        return th;
+    }
+
   public:
     static RecordManager openTable(std::string_view path)
     {
         int fd = PagedFile::FileManager::openFile(path);
-        auto pm = PagedFile::getPageManager();
-        auto page = pm->getPage({fd, 0});
+        auto pos = _tables.find(fd);
+        if (pos == _tables.end())
+        {
+            auto pm = PagedFile::FileManager::poolOfFd(fd);
+            auto page = pm->getPage({fd, 0});
+            auto th = std::make_shared<TableHeader>();
+            memcpy(th.get(), tableHeaderOf(page->_data), sizeof(TableHeader));
+            assert(th->_recordSize != 0);
+            pos = _tables.emplace(fd, OpenTable{th, pm}).first;
+        }
+        return makeManager(fd, pos->second, true);
+    }
+    /**
+     * @brief whether the header of a file is a consistent table header, for a file which may not be a table.
+     * The header page is read around the pool, as a page failing its checksum there is fatal.
+     */
+    static bool isTable(std::string_view path)
+    {
+        int fd = PagedFile::FileManager::openFile(path);
+        if (_tables.count(fd))
+            return true;
+        alignas(PAGESIZE) uint8_t page[PAGESIZE];
+        auto nread = PagedFile::diskRead(fd, 0, page);
+        PagedFile::FileManager::closeFile(fd, *PagedFile::FileManager::poolOfFd(fd));
+        if (nread != PAGESIZE or not PagedFile::verifyPage(page))
+            return false;
         TableHeader th;
-        memcpy(&th, page->_data, sizeof(th));
-        assert(th._recordSize != 0);
-        // pm.getPage();
-        return RecordManager(fd, pm, th);
+        memcpy(&th, tableHeaderOf(page), sizeof(th));
+        if (th._recordSize == 0 or th._recordSize > MAXRECORDSIZE or
+            th._slotsPerPage != calSlotsPerPage(th._recordSize) or th._columnCount > MAXCOLUMNS)
+            return false;
+        for (uint32_t i = 0; i < th._columnCount; i++)
+        {
+            if (th._columns[i]._offset + th._columns[i]._size > th._recordSize)
+                return false;
+        }
+        return true;
     }
     static void closeTable(RecordManager &rm)
     {
+        _tables.erase(rm.getFd());
         PagedFile::FileManager::closeFile(rm.getFd(), *(rm.getPageManager()));
     }
     static RecordManager creatTable(std::string_view path, uint32_t recordSize)
     {
         assert(recordSize <= MAXRECORDSIZE);
-        PagedFile::FileManager::createFile(path);
-        int fd = PagedFile::FileManager::openFile(path);
-        auto pm = PagedFile::getPageManager();
-        auto page = pm->getPage({fd, 0}); // first page just for header
-        TableHeader th = {
-            ._recordSize = recordSize, ._existsPageNum = 0, ._nextPage = FIRSTLOADPAGE, ._totalRecords = 0};
+        TableHeader th{};
+        th._recordSize = recordSize;
+        th._nextPage = FIRSTLOADPAGE;
         th._slotsPerPage = calSlotsPerPage(recordSize);
-        memcpy(page->_data, &th, sizeof(th));
-        page->_dirty = true;
-        return RecordManager(fd, pm, th);
+        return makeTable(path, th, true);
+    }
+    /**
+     * @brief create a table with a schema, columns are packed in order.
+     * @param zoneColumns index of columns to keep per page min / max, so scans could skip pages.
+     */
+    static RecordManager creatTable(std::string_view path, const std::vector<Column> &columns,
+                                    const std::vector<uint32_t> &zoneColumns = {})
+    {
+        return makeTable(path, schemaHeader(columns, zoneColumns), true);
     }
+    /**
+     * @brief create a table for intermediate results, should be released by dropTable.
+     * Temporary tables are not logged. A table in memory spills to temporary directory over the budget
+     * of memory files, see PagedFile::MemoryFile.
+     * @param memory in a memory file, or in a file of temporary directory
+     */
+    static RecordManager creatTempTable(const std::vector<Column> &columns, bool memory = true)
+    {
+        auto path = memory ? PagedFile::FileManager::memoryPath() : PagedFile::FileManager::tempPath();
+        return makeTable(path, schemaHeader(columns, {}), false);
+    }
+
+    /**
+     * @brief close and delete a table, cached pages are discarded without write back.
+     */
+    static void dropTable(RecordManager &rm)
+    {
+        auto path = PagedFile::FileManager::getPathByFd(rm.getFd());
+        assert(not path.empty());
+        rm.getPageManager()->discardAllByFd(rm.getFd());
+        closeTable(rm);
+        deleteTable(path);
+    }
+
+    /**
+     * @brief delete a table and its statistics, see Optimizer::analyze
+     */
     static void deleteTable(std::string_view path)
     {
+        if (auto log = PagedFile::poolOf(path)->getLog())
+            log->dropFile(PagedFile::FileManager::isFile(path));
         PagedFile::FileManager::deleteFile(path);
+        auto stats = std::string(path) + STATSSUFFIX;
+        if (not PagedFile::FileManager::isFile(stats).empty())
+            PagedFile::FileManager::deleteFile(stats);
     };
 };
 } // namespace RecordMgr
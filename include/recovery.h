@@ -0,0 +1,384 @@
+#if !defined(__SQLIGHT_RECOVERY__)
+#define __SQLIGHT_RECOVERY__
+
+#include "pagedFile.h"
+#include "record.h"
+#include "wal.h"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// rollback and crash recovery by write ahead log
+namespace RecordMgr
+{
+
+/**
+ * @brief undo changes of a transaction in reverse order, then log its end.
+ * Every undo is logged as a CLR, so a rollback interrupted by a crash is not undone twice.
+ */
+inline void rollback(PagedFile::LogManager &log, uint64_t txn)
+{
+    struct Table
+    {
+        std::unique_ptr<RecordManager> _rm;
+        bool _opened; // opened by rollback, it is closed at the end, tables opened by others stay open
+    };
+    robin_hood::unordered_map<uint32_t, Table> tables;
+    std::vector<uint8_t> buf;
+    auto lsn = log.lastLsn(txn);
+    while (lsn)
+    {
+        log.read(lsn, buf);
+        auto r = reinterpret_cast<const PagedFile::LogRecord *>(buf.data());
+        if (r->_type == PagedFile::LogType::CLR)
+        {
+            lsn = r->_undoNext;
+            continue;
+        }
+        auto pos = tables.find(r->_fileId);
+        if (pos == tables.end())
+        {
+            auto path = log.pathOf(r->_fileId);
+            assert(not path.empty());
+            bool opened = PagedFile::FileManager::getFdByPath(PagedFile::FileManager::isFile(path)) == -1;
+            auto rm = std::make_unique<RecordManager>(RecordFileManager::openTable(path));
+            pos = tables.emplace(r->_fileId, Table{std::move(rm), opened}).first;
+        }
+        log.beginUndo(txn, r->_prevLsn);
+        pos->second._rm->undo(*r);
+        log.endUndo();
+        lsn = r->_prevLsn;
+    }
+    log.endAbort(txn);
+    for (auto &&[id, t] : tables)
+    {
+        if (t._opened)
+            RecordFileManager::closeTable(*t._rm);
+    }
+}
+
+/**
+ * @brief roll back transaction of the calling thread.
+ */
+inline void rollback(PagedFile::LogManager &log)
+{
+    assert(log.current() != 0);
+    rollback(log, log.current());
+}
+
+constexpr uint32_t REDOEXTENT = 16; // adjacent pages go to the same redo worker, so they are read together
+
+constexpr uint32_t REDOBATCH = 1 << 20; // bytes of records sent to a redo worker at a time
+
+constexpr uint32_t REDOQUEUE = 8; // batches queued for a redo worker at most
+
+constexpr uint32_t REDOPAGES = 1 << 14; // pages a redo worker keeps before writing them back
+
+/**
+ * @brief redo of a partition of pages on a thread.
+ * Records of a page are applied in lsn order. Pages in cache are changed in cache,
+ * other pages are read by the worker directly, a batch at a time with preadv, and written back by it.
+ * A page read with a checksum mismatch is torn, it is rebuilt from the image of it logged by its first change since
+ * it was written back, records before the image are skipped.
+ */
+class RedoWorker
+{
+  private:
+    struct Entry // a batch is a sequence of Entry, each followed by a LogRecord
+    {
+        int _fd;
+        uint32_t _reserved;
+    };
+
+    PagedFile::PageManager *_pm;
+    std::thread _thread;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<std::vector<uint8_t>> _queue;
+    bool _done = false;
+
+    robin_hood::unordered_map<Pid, uint8_t *, PagedFile::PidHash> _pages; // pages read by this worker
+    robin_hood::unordered_set<Pid, PagedFile::PidHash> _torn; // pages read which are not rebuilt yet
+    robin_hood::unordered_set<int> _written;
+    uint64_t _redone = 0, _rebuilt = 0;
+
+    static bool redoPage(uint8_t *data, const PagedFile::LogRecord &r)
+    {
+        auto ph = reinterpret_cast<PageHeader *>(data);
+        if (ph->_lsn >= r._lsn)
+            return false;
+        memcpy(data + r._offset, r.image(), r._len);
+        ph->_lsn = r._lsn;
+        return true;
+    }
+
+    template <typename F> static void forEach(const std::vector<uint8_t> &batch, F f)
+    {
+        for (size_t off = 0; off < batch.size();)
+        {
+            auto e = reinterpret_cast<const Entry *>(batch.data() + off);
+            auto r = reinterpret_cast<const PagedFile::LogRecord *>(e + 1);
+            f(e->_fd, *r);
+            off += sizeof(Entry) + r->_size;
+        }
+    }
+
+    /**
+     * @brief read pages of a batch which are neither in cache nor read, adjacent pages by one preadv.
+     */
+    void prefetch(const std::vector<uint8_t> &batch)
+    {
+        std::vector<Pid> missing;
+        forEach(batch, [&](int fd, const PagedFile::LogRecord &r) {
+            Pid p{fd, r._pageNum};
+            if (not _pages.count(p) and not _pm->isInCache(p))
+            {
+                _pages[p] = nullptr;
+                missing.push_back(p);
+            }
+        });
+        std::sort(missing.begin(), missing.end(),
+                  [](Pid a, Pid b) { return std::tie(a.fd, a.pageNum) < std::tie(b.fd, b.pageNum); });
+        constexpr uint32_t MAXIOV = 64;
+        struct iovec iov[MAXIOV];
+        for (size_t i = 0; i < missing.size();)
+        {
+            size_t n = 0;
+            while (i + n < missing.size() and n < MAXIOV and missing[i + n].fd == missing[i].fd and
+                   missing[i + n].pageNum == missing[i].pageNum + n)
+            {
+                auto data = static_cast<uint8_t *>(aligned_alloc(PAGESIZE, PAGESIZE)); // for O_DIRECT
+                assert(data);
+                _pages[missing[i + n]] = data;
+                iov[n].iov_base = data;
+                iov[n].iov_len = PAGESIZE;
+                n++;
+            }
+            auto nread = PagedFile::diskRead(missing[i].fd, missing[i].pageNum, iov, n);
+            assert(nread >= 0 and nread % PAGESIZE == 0);
+            for (size_t k = 0; k < size_t(nread / PAGESIZE); k++)
+            {
+                if (not _pm->verify(missing[i + k], static_cast<uint8_t *>(iov[k].iov_base)))
+                {
+                    memset(iov[k].iov_base, 0, PAGESIZE); // older than any record
+                    _torn.insert(missing[i + k]);
+                }
+            }
+            for (size_t k = nread / PAGESIZE; k < n; k++) // beyond eof
+                memset(iov[k].iov_base, 0, PAGESIZE);
+            i += n;
+        }
+    }
+
+    void apply(const std::vector<uint8_t> &batch)
+    {
+        prefetch(batch);
+        forEach(batch, [&](int fd, const PagedFile::LogRecord &r) {
+            auto pos = _pages.find({fd, r._pageNum});
+            if (pos != _pages.end())
+            {
+                if (not _torn.empty() and _torn.count(pos->first))
+                {
+                    if (not r.isPageImage())
+                        return;
+                    _torn.erase(pos->first);
+                    _rebuilt++;
+                }
+                _redone += redoPage(pos->second, r);
+                return;
+            }
+            std::lock_guard<std::recursive_mutex> lk(_pm->latch());
+            auto p = _pm->getPage({fd, r._pageNum});
+            if (redoPage(p->_data, r))
+            {
+                p->_lsn = r._lsn;
+                p->_recLsn = p->_recLsn ? p->_recLsn : r._lsn;
+                p->_dirty = true;
+                _redone++;
+            }
+        });
+        if (_pages.size() > REDOPAGES)
+            writeBack();
+    }
+
+    /**
+     * @brief write back pages read, torn pages are kept until their images are applied.
+     */
+    void writeBack()
+    {
+        decltype(_pages) torn;
+        for (auto &&[p, data] : _pages)
+        {
+            if (_torn.count(p))
+            {
+                torn[p] = data;
+                continue;
+            }
+            PagedFile::setPageChecksum(data);
+            auto n = PagedFile::diskWrite(p.fd, p.pageNum, data);
+            assert(n == PAGESIZE);
+            _written.insert(p.fd);
+            free(data);
+        }
+        _pages = std::move(torn);
+    }
+
+  public:
+    explicit RedoWorker(PagedFile::PageManager *pm) : _pm(pm)
+    {
+        _thread = std::thread([this] {
+            while (true)
+            {
+                std::vector<uint8_t> batch;
+                {
+                    std::unique_lock<std::mutex> lk(_mutex);
+                    _cv.wait(lk, [this] { return _done or not _queue.empty(); });
+                    if (_queue.empty())
+                        break;
+                    batch = std::move(_queue.front());
+                    _queue.pop_front();
+                }
+                _cv.notify_all();
+                apply(batch);
+            }
+            writeBack();
+            for (auto &&p : _torn)
+            {
+                // no image of it since the last checkpoint, so it is not torn by a crash
+                fmt::print(stderr, "page {} of fd {} could not be rebuilt from the log\n", p.pageNum, p.fd);
+                std::abort();
+            }
+        });
+    }
+
+    /**
+     * @brief append a record of page (fd, r._pageNum) to a batch
+     */
+    static void add(std::vector<uint8_t> &batch, int fd, const PagedFile::LogRecord &r)
+    {
+        auto off = batch.size();
+        batch.resize(off + sizeof(Entry) + r._size);
+        auto e = reinterpret_cast<Entry *>(batch.data() + off);
+        e->_fd = fd;
+        memcpy(e + 1, &r, r._size);
+    }
+
+    void push(std::vector<uint8_t> &&batch)
+    {
+        std::unique_lock<std::mutex> lk(_mutex);
+        _cv.wait(lk, [this] { return _queue.size() < REDOQUEUE; });
+        _queue.push_back(std::move(batch));
+        _cv.notify_all();
+    }
+
+    /**
+     * @brief torn pages rebuilt, valid after finish
+     */
+    uint64_t rebuilt() const
+    {
+        return _rebuilt;
+    }
+
+    /**
+     * @brief wait until all batches are applied and pages are written back.
+     * @return records applied
+     */
+    uint64_t finish()
+    {
+        {
+            std::lock_guard<std::mutex> lk(_mutex);
+            _done = true;
+        }
+        _cv.notify_all();
+        _thread.join();
+        for (auto &&fd : _written)
+            PagedFile::diskSync(fd);
+        return _redone;
+    }
+};
+
+struct RecoveryStats
+{
+    uint64_t _records; // records in the log
+    uint64_t _redone;  // page records applied
+    uint64_t _rebuilt; // torn pages rebuilt from their images
+    uint64_t _losers;  // transactions rolled back
+};
+
+/**
+ * @brief apply page records of the log to pages older than them, then roll back unfinished transactions.
+ * Redo starts from the last checkpoint, and recovery ends with a checkpoint.
+ * Records are partitioned by page to threads for redo, pages torn by the crash are rebuilt from their images.
+ * Call it after PageManager::attachLog and before tables are used.
+ * @param threads threads for redo, 0 for hardware concurrency
+ */
+inline RecoveryStats recover(PagedFile::LogManager &log, PagedFile::PageManager *pm, uint32_t threads = 0)
+{
+    using namespace PagedFile;
+    RecoveryStats st{};
+    robin_hood::unordered_map<uint32_t, uint64_t> dropped; // file id -> lsn of DROP
+    uint64_t redoLsn = 0;
+    log.scan([&](const LogRecord &r) {
+        st._records++;
+        if (r._type == LogType::DROP)
+            dropped[r._fileId] = r._lsn;
+        if (r._type == LogType::CHECKPOINT)
+            redoLsn = reinterpret_cast<const CheckpointImage *>(r.image())->_redoLsn;
+    });
+
+    threads = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::unique_ptr<RedoWorker>> workers;
+    std::vector<std::vector<uint8_t>> batches(threads);
+    for (uint32_t i = 0; i < threads; i++)
+        workers.emplace_back(std::make_unique<RedoWorker>(pm));
+    robin_hood::unordered_map<uint32_t, int> fds;
+    log.scan(
+        [&](const LogRecord &r) {
+            if (r._type != LogType::PAGE)
+                return;
+            auto d = dropped.find(r._fileId);
+            if (d != dropped.end() and r._lsn < d->second)
+                return;
+            auto pos = fds.find(r._fileId);
+            if (pos == fds.end())
+            {
+                auto path = log.pathOf(r._fileId);
+                assert(not path.empty());
+                if (FileManager::isFile(path).empty())
+                    FileManager::createFile(path);
+                pos = fds.emplace(r._fileId, FileManager::openFile(path)).first;
+            }
+            auto w = PidHash()({pos->second, r._pageNum / REDOEXTENT}) % threads;
+            RedoWorker::add(batches[w], pos->second, r);
+            if (batches[w].size() >= REDOBATCH)
+            {
+                workers[w]->push(std::move(batches[w]));
+                batches[w].clear();
+            }
+        },
+        std::max(redoLsn, log.firstLsn()));
+    for (uint32_t i = 0; i < threads; i++)
+    {
+        if (not batches[i].empty())
+            workers[i]->push(std::move(batches[i]));
+        st._redone += workers[i]->finish();
+        st._rebuilt += workers[i]->rebuilt();
+    }
+
+    for (auto txn : log.activeTransactions())
+    {
+        rollback(log, txn);
+        st._losers++;
+    }
+    pm->flushAll();
+    pm->syncAll();
+    log.checkpoint(log.nextLsn());
+    return st;
+}
+
+} // namespace RecordMgr
+
+#endif // __SQLIGHT_RECOVERY__
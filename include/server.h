@@ -0,0 +1,212 @@
+#if !defined(__SQLIGHT_SERVER__)
+#define __SQLIGHT_SERVER__
+
+#include "record.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * @brief sqlightd, a server which owns the page cache and serves tables over a Unix domain socket.
+ * A request is a RequestHeader and _length bytes of payload, a response is a ResponseHeader and its payload.
+ * A client may send many requests without waiting, requests of a connection are executed in order
+ * and responses come back in the same order, with the _id of their requests.
+ */
+namespace Server
+{
+
+constexpr uint32_t MAXREQUEST = 16 << 20; // bytes of payload of a request at most, a larger one closes the connection
+
+constexpr uint32_t SERVERREAD = 64 << 10; // bytes read from a connection by one read
+
+constexpr uint32_t SERVERBATCH = 1 << 20; // bytes read from a connection before its requests are executed
+
+constexpr uint32_t SCANMAX = 4096; // records of a SCAN response at most
+
+constexpr uint32_t INSERTBATCH = 256 << 10; // bytes of records of an INSERT inserted by one insertRecords at most
+
+constexpr uint32_t NOTABLE = UINT32_MAX; // table of a request which is not on a table
+
+enum class Op : uint8_t
+{
+    PING,   // no payload
+    OPEN,   // payload is the path of a table, response is uint32_t table and uint32_t record size
+    CLOSE,  // table is closed for this connection
+    COUNT,  // response is uint64_t records of the table
+    GET,    // payload is a WireRid, response is the record
+    INSERT, // payload is records one after another, response is a WireRid of each record
+    UPDATE, // payload is a WireRid and the record
+    DELETE, // payload is a WireRid
+    SCAN    // payload is a WireRid and uint32_t max, response is up to max WireRid and record pairs after the rid
+};
+
+enum class Status : uint8_t
+{
+    OK,
+    NOTFOUND,  // no such table, or no record of the rid
+    BADREQUEST // unknown op, wrong size of payload, a table not opened by the connection or OPEN of a file not a table
+};
+
+struct RequestHeader
+{
+    uint32_t _length; // bytes of payload
+    uint32_t _id;     // chosen by the client, returned in the response
+    uint32_t _table;  // table from OPEN
+    Op _op;
+    uint8_t _reserved[3];
+};
+
+struct ResponseHeader
+{
+    uint32_t _length;
+    uint32_t _id;
+    Status _status;
+    uint8_t _reserved[3];
+};
+
+/**
+ * @brief a rid on the wire, the table is given by the request. SCAN from {0, 0} starts at the first record.
+ */
+struct WireRid
+{
+    uint32_t _page;
+    uint32_t _slot;
+};
+
+class Server
+{
+  private:
+    struct Table
+    {
+        std::string _path;
+        std::unique_ptr<RecordMgr::RecordManager> _rm; // nullptr when no connection has it open
+        uint32_t _refs = 0;
+    };
+
+    struct Connection
+    {
+        int _fd;
+        std::mutex _mutex; // held by the worker serving it, it is never contended as EPOLLONESHOT hands it over
+        std::vector<uint8_t> _in;
+        std::vector<uint8_t> _out;     // responses not taken by the socket yet, nothing is read until it is empty
+        bool _eof = false;             // the peer has shut down writing, it is closed once _out is written
+        std::vector<uint32_t> _tables; // opened by this connection, a table may be opened more than once
+    };
+
+    std::string _path;
+    std::string _pool;
+    uint32_t _threads;
+    int _listen = -1;
+    int _epoll = -1;
+    int _wake = -1; // eventfd which stops the event loop
+
+    std::mutex _queueMutex;
+    std::condition_variable _queueCv;
+    std::deque<Connection *> _queue; // connections with bytes to read or room to write
+    bool _stopping = false;
+    std::unordered_set<Connection *> _connections;
+
+    std::mutex _tableMutex;
+    std::vector<Table> _tables;
+    std::map<std::string, uint32_t> _tableIds;
+
+    void accept();
+    void work();
+    bool serve(Connection &c);
+    void execute(Connection &c, const RequestHeader &h, const uint8_t *payload);
+    void release(Connection *c);
+
+    uint32_t open(std::string_view path, Status &status);
+    void close(uint32_t table);
+    RecordMgr::RecordManager *table(Connection &c, uint32_t table);
+
+  public:
+    Server() = delete;
+    Server(const Server &) = delete;
+
+    /**
+     * @param path of the socket, an old socket file is removed
+     * @param threads workers executing requests, 0 for all cpus
+     * @param pool tables are cached in this pool if it is not empty, see PagedFile::createPool
+     */
+    explicit Server(std::string_view path, uint32_t threads = 0, std::string_view pool = "");
+    ~Server();
+
+    /**
+     * @brief serve connections until stop is called
+     */
+    void run();
+
+    /**
+     * @brief make run return, it is safe in a signal handler
+     */
+    void stop();
+};
+
+/**
+ * @brief a connection to sqlightd. Requests are buffered by send and written by flush or receive,
+ * so a batch of requests is pipelined in a few writes.
+ */
+class Client
+{
+  private:
+    int _fd = -1;
+    uint32_t _nextId = 0;
+    std::vector<uint8_t> _out;
+    std::vector<uint8_t> _in;
+    size_t _inPos = 0;
+
+    bool fill(size_t bytes);
+
+  public:
+    struct Response
+    {
+        ResponseHeader _header;
+        std::vector<uint8_t> _payload;
+    };
+
+    Client() = delete;
+    Client(const Client &) = delete;
+    explicit Client(std::string_view path);
+    ~Client();
+
+    bool connected() const
+    {
+        return _fd != -1;
+    }
+
+    /**
+     * @brief queue a request
+     * @return id of the request
+     */
+    uint32_t send(Op op, uint32_t table = NOTABLE, const void *payload = nullptr, uint32_t length = 0);
+
+    bool flush();
+
+    /**
+     * @brief wait for the response of the oldest request which has no response yet
+     * @return false if the connection is closed
+     */
+    bool receive(Response &r);
+
+    /**
+     * @brief send a request and wait for its response, responses of requests queued before are dropped
+     * @return status of the response, NOTFOUND if the connection is closed
+     */
+    Status call(Op op, uint32_t table, const void *payload, uint32_t length, Response &r);
+
+    /**
+     * @return table, or NOTABLE if there is no such table
+     */
+    uint32_t open(std::string_view path, uint32_t *recordSize = nullptr);
+};
+
+} // namespace Server
+
+#endif // __SQLIGHT_SERVER__
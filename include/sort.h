@@ -0,0 +1,525 @@
+#if !defined(__SQLIGHT_SORT__)
+#define __SQLIGHT_SORT__
+
+#include "exec.h"
+#include "pagedFile.h"
+#include <algorithm>
+#include <string>
+
+namespace Exec
+{
+
+constexpr size_t SORTMEMORY = 8 << 20; // default size of a sorted run in bytes, about the size of cache
+
+constexpr uint32_t SORTFANIN = 128; // max runs merged at once
+
+constexpr uint32_t SORTPREFETCH = 16; // pages read ahead by a run reader
+
+struct SortKey
+{
+    uint32_t _col;
+    bool _desc;
+};
+
+/**
+ * @brief compare two rows by sort keys
+ * @return <0, 0, >0
+ */
+inline int compareRows(const uint8_t *a, const uint8_t *b, const std::vector<Column> &packed,
+                       const std::vector<SortKey> &keys)
+{
+    for (auto &&k : keys)
+    {
+        auto &c = packed[k._col];
+        auto x = a + c._offset, y = b + c._offset;
+        int r;
+        if (c._type == ColumnType::CHAR)
+        {
+            r = memcmp(x, y, c._size);
+        }
+        else
+        {
+            auto nx = normalizeKey(x, c, false), ny = normalizeKey(y, c, false);
+            r = nx < ny ? -1 : (nx > ny ? 1 : 0);
+        }
+        if (r != 0)
+            return k._desc ? -r : r;
+    }
+    return 0;
+}
+
+struct SortEntry
+{
+    uint64_t _key;
+    uint32_t _row;
+};
+
+/**
+ * @brief stable LSD radix sort by _key, a byte is skipped if all keys have the same value of it.
+ */
+inline void radixSort(std::vector<SortEntry> &v)
+{
+    auto n = v.size();
+    if (n < 2)
+        return;
+    std::vector<uint32_t> hist(8 * 256, 0);
+    for (auto &&e : v)
+    {
+        for (uint32_t b = 0; b < 8; b++)
+            hist[b * 256 + ((e._key >> (b * 8)) & 0xff)]++;
+    }
+    std::vector<SortEntry> tmp(n);
+    for (uint32_t b = 0; b < 8; b++)
+    {
+        auto h = hist.data() + b * 256;
+        if (h[(v[0]._key >> (b * 8)) & 0xff] == n)
+            continue;
+        uint32_t sum = 0;
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            auto c = h[i];
+            h[i] = sum;
+            sum += c;
+        }
+        for (auto &&e : v)
+            tmp[h[(e._key >> (b * 8)) & 0xff]++] = e;
+        v.swap(tmp);
+    }
+}
+
+/**
+ * @brief loser tree of k sources, the winner is the least one.
+ * less(i, j) compares current values of source i and j.
+ */
+template <typename Less> class LoserTree
+{
+  private:
+    std::vector<uint32_t> _tree; // _tree[0] is winner, _tree[1, k) are losers
+    uint32_t _k;
+    Less _less;
+
+    uint32_t build(uint32_t node)
+    {
+        if (node >= _k)
+            return node - _k;
+        auto l = build(node * 2), r = build(node * 2 + 1);
+        if (_less(r, l))
+        {
+            _tree[node] = l;
+            return r;
+        }
+        _tree[node] = r;
+        return l;
+    }
+
+  public:
+    LoserTree(uint32_t k, Less less) : _tree(std::max<uint32_t>(k, 1)), _k(k), _less(less)
+    {
+        _tree[0] = _k <= 1 ? 0 : build(1);
+    }
+
+    uint32_t winner() const
+    {
+        return _tree[0];
+    }
+
+    /**
+     * @brief replay after the winner advanced
+     */
+    void replay()
+    {
+        auto winner = _tree[0];
+        for (auto node = (winner + _k) / 2; node > 0; node /= 2)
+        {
+            if (_less(_tree[node], winner))
+                std::swap(_tree[node], winner);
+        }
+        _tree[0] = winner;
+    }
+};
+
+/**
+ * @brief a sorted run in a memory file, which spills to disk over the budget of memory files.
+ * Pages start with PageHeader, PageHeader::_nextSlot is rows of the page.
+ */
+struct Run
+{
+    std::string _path;
+    int _fd;
+    uint32_t _pages = 0;
+    uint64_t _rows = 0;
+};
+
+class RunWriter
+{
+  private:
+    PagedFile::PageManager *_pm;
+    Run _run;
+    uint32_t _rowSize;
+    uint32_t _rowsPerPage;
+    PagedFile::Page *_page = nullptr;
+    uint32_t _n = 0;
+
+    void seal()
+    {
+        if (_page == nullptr)
+            return;
+        reinterpret_cast<PageHeader *>(_page->_data)->_nextSlot = _n;
+        _page->_dirty = true;
+        _pm->flush(_page, true);
+        _page = nullptr;
+    }
+
+  public:
+    RunWriter(PagedFile::PageManager *pm, uint32_t rowSize)
+        : _pm(pm), _rowSize(rowSize), _rowsPerPage((PAGESIZE - sizeof(PageHeader)) / rowSize)
+    {
+        assert(_rowsPerPage > 0);
+        _run._path = PagedFile::FileManager::memoryPath();
+        PagedFile::FileManager::createFile(_run._path);
+        _run._fd = PagedFile::FileManager::openFile(_run._path);
+    }
+
+    void add(const uint8_t *row)
+    {
+        if (_page == nullptr or _n == _rowsPerPage)
+        {
+            seal();
+            _page = _pm->newPage({_run._fd, _run._pages++});
+            _n = 0;
+        }
+        memcpy(_page->_data + sizeof(PageHeader) + size_t(_n++) * _rowSize, row, _rowSize);
+        _run._rows++;
+    }
+
+    Run finish()
+    {
+        seal();
+        return _run;
+    }
+};
+
+class RunReader
+{
+  private:
+    PagedFile::PageManager *_pm;
+    Run _run;
+    uint32_t _rowSize;
+    std::unique_ptr<uint8_t[]> _buf{new uint8_t[PAGESIZE]};
+    uint32_t _page = 0; // next page to read
+    uint32_t _n = 0;    // rows of _buf
+    uint32_t _i = 0;    // current row of _buf
+
+    bool load()
+    {
+        if (_page == _run._pages)
+            return false;
+        if (_page % SORTPREFETCH == 0)
+            _pm->prefetch(_run._fd, _page, std::min(SORTPREFETCH, _run._pages - _page));
+        auto p = _pm->getPage({_run._fd, _page++});
+        memcpy(_buf.get(), p->_data, PAGESIZE);
+        _pm->flush(p, true);
+        _n = reinterpret_cast<PageHeader *>(_buf.get())->_nextSlot;
+        _i = 0;
+        return true;
+    }
+
+  public:
+    RunReader(PagedFile::PageManager *pm, const Run &run, uint32_t rowSize) : _pm(pm), _run(run), _rowSize(rowSize)
+    {
+        load();
+    }
+
+    /**
+     * @brief current row, nullptr at the end
+     */
+    const uint8_t *get() const
+    {
+        return _i < _n ? _buf.get() + sizeof(PageHeader) + size_t(_i) * _rowSize : nullptr;
+    }
+
+    void advance()
+    {
+        if (++_i == _n)
+            load();
+    }
+};
+
+/**
+ * @brief external merge sort of rows.
+ * Rows are buffered up to a memory budget, then sorted by radix sort of normalized key and
+ * written to a temporary file as a sorted run. Runs are merged by a loser tree.
+ * Sorted rows are streamed by next(), for ORDER BY and bulk loading of indexes.
+ */
+class ExternalSorter
+{
+  private:
+    std::vector<Column> _packed;
+    std::vector<SortKey> _keys;
+    uint32_t _rowSize;
+    size_t _memory;
+    PagedFile::PageManager *_pm;
+
+    std::vector<uint8_t> _rows;
+    uint32_t _rowCount = 0;
+    std::vector<SortEntry> _order;
+    std::vector<Run> _runs;
+
+    bool _finished = false;
+    // in memory
+    uint32_t _pos = 0;
+    // merging
+    std::vector<std::unique_ptr<RunReader>> _readers;
+    struct ReaderLess
+    {
+        ExternalSorter *_s;
+        bool operator()(uint32_t i, uint32_t j) const
+        {
+            auto a = _s->_readers[i]->get(), b = _s->_readers[j]->get();
+            if (a == nullptr or b == nullptr)
+                return b == nullptr and (a != nullptr or i < j);
+            auto r = compareRows(a, b, _s->_packed, _s->_keys);
+            return r < 0 or (r == 0 and i < j);
+        }
+    };
+    std::unique_ptr<LoserTree<ReaderLess>> _tree;
+    bool _started = false;
+
+    const uint8_t *rowAt(uint32_t i) const
+    {
+        return _rows.data() + size_t(i) * _rowSize;
+    }
+
+    void sortBuffer()
+    {
+        auto &first = _packed[_keys[0]._col];
+        _order.resize(_rowCount);
+        for (uint32_t i = 0; i < _rowCount; i++)
+            _order[i] = {normalizeKey(rowAt(i) + first._offset, first, _keys[0]._desc), i};
+        radixSort(_order);
+        if (_keys.size() == 1 and (first._type != ColumnType::CHAR or first._size <= 8))
+            return;
+        // rows with the same normalized key are sorted by all keys
+        uint32_t i = 0;
+        while (i < _rowCount)
+        {
+            auto j = i + 1;
+            while (j < _rowCount and _order[j]._key == _order[i]._key)
+                j++;
+            if (j - i > 1)
+                std::stable_sort(_order.begin() + i, _order.begin() + j, [this](const SortEntry &a, const SortEntry &b) {
+                    return compareRows(rowAt(a._row), rowAt(b._row), _packed, _keys) < 0;
+                });
+            i = j;
+        }
+    }
+
+    void spill()
+    {
+        sortBuffer();
+        RunWriter w(_pm, _rowSize);
+        for (auto &&e : _order)
+            w.add(rowAt(e._row));
+        _runs.push_back(w.finish());
+        _rows.clear();
+        _rowCount = 0;
+    }
+
+    static void dropRun(const Run &r, PagedFile::PageManager *pm)
+    {
+        pm->discardAllByFd(r._fd);
+        PagedFile::FileManager::closeFile(r._fd, *pm);
+        PagedFile::FileManager::deleteFile(r._path);
+    }
+
+    void startMerge()
+    {
+        _readers.clear();
+        for (auto &&r : _runs)
+            _readers.emplace_back(std::make_unique<RunReader>(_pm, r, _rowSize));
+        _tree = std::make_unique<LoserTree<ReaderLess>>(_readers.size(), ReaderLess{this});
+    }
+
+    /**
+     * @brief merge runs until there are at most SORTFANIN runs
+     */
+    void reduceRuns()
+    {
+        while (_runs.size() > SORTFANIN)
+        {
+            std::vector<Run> rest(_runs.begin() + SORTFANIN, _runs.end());
+            _runs.resize(SORTFANIN);
+            startMerge();
+            RunWriter w(_pm, _rowSize);
+            const uint8_t *row;
+            while ((row = nextMerged()) != nullptr)
+                w.add(row);
+            _readers.clear();
+            for (auto &&r : _runs)
+                dropRun(r, _pm);
+            _runs = std::move(rest);
+            _runs.push_back(w.finish());
+        }
+    }
+
+    const uint8_t *nextMerged()
+    {
+        if (_started)
+        {
+            _readers[_tree->winner()]->advance();
+            _tree->replay();
+        }
+        _started = true;
+        auto row = _readers[_tree->winner()]->get();
+        if (row == nullptr)
+            _started = false;
+        return row;
+    }
+
+  public:
+    ExternalSorter() = delete;
+    ExternalSorter(const ExternalSorter &) = delete;
+
+    /**
+     * @param schema columns of rows
+     * @param memory memory budget of buffered rows in bytes
+     */
+    ExternalSorter(std::vector<Column> schema, std::vector<SortKey> keys, size_t memory = SORTMEMORY,
+                   PagedFile::PageManager *pm = PagedFile::getPageManager())
+        : _packed(std::move(schema)), _keys(std::move(keys)), _memory(memory), _pm(pm)
+    {
+        assert(not _keys.empty());
+        for (auto &&k : _keys)
+            assert(k._col < _packed.size());
+        _rowSize = packColumns(_packed);
+    }
+
+    ~ExternalSorter()
+    {
+        _readers.clear();
+        for (auto &&r : _runs)
+            dropRun(r, _pm);
+    }
+
+    const std::vector<Column> &packed() const
+    {
+        return _packed;
+    }
+
+    uint32_t rowSize() const
+    {
+        return _rowSize;
+    }
+
+    /**
+     * @brief number of runs written to disk
+     */
+    size_t runs() const
+    {
+        return _runs.size();
+    }
+
+    void add(const uint8_t *row)
+    {
+        assert(not _finished);
+        if (_rows.size() + _rowSize > _memory and _rowCount != 0)
+            spill();
+        _rows.insert(_rows.end(), row, row + _rowSize);
+        _rowCount++;
+    }
+
+    void add(const Batch &b)
+    {
+        ArenaScope scope;
+        auto row = static_cast<uint8_t *>(scope.arena().allocate(_rowSize));
+        for (uint32_t i = 0; i < b.size(); i++)
+        {
+            storeRow(b, b.rowAt(i), _packed, row);
+            add(row);
+        }
+    }
+
+    /**
+     * @brief no more rows, prepare to stream sorted rows
+     */
+    void finish()
+    {
+        assert(not _finished);
+        _finished = true;
+        if (_runs.empty())
+        {
+            sortBuffer();
+            return;
+        }
+        if (_rowCount != 0)
+            spill();
+        _rows.clear();
+        _rows.shrink_to_fit();
+        reduceRuns();
+        startMerge();
+    }
+
+    /**
+     * @brief next sorted row, valid until next call.
+     * @return nullptr at the end
+     */
+    const uint8_t *next()
+    {
+        assert(_finished);
+        if (_runs.empty())
+            return _pos < _rowCount ? rowAt(_order[_pos++]._row) : nullptr;
+        return nextMerged();
+    }
+};
+
+/**
+ * @brief ORDER BY, sort all rows of child.
+ */
+class SortOp : public Operator
+{
+  private:
+    OperatorPtr _child;
+    ExternalSorter _sorter;
+    std::vector<std::unique_ptr<Vector>> _vecs;
+    Batch _batch;
+    bool _sorted = false;
+
+  public:
+    SortOp() = delete;
+    SortOp(OperatorPtr child, std::vector<SortKey> keys, size_t memory = SORTMEMORY)
+        : _child(std::move(child)), _sorter(_child->schema(), std::move(keys), memory)
+    {
+        for (auto &&c : _child->schema())
+        {
+            _vecs.emplace_back(std::make_unique<Vector>(c));
+            _batch._cols.push_back(_vecs.back().get());
+        }
+    }
+
+    const std::vector<Column> &schema() const override
+    {
+        return _child->schema();
+    }
+
+    Batch *next() override
+    {
+        if (not _sorted)
+        {
+            Batch *b;
+            while ((b = _child->next()) != nullptr)
+                _sorter.add(*b);
+            _sorter.finish();
+            _sorted = true;
+        }
+        _batch._count = 0;
+        _batch._hasSel = false;
+        const uint8_t *row;
+        while (_batch._count < BATCHSIZE and (row = _sorter.next()) != nullptr)
+            loadRow(row, _sorter.packed(), _batch, 0, _batch._count++);
+        return _batch._count ? &_batch : nullptr;
+    }
+};
+
+} // namespace Exec
+
+#endif // __SQLIGHT_SORT__
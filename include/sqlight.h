@@ -2,6 +2,7 @@
 #define __SQLIGHT__
 #include <ciso646>
 #include <cstdint>
+#include <cstring>
 #include <tuple>
 
 #define SQLIGHT_VERSION "0.01"
@@ -12,6 +13,86 @@ constexpr unsigned PAGESIZE = 4096; // A page is 4096 bytes.
 
 constexpr unsigned CACHESIZE = 4096 * 2; // Cache could contains CACHESIZE pages for maximum.
 
+/**
+ * @brief type of a fixed width column in a record.
+ */
+enum class ColumnType : uint8_t
+{
+    INT32,
+    INT64,
+    FLOAT64,
+    CHAR, // fixed length bytes, width is Column::_size
+};
+
+constexpr uint32_t MAXCOLUMNS = 32; // max columns of a table
+
+constexpr uint32_t MAXCOLUMNNAME = 24; // max length of a column name, include '\0'
+
+/**
+ * @brief a column of a table, describes where a value lives in a record.
+ */
+struct Column
+{
+    char _name[MAXCOLUMNNAME];
+    ColumnType _type;
+    uint8_t _reserved;
+    uint16_t _size;   // width in bytes
+    uint32_t _offset; // offset in a record
+};
+
+/**
+ * @brief width in bytes of a value of type t. size is only used by CHAR.
+ */
+constexpr uint16_t columnWidth(ColumnType t, uint16_t size = 0)
+{
+    switch (t)
+    {
+    case ColumnType::INT32:
+        return 4;
+    case ColumnType::INT64:
+    case ColumnType::FLOAT64:
+        return 8;
+    default:
+        return size;
+    }
+}
+
+/**
+ * @brief map a value to a unsigned integer with the same order, for sorting and zone maps.
+ * Only the first 8 bytes of a CHAR are used, so the order of CHAR is not strict.
+ */
+inline uint64_t normalizeKey(const uint8_t *v, const Column &c, bool desc = false)
+{
+    uint64_t k = 0;
+    switch (c._type)
+    {
+    case ColumnType::INT32: {
+        int32_t i;
+        memcpy(&i, v, sizeof(i));
+        k = uint64_t(uint32_t(i) ^ 0x80000000u) << 32;
+        break;
+    }
+    case ColumnType::INT64: {
+        int64_t i;
+        memcpy(&i, v, sizeof(i));
+        k = uint64_t(i) ^ (1ULL << 63);
+        break;
+    }
+    case ColumnType::FLOAT64: {
+        double d;
+        memcpy(&d, v, sizeof(d));
+        d = d == 0 ? 0 : d; // -0.0 is 0.0
+        memcpy(&k, &d, sizeof(k));
+        k = (k >> 63) ? ~k : k | (1ULL << 63);
+        break;
+    }
+    default:
+        for (uint32_t i = 0; i < 8; i++)
+            k = (k << 8) | (i < c._size ? v[i] : 0);
+    }
+    return desc ? ~k : k;
+}
+
 struct TableHeader
 {
     uint32_t _recordSize;    // a record size in byte
@@ -19,18 +100,25 @@ struct TableHeader
     uint32_t _slotsPerPage;  // record number of one page could have, a slot for a record
     uint32_t _nextPage;      // next page could use
     uint32_t _totalRecords;  // total exitsted rsecord numbers in the file
+    uint32_t _columnCount;   // 0 for a table without schema
+    uint32_t _zoneColumns;   // bitmask of columns with zone map
+    uint32_t _zoneSpan;      // pages covered by a zone page, 0 for no zone map
+    Column _columns[MAXCOLUMNS];
 };
 
 constexpr uint32_t FIRSTLOADPAGE = 1; // first page which loads data record
 
 struct PageHeader
 {
-    // uint32_t _existsRecordNum;
+    uint64_t _lsn; // lsn of the last log record of this page, see PagedFile::LogManager
     uint32_t _nextSlot;
+    uint32_t _checksum; // CRC32C of the page as written to disk, see PagedFile::pageChecksum
 };
 
 constexpr uint32_t MAXRECORDSIZE = 4096 - sizeof(PageHeader) - 1;
 
+constexpr const char *STATSSUFFIX = ".stats"; // statistics of a table are in the file of its path with this suffix
+
 struct Rid
 {
     int _fd; // ? maybe useless ?
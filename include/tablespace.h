@@ -0,0 +1,217 @@
+#if !defined(__SQLIGHT_TABLESPACE__)
+#define __SQLIGHT_TABLESPACE__
+
+#include "memfile.h"
+#include "sqlight.h"
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <robin_hood.h>
+#include <set>
+#include <string>
+#include <string_view>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+
+namespace PagedFile
+{
+
+constexpr uint32_t EXTENTPAGES = 256; // pages of an extent, 1 MiB
+
+constexpr uint32_t TSGROWTH = 16; // extents preallocated at a time when a tablespace is full
+
+constexpr uint32_t TSDIRPAGES = 63; // pages of table directory, after the superblock
+
+constexpr uint32_t TSMAPPAGE = 1 + TSDIRPAGES; // first page of extent map, to the end of the first extent
+
+constexpr int TSFDBASE = 1 << 20; // virtual fds of tables in tablespaces start from it, real fds are below
+
+constexpr uint32_t TSFDSPAN = 1 << 12; // virtual fds of a tablespace
+
+constexpr uint64_t TSMAGIC = 0x6563617073626c74; // "tlbspace"
+
+constexpr std::string_view TSSEP = "::"; // a table in a tablespace is "<tablespace path>::<table name>"
+
+struct TablespaceHeader
+{
+    uint64_t _magic;
+    uint32_t _extents; // extents of the file, the first one is metadata
+    uint32_t _reserved;
+};
+
+struct TableEntry
+{
+    char _name[52];
+    uint32_t _id;      // 1 + index of the entry, 0 for a free entry
+    uint32_t _pages;   // pages written, pages after it read as zero
+    uint32_t _extents; // extents allocated
+};
+
+struct ExtentEntry
+{
+    uint32_t _table; // 0 for a free extent
+    uint32_t _seq;   // index of the extent in the table
+};
+
+constexpr uint32_t TSMAXTABLES = TSDIRPAGES * PAGESIZE / sizeof(TableEntry); // tables of a tablespace
+
+// largest table id, the id of a table is the offset of its virtual fd in the TSFDSPAN of the tablespace
+constexpr uint32_t TSMAXID = TSMAXTABLES < TSFDSPAN ? TSMAXTABLES : TSFDSPAN - 1;
+
+constexpr uint32_t TSMAXEXTENTS = (EXTENTPAGES - TSMAPPAGE) * PAGESIZE / sizeof(ExtentEntry);
+
+/**
+ * @brief many tables in one file, space is allocated by extents.
+ * The first extent is metadata: a superblock, a directory of tables and the owner of every extent.
+ * Metadata is kept in memory and written by sync, so it is durable with the pages written before.
+ * A table has a virtual fd, pages of it are read and written by read / write with its page numbers.
+ * A new extent of a table is the one after its last extent if it is free, so tables stay contiguous.
+ */
+class Tablespace
+{
+  private:
+    int _fd;
+    std::string _path;
+    int _fdBase;
+    std::mutex _mutex;
+    std::unique_ptr<uint8_t, decltype(&std::free)> _meta{nullptr, &std::free};
+    std::set<uint32_t> _dirtyMeta;                                       // pages of _meta changed since sync
+    robin_hood::unordered_map<uint32_t, std::vector<uint32_t>> _extents; // table id -> its extents in order
+    std::set<uint32_t> _free;
+
+    // tablespaces are never closed, as pages of them may be written back by PageManager at exit
+    static robin_hood::unordered_map<std::string, Tablespace *> &spaces();
+    static std::vector<Tablespace *> &byIndex();
+
+    TablespaceHeader *header()
+    {
+        return reinterpret_cast<TablespaceHeader *>(_meta.get());
+    }
+
+    TableEntry *entry(uint32_t id)
+    {
+        return reinterpret_cast<TableEntry *>(_meta.get() + PAGESIZE) + id - 1;
+    }
+
+    ExtentEntry *extentEntry(uint32_t extent)
+    {
+        return reinterpret_cast<ExtentEntry *>(_meta.get() + TSMAPPAGE * PAGESIZE) + extent;
+    }
+
+    void touch(const void *p)
+    {
+        _dirtyMeta.insert((static_cast<const uint8_t *>(p) - _meta.get()) / PAGESIZE);
+    }
+
+    uint32_t allocExtent(uint32_t id);
+
+    /**
+     * @brief physical page of page pageNum of table id, -1 if it reads as zero. _mutex must be held.
+     */
+    off_t locate(uint32_t id, uint32_t pageNum)
+    {
+        auto &e = _extents[id];
+        if (pageNum >= entry(id)->_pages or pageNum / EXTENTPAGES >= e.size())
+            return -1;
+        return off_t(e[pageNum / EXTENTPAGES]) * EXTENTPAGES + pageNum % EXTENTPAGES;
+    }
+
+    Tablespace(std::string_view path, int index);
+
+  public:
+    Tablespace(const Tablespace &) = delete;
+
+    /**
+     * @brief open a tablespace by path, it is created if create is true and it does not exist.
+     * @return nullptr if it does not exist
+     */
+    static Tablespace *open(std::string_view path, bool create = false);
+
+    static bool isVirtual(int fd)
+    {
+        return fd >= TSFDBASE and fd < MEMFDBASE;
+    }
+
+    static Tablespace *byFd(int fd)
+    {
+        return byIndex()[(fd - TSFDBASE) / TSFDSPAN];
+    }
+
+    static uint32_t idOf(int fd)
+    {
+        return (fd - TSFDBASE) % TSFDSPAN;
+    }
+
+    /**
+     * @brief split "<tablespace path>::<table name>", empty names if path is not in a tablespace
+     */
+    static std::pair<std::string, std::string> split(std::string_view path)
+    {
+        auto pos = path.rfind(TSSEP);
+        if (pos == std::string_view::npos)
+            return {};
+        return {std::string(path.substr(0, pos)), std::string(path.substr(pos + TSSEP.size()))};
+    }
+
+    const std::string &path() const
+    {
+        return _path;
+    }
+
+    /**
+     * @return id of a table, 0 if not found
+     */
+    uint32_t find(std::string_view name);
+
+    /**
+     * @return id of a new table
+     */
+    uint32_t create(std::string_view name);
+
+    /**
+     * @brief delete a table, its extents are free.
+     */
+    void drop(uint32_t id);
+
+    int fdOf(uint32_t id) const
+    {
+        return _fdBase + id;
+    }
+
+    /**
+     * @brief read n pages of table id from pageNum, pages never written are zero.
+     * Pages which are adjacent in the file are read by one preadv.
+     * @return bytes read
+     */
+    ssize_t read(uint32_t id, uint32_t pageNum, const struct iovec *iov, int n);
+
+    /**
+     * @brief write page pageNum of table id, extents are allocated for it.
+     */
+    ssize_t write(uint32_t id, uint32_t pageNum, const void *data);
+
+    /**
+     * @brief write metadata changed, then fdatasync the file.
+     */
+    void sync();
+
+    /**
+     * @brief pages of table id, including pages never written before the last one written
+     */
+    uint32_t pages(uint32_t id);
+
+    /**
+     * @brief extents of table id in order, for tests
+     */
+    std::vector<uint32_t> extents(uint32_t id);
+
+    /**
+     * @brief extents of the file, include the metadata extent
+     */
+    uint32_t size();
+};
+
+} // namespace PagedFile
+
+#endif // __SQLIGHT_TABLESPACE__
@@ -0,0 +1,145 @@
+#if !defined(__SQLIGHT_TRACE__)
+#define __SQLIGHT_TRACE__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+// trace points of PagedFile and RecordMgr are compiled only with SQLIGHT_TRACE, see option SQLIGHT_TRACE of cmake.
+// With it, a trace point costs a relaxed load while tracing is stopped.
+#if defined(SQLIGHT_TRACE)
+#define SQLIGHT_TRACE_CONCAT_(a, b) a##b
+#define SQLIGHT_TRACE_CONCAT(a, b) SQLIGHT_TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) Trace::Scope SQLIGHT_TRACE_CONCAT(_traceScope, __LINE__)(name)
+#else
+#define TRACE_SCOPE(name)
+#endif
+
+namespace Trace
+{
+
+constexpr uint32_t TRACEEVENTS = 1 << 16; // events kept per thread, older ones are overwritten
+
+struct Event
+{
+    const char *_name; // a string literal
+    uint32_t _tid;     // thread which recorded it
+    uint64_t _begin;   // ns of steady_clock
+    uint64_t _duration;
+    uint64_t _cycles; // 0 without counters
+    uint64_t _cacheMisses;
+};
+
+/**
+ * @brief events of a thread. Only the thread writes it, _head is published after an event is written,
+ * so a dump reads events up to _head without a lock.
+ * When the thread exits, the ring is taken by the next thread which traces, its events are kept until overwritten.
+ */
+struct Ring
+{
+    Event _events[TRACEEVENTS];
+    std::atomic<uint64_t> _head{0}; // events written
+    uint32_t _tid;                  // thread using it
+    int _counterFd = -1; // leader of perf_event_open counters of the thread, -1 if there is none
+    int _missFd = -1;
+    uint64_t _counterEpoch = 0;
+};
+
+extern std::atomic<bool> active;
+
+extern std::atomic<uint64_t> epoch; // counts start, a thread opens its counters again after a new start
+
+extern std::atomic<uint64_t> startTime; // events which begin before it are not dumped
+
+extern std::atomic<bool> counters;
+
+/**
+ * @brief ring of this thread, taken on first use and given back when the thread exits
+ */
+Ring &ring();
+
+/**
+ * @brief rings allocated, at most the number of threads which have traced at the same time
+ */
+size_t ringCount();
+
+/**
+ * @brief cycles and cache misses of this thread so far, zero if counters are off or not supported
+ */
+void readCounters(Ring &r, uint64_t &cycles, uint64_t &cacheMisses);
+
+/**
+ * @brief start to record events, events recorded before are not dumped.
+ * @param withCounters also count cpu cycles and cache misses of every event by perf_event_open,
+ * which costs a syscall at both ends of an event
+ */
+void start(bool withCounters = false);
+
+void stop();
+
+/**
+ * @brief write events of all threads to a Chrome trace JSON file, for chrome://tracing or ui.perfetto.dev.
+ * Call it after stop.
+ * @return events written
+ */
+uint64_t dump(std::string_view path);
+
+/**
+ * @brief whether trace points are compiled
+ */
+constexpr bool compiled()
+{
+#if defined(SQLIGHT_TRACE)
+    return true;
+#else
+    return false;
+#endif
+}
+
+inline uint64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+/**
+ * @brief an event from its construction to its destruction
+ */
+class Scope
+{
+  private:
+    const char *_name;
+    Ring *_ring = nullptr; // nullptr while tracing is stopped
+    uint64_t _begin, _cycles, _cacheMisses;
+
+  public:
+    Scope(const Scope &) = delete;
+
+    explicit Scope(const char *name) : _name(name)
+    {
+        if (not active.load(std::memory_order_relaxed))
+            return;
+        _ring = &ring();
+        readCounters(*_ring, _cycles, _cacheMisses);
+        _begin = now();
+    }
+
+    ~Scope()
+    {
+        if (_ring == nullptr)
+            return;
+        auto end = now();
+        uint64_t cycles, cacheMisses;
+        readCounters(*_ring, cycles, cacheMisses);
+        auto head = _ring->_head.load(std::memory_order_relaxed);
+        auto &e = _ring->_events[head % TRACEEVENTS];
+        e = {_name, _ring->_tid, _begin, end - _begin, cycles - _cycles, cacheMisses - _cacheMisses};
+        _ring->_head.store(head + 1, std::memory_order_release);
+    }
+};
+
+} // namespace Trace
+
+#endif // __SQLIGHT_TRACE__
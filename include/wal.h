@@ -0,0 +1,363 @@
+#if !defined(__SQLIGHT_WAL__)
+#define __SQLIGHT_WAL__
+
+#include "sqlight.h"
+#include <algorithm>
+#include <cassert>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <robin_hood.h>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace PagedFile
+{
+
+struct Page;
+
+enum class LogType : uint8_t
+{
+    PAGE,   // redo only, after image of bytes [_offset, _offset + _len) of a page
+    INSERT, // undo only, a record was inserted into slot _offset of page _pageNum
+    DELETE, // undo only, before image of a deleted record
+    UPDATE, // undo only, before image of a updated record
+    CLR,    // compensation, a undo record has been undone, rollback continues from _undoNext
+    COMMIT,
+    ABORT,
+    FILE,       // image is the path of _fileId
+    DROP,       // file _fileId was deleted
+    CHECKPOINT, // image is a CheckpointImage
+};
+
+constexpr uint8_t LOGEND = 1; // flag of the last record of a group
+
+constexpr uint32_t LOGHEADERSIZE = PAGESIZE; // the log file starts with a LogFileHeader
+
+constexpr uint64_t LOGMAGIC = 0x4c41575448474c53; // "SLGHTWAL"
+
+struct LogFileHeader
+{
+    uint64_t _magic;
+    uint64_t _base;  // lsn of offset 0 of the log file
+    uint64_t _start; // lsn of the first record, records before it are truncated
+};
+
+struct CheckpointImage
+{
+    uint64_t _redoLsn; // changes before it are on disk
+    uint64_t _maxTxn;
+};
+
+/**
+ * @brief a record of the log, followed by _len bytes image.
+ * Lsn of a record is its offset in the log, records of a change are appended as a group,
+ * a group without its last record is ignored.
+ */
+struct LogRecord
+{
+    uint32_t _size;     // bytes of the record, include header and image
+    uint32_t _checksum; // CRC32C of the whole record but _checksum
+    LogType _type;
+    uint8_t _flags;
+    uint16_t _len; // bytes of image
+    uint32_t _fileId;
+    uint64_t _lsn;
+    uint64_t _txn;      // 0 for changes without transaction, which are never undone
+    uint64_t _prevLsn;  // previous undo record (or CLR) of the transaction
+    uint64_t _undoNext; // CLR only
+    uint32_t _pageNum;
+    uint32_t _offset; // offset in page for PAGE, slot for INSERT, DELETE and UPDATE
+
+    const uint8_t *image() const
+    {
+        return reinterpret_cast<const uint8_t *>(this + 1);
+    }
+
+    /**
+     * @brief a PAGE record of the whole page but PageHeader::_lsn, see LogManager::logPage
+     */
+    bool isPageImage() const
+    {
+        return _type == LogType::PAGE and _offset == sizeof(PageHeader::_lsn) and _len == PAGESIZE - _offset;
+    }
+};
+
+uint32_t logChecksum(const LogRecord *r);
+
+/**
+ * @brief write ahead log.
+ * Records are appended to a memory buffer, and written by flush with one write and fdatasync.
+ * Threads waiting for the same flush share it (group commit).
+ * PageManager::attachLog makes a page written back only after the log of it is flushed.
+ */
+class LogManager
+{
+  private:
+    int _fd;
+    uint64_t _base;               // lsn of offset 0 of the log file
+    std::atomic<uint64_t> _start; // lsn of the first record
+    uint64_t _nextLsn;            // lsn of next record
+    uint64_t _bufferLsn;          // lsn of _buffer[0]
+    uint64_t _writingLsn;         // lsn of _writing[0]
+    uint64_t _flushedLsn;         // records before it are durable
+    std::vector<uint8_t> _buffer;
+    std::vector<uint8_t> _writing; // written by the flushing thread without holding _mutex
+    bool _flushing = false;
+    uint64_t _flushes = 0;
+    std::chrono::microseconds _groupDelay{0};
+    std::mutex _mutex;
+    std::condition_variable _cv;
+
+    uint64_t _maxTxn = 0;
+    struct TxnState
+    {
+        uint64_t _first; // lsn of the group of the first undo record, which begins with its page changes
+        uint64_t _last;  // lsn of the last undo record
+    };
+    robin_hood::unordered_map<uint64_t, TxnState> _active;
+    uint32_t _maxFileId = 0;
+    robin_hood::unordered_map<std::string, uint32_t> _path2id;
+    robin_hood::unordered_map<uint32_t, std::string> _id2path;
+    std::multiset<uint64_t> _pins; // records from them are kept by checkpoint
+
+    // records of a change made by a thread, appended to the log by endOp
+    struct OpState
+    {
+        int _depth = 0;
+        uint64_t _txn = 0; // current transaction of the thread
+        bool _undoing = false;
+        uint64_t _undoNext = 0;
+        uint64_t _savedTxn = 0; // transaction of the thread before beginUndo
+        std::vector<uint8_t> _buf;
+        std::vector<std::pair<Page *, uint32_t>> _pages; // page and offset of its record in _buf
+    };
+    static thread_local OpState _op;
+
+    LogRecord *pushRecord(std::vector<uint8_t> &buf, LogType type, uint32_t fileId, uint32_t len);
+    uint64_t appendGroup(std::vector<uint8_t> &group); // return lsn of the group, _mutex must be held
+    uint64_t appendOne(LogType type, uint64_t txn, uint32_t fileId, const void *image, uint32_t len);
+    uint64_t findEnd();
+    void loadState();
+
+    /**
+     * @brief call f(const LogRecord &) for records in [from, to) of the log file until it returns false.
+     * @return lsn where it stopped
+     */
+    template <typename F> uint64_t walk(uint64_t from, uint64_t to, F f)
+    {
+        constexpr size_t CHUNK = 1 << 20;
+        std::vector<uint8_t> buf(CHUNK);
+        size_t end = 0; // valid bytes of buf
+        uint64_t lsn = from, bufLsn = from;
+        while (lsn + sizeof(LogRecord) <= to)
+        {
+            auto need = [&](size_t n) {
+                if (lsn - bufLsn + n <= end)
+                    return true;
+                auto used = lsn - bufLsn;
+                memmove(buf.data(), buf.data() + used, end - used);
+                end -= used, bufLsn = lsn;
+                if (buf.size() < n)
+                    buf.resize(n);
+                auto want = std::min<uint64_t>(buf.size() - end, to - (bufLsn + end));
+                auto nread = pread(_fd, buf.data() + end, want, bufLsn + end - _base);
+                if (nread > 0)
+                    end += nread;
+                return lsn - bufLsn + n <= end;
+            };
+            if (not need(sizeof(LogRecord)))
+                break;
+            auto size = reinterpret_cast<const LogRecord *>(buf.data() + (lsn - bufLsn))->_size;
+            if (size < sizeof(LogRecord) or size > sizeof(LogRecord) + UINT16_MAX or lsn + size > to or
+                not need(size))
+                break;
+            if (not f(*reinterpret_cast<const LogRecord *>(buf.data() + (lsn - bufLsn))))
+                break;
+            lsn += size;
+        }
+        return lsn;
+    }
+
+  public:
+    LogManager(const LogManager &) = delete;
+
+    /**
+     * @brief open a log file, create it if it does not exist.
+     * A torn group at the end of the log is cut off.
+     */
+    explicit LogManager(std::string_view path);
+
+    /**
+     * @brief flush the log and close it. Transaction of the calling thread is forgotten.
+     */
+    ~LogManager();
+
+    uint64_t firstLsn() const
+    {
+        return _start;
+    }
+
+    uint64_t nextLsn()
+    {
+        std::lock_guard<std::mutex> lk(_mutex);
+        return _nextLsn;
+    }
+
+    uint64_t flushedLsn()
+    {
+        std::lock_guard<std::mutex> lk(_mutex);
+        return _flushedLsn;
+    }
+
+    /**
+     * @brief number of write + fdatasync, less than commits if commits are grouped.
+     */
+    uint64_t flushes()
+    {
+        std::lock_guard<std::mutex> lk(_mutex);
+        return _flushes;
+    }
+
+    /**
+     * @brief time a flushing thread waits before writing, so more commits could join the group.
+     */
+    void setGroupDelay(std::chrono::microseconds delay)
+    {
+        _groupDelay = delay;
+    }
+
+    /**
+     * @brief make records before lsn durable, -1 for all records.
+     * If another thread is flushing, wait for it and flush what is left.
+     */
+    void flush(uint64_t lsn = -1);
+
+    /**
+     * @brief read a record by lsn into buf.
+     */
+    void read(uint64_t lsn, std::vector<uint8_t> &buf);
+
+    /**
+     * @brief call f(const LogRecord &) for every record from lsn from in order.
+     */
+    template <typename F> void scan(F f, uint64_t from = 0)
+    {
+        flush();
+        walk(from ? from : firstLsn(), flushedLsn(), [&](const LogRecord &r) {
+            f(r);
+            return true;
+        });
+    }
+
+    /**
+     * @brief begin a transaction of the calling thread, changes without a transaction are never undone.
+     */
+    uint64_t begin();
+
+    /**
+     * @brief commit transaction of the calling thread and wait until it is durable.
+     * Without a transaction, wait until all changes before are durable.
+     */
+    void commit();
+
+    /**
+     * @brief log the end of a rolled back transaction, see RecordMgr::rollback.
+     */
+    void endAbort(uint64_t txn);
+
+    /**
+     * @brief current transaction of the calling thread, 0 for none.
+     */
+    uint64_t current() const
+    {
+        return _op._txn;
+    }
+
+    /**
+     * @brief lsn of last undo record of a active transaction
+     */
+    uint64_t lastLsn(uint64_t txn);
+
+    /**
+     * @brief transactions without commit or abort, they are rolled back by recovery.
+     */
+    std::vector<uint64_t> activeTransactions();
+
+    /**
+     * @brief lsn of the first change of active transactions, nextLsn if there is none.
+     */
+    uint64_t firstActiveLsn();
+
+    /**
+     * @brief changes between beginUndo and endUndo are compensations of a undo record of txn.
+     * @param undoNext _prevLsn of the undo record
+     */
+    void beginUndo(uint64_t txn, uint64_t undoNext);
+    void endUndo();
+
+    /**
+     * @brief changes between beginOp and endOp are appended as a group by endOp.
+     * Pages changed are stamped with lsn, and not evicted until endOp.
+     */
+    void beginOp();
+    void endOp();
+
+    /**
+     * @brief append records of the operation of this thread as a group before endOp, its pages are no longer
+     * pending. For an operation which changes more pages than the cache holds, atomicity of it is lost.
+     */
+    void appendOp();
+
+    /**
+     * @brief log bytes [offset, offset + len) of page p which have been changed.
+     * The first change of a page since it was written back logs the whole page instead, so redo rebuilds a page
+     * torn by a crash while writing it back.
+     */
+    void logPage(Page *p, uint32_t fileId, uint32_t offset, uint32_t len);
+
+    /**
+     * @brief log how to undo a change of record (pageNum, slot), by a transaction.
+     * It is a CLR while undoing, nothing without a transaction.
+     */
+    void logUndo(LogType type, uint32_t fileId, uint32_t pageNum, uint32_t slot, const void *before, uint32_t len);
+
+    /**
+     * @brief log a checkpoint and truncate the log before redoLsn.
+     * Records of active transactions are kept. Call it after changes before redoLsn are durable on disk.
+     * @return lsn of the checkpoint record
+     */
+    uint64_t checkpoint(uint64_t redoLsn);
+
+    /**
+     * @brief keep records from lsn until unpin, for a reader of the log such as a backup.
+     * @return lsn pinned, firstLsn if records before it are truncated
+     */
+    uint64_t pin(uint64_t lsn);
+    void unpin(uint64_t lsn);
+
+    /**
+     * @brief id of a file in log records, a new file is logged with its path.
+     */
+    uint32_t fileId(std::string_view path);
+
+    /**
+     * @brief path of a file id, empty if not found.
+     */
+    std::string pathOf(uint32_t fileId);
+
+    /**
+     * @brief log a file is deleted, records of it before are not redone.
+     */
+    void dropFile(std::string_view path);
+};
+
+} // namespace PagedFile
+
+#endif // __SQLIGHT_WAL__
@@ -1,6 +1,384 @@
 #include "fmt/format.h"
+#include "import.h"
+#include "optimizer.h"
+#include "output.h"
+#include "record.h"
 #include "utf8.h"
+#include <chrono>
 #include <ciso646>
+#include <algorithm>
+#include <charconv>
+#include <csignal>
+#include <cstdio>
+#include <fcntl.h>
+#include <map>
+#include <sstream>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+
+struct Shell
+{
+    Exec::OutputFormat _mode = Exec::OutputFormat::CSV;
+    bool _headers = false;
+    int _out = STDOUT_FILENO;
+} shell;
+
+constexpr const char *HELP = R"(.create TABLE COLUMN:TYPE ...    create a table, TYPE is int32, int64, float64 or char:N
+.import FILE TABLE [csv|tsv|binary] [header] [threads=N]
+                                  load a file into a table, a binary file has records of the table layout
+.count TABLE                      count records of a table
+.select TABLE [COLUMN ...] [where COLUMN OP VALUE]
+                                  write rows of a table to the output, OP is = != < <= > >=
+.analyze TABLE [pages=N]          sample N pages of a table and keep statistics of its columns
+.explain TABLE COLUMN OP VALUE    show the access path chosen for a predicate
+.mode csv|tsv|binary              format of rows written by .select
+.headers on|off                   write a line of column names before rows
+.output [FILE]                    write rows to a file, or stdout without FILE
+.help                             show this message
+.quit                             exit
+)";
+
+std::vector<std::string> split(const std::string &line)
+{
+    std::istringstream in(line);
+    std::vector<std::string> words;
+    for (std::string w; in >> w;)
+        words.push_back(w);
+    return words;
+}
+
+/**
+ * @brief parse s as a whole as a number in [min, max]
+ */
+bool parseNumber(std::string_view s, uint32_t min, uint32_t max, uint32_t &n)
+{
+    auto r = std::from_chars(s.data(), s.data() + s.size(), n);
+    return r.ec == std::errc() and r.ptr == s.data() + s.size() and n >= min and n <= max;
+}
+
+bool parseColumn(const std::string &spec, Column &c)
+{
+    auto pos = spec.find(':');
+    if (pos == std::string::npos or pos == 0 or pos >= MAXCOLUMNNAME)
+        return false;
+    auto name = spec.substr(0, pos), type = spec.substr(pos + 1);
+    if (type == "int32")
+        c = RecordMgr::makeColumn(name, ColumnType::INT32);
+    else if (type == "int64")
+        c = RecordMgr::makeColumn(name, ColumnType::INT64);
+    else if (type == "float64")
+        c = RecordMgr::makeColumn(name, ColumnType::FLOAT64);
+    else if (uint32_t n; type.rfind("char:", 0) == 0 and parseNumber(type.substr(5), 1, MAXRECORDSIZE, n))
+        c = RecordMgr::makeColumn(name, ColumnType::CHAR, n);
+    else
+        return false;
+    return true;
+}
+
+void create(const std::vector<std::string> &words)
+{
+    if (words.size() < 3 or words.size() - 2 > MAXCOLUMNS)
+    {
+        fmt::print("usage: .create TABLE COLUMN:TYPE ...\n");
+        return;
+    }
+    std::vector<Column> columns(words.size() - 2);
+    uint32_t recordSize = 0;
+    for (size_t i = 2; i < words.size(); i++)
+    {
+        if (not parseColumn(words[i], columns[i - 2]))
+        {
+            fmt::print("bad column {}\n", words[i]);
+            return;
+        }
+        recordSize += columns[i - 2]._size;
+    }
+    if (recordSize > MAXRECORDSIZE)
+    {
+        fmt::print("records are over {} bytes\n", MAXRECORDSIZE);
+        return;
+    }
+    if (not PagedFile::FileManager::isFile(words[1]).empty())
+    {
+        fmt::print("{} exists\n", words[1]);
+        return;
+    }
+    auto rm = RecordMgr::RecordFileManager::creatTable(words[1], columns);
+    RecordMgr::RecordFileManager::closeTable(rm);
+}
+
+void import(const std::vector<std::string> &words)
+{
+    if (words.size() < 3)
+    {
+        fmt::print("usage: .import FILE TABLE [csv|tsv|binary] [header] [threads=N]\n");
+        return;
+    }
+    Import::Options opt;
+    for (size_t i = 3; i < words.size(); i++)
+    {
+        if (words[i] == "csv")
+            opt._format = Import::Format::CSV;
+        else if (words[i] == "tsv")
+            opt._format = Import::Format::TSV;
+        else if (words[i] == "binary")
+            opt._format = Import::Format::BINARY;
+        else if (words[i] == "header")
+            opt._header = true;
+        else if (words[i].rfind("threads=", 0) == 0)
+        {
+            if (not parseNumber(std::string_view(words[i]).substr(8), 1, UINT16_MAX, opt._threads))
+            {
+                fmt::print("usage: .import FILE TABLE [csv|tsv|binary] [header] [threads=N]\n");
+                return;
+            }
+        }
+        else
+        {
+            fmt::print("unknown option {}\n", words[i]);
+            return;
+        }
+    }
+    if (access(words[1].c_str(), R_OK) != 0 or PagedFile::FileManager::isFile(words[2]).empty())
+    {
+        fmt::print("no such file or table\n");
+        return;
+    }
+    auto rm = RecordMgr::RecordFileManager::openTable(words[2]);
+    if (rm.getTableHeader()._columnCount == 0 and opt._format != Import::Format::BINARY)
+    {
+        fmt::print("a table without a schema is only loaded from a binary file\n");
+        RecordMgr::RecordFileManager::closeTable(rm);
+        return;
+    }
+    auto begin = std::chrono::steady_clock::now();
+    auto st = Import::importFile(words[1], rm, opt);
+    std::chrono::duration<double> secs = std::chrono::steady_clock::now() - begin;
+    fmt::print("{} rows, {} errors, {:.2f} s, {:.1f} MiB/s\n", st._rows, st._errors, secs.count(),
+               st._bytes / secs.count() / (1 << 20));
+    auto &th = rm.getTableHeader();
+    if (st._errors and st._errorColumn < th._columnCount)
+        fmt::print("first error at byte {}, column {}\n", st._errorOffset, th._columns[st._errorColumn]._name);
+    else if (st._errors)
+        fmt::print("first error at byte {}\n", st._errorOffset);
+    RecordMgr::RecordFileManager::closeTable(rm);
+}
+
+void count(const std::vector<std::string> &words)
+{
+    if (words.size() != 2 or PagedFile::FileManager::isFile(words[1]).empty())
+    {
+        fmt::print("usage: .count TABLE\n");
+        return;
+    }
+    auto rm = RecordMgr::RecordFileManager::openTable(words[1]);
+    fmt::print("{}\n", rm.getTotalRecord());
+    RecordMgr::RecordFileManager::closeTable(rm);
+}
+
+struct Predicate
+{
+    uint32_t _col;
+    Exec::CmpOp _op;
+    bool _integer;   // an integer literal on an integer column, _ivalue is exact
+    int64_t _ivalue;
+    double _value;
+};
+
+/**
+ * @brief parse `COLUMN OP VALUE` from words[first], the column is a number
+ */
+bool parsePredicate(const RecordMgr::RecordManager &rm, const std::vector<std::string> &words, size_t first,
+                    Predicate &p)
+{
+    static const std::map<std::string, Exec::CmpOp> ops = {
+        {"=", Exec::CmpOp::EQ}, {"==", Exec::CmpOp::EQ}, {"!=", Exec::CmpOp::NE}, {"<", Exec::CmpOp::LT},
+        {"<=", Exec::CmpOp::LE}, {">", Exec::CmpOp::GT}, {">=", Exec::CmpOp::GE}};
+    if (words.size() != first + 3 or ops.count(words[first + 1]) == 0)
+        return false;
+    auto c = rm.getColumnIndex(words[first]);
+    if (c < 0 or rm.getTableHeader()._columns[c]._type == ColumnType::CHAR)
+        return false;
+    auto &v = words[first + 2];
+    p = {uint32_t(c), ops.at(words[first + 1]), false, 0, 0};
+    if (rm.getTableHeader()._columns[c]._type != ColumnType::FLOAT64)
+    {
+        auto r = std::from_chars(v.data() + (v[0] == '+'), v.data() + v.size(), p._ivalue);
+        p._integer = r.ec == std::errc() and r.ptr == v.data() + v.size();
+    }
+    char *end;
+    p._value = strtod(v.c_str(), &end);
+    return *end == '\0';
+}
+
+Exec::OperatorPtr planScan(const RecordMgr::RecordManager &rm, const Optimizer::TableStats *stats,
+                           const Predicate &p)
+{
+    if (p._integer)
+        return Optimizer::planScan(rm, stats, p._col, p._op, p._ivalue);
+    return Optimizer::planScan(rm, stats, p._col, p._op, p._value);
+}
+
+void select(const std::vector<std::string> &words)
+{
+    if (words.size() < 2 or PagedFile::FileManager::isFile(words[1]).empty())
+    {
+        fmt::print("usage: .select TABLE [COLUMN ...] [where COLUMN OP VALUE]\n");
+        return;
+    }
+    auto rm = RecordMgr::RecordFileManager::openTable(words[1]);
+    auto where = std::find(words.begin(), words.end(), "where") - words.begin();
+    Predicate pred;
+    if (size_t(where) != words.size() and not parsePredicate(rm, words, where + 1, pred))
+    {
+        fmt::print("bad predicate, COLUMN OP VALUE on a number column\n");
+        RecordMgr::RecordFileManager::closeTable(rm);
+        return;
+    }
+    std::vector<uint32_t> columns;
+    for (size_t i = 2; i < size_t(where); i++)
+    {
+        auto c = rm.getColumnIndex(words[i]);
+        if (c < 0)
+        {
+            fmt::print("no column {}\n", words[i]);
+            RecordMgr::RecordFileManager::closeTable(rm);
+            return;
+        }
+        columns.push_back(c);
+    }
+    if (rm.getTableHeader()._columnCount == 0)
+    {
+        fmt::print("a table without a schema could not be selected\n");
+        RecordMgr::RecordFileManager::closeTable(rm);
+        return;
+    }
+    {
+        Exec::OperatorPtr op;
+        if (size_t(where) == words.size())
+            op = std::make_unique<Exec::ScanOp>(&rm, columns);
+        else
+        {
+            Optimizer::TableStats stats;
+            bool analyzed = Optimizer::loadStats(words[1], stats);
+            op = planScan(rm, analyzed ? &stats : nullptr, pred);
+            if (not columns.empty())
+                op = std::make_unique<Exec::ProjectOp>(std::move(op), columns);
+        }
+        Exec::ResultWriter out(shell._out, shell._mode);
+        if (shell._headers)
+            out.header(op->schema());
+        out.drain(*op);
+        if (out.failed())
+            fmt::print(stderr, "write to the output failed\n");
+    }
+    RecordMgr::RecordFileManager::closeTable(rm);
+}
+
+void analyze(const std::vector<std::string> &words)
+{
+    uint32_t pages = Optimizer::STATSSAMPLE;
+    bool usage = words.size() < 2 or words.size() > 3 or PagedFile::FileManager::isFile(words[1]).empty();
+    if (not usage and words.size() == 3)
+        usage = words[2].rfind("pages=", 0) != 0 or
+                not parseNumber(std::string_view(words[2]).substr(6), 1, UINT32_MAX, pages);
+    if (usage)
+    {
+        fmt::print("usage: .analyze TABLE [pages=N]\n");
+        return;
+    }
+    auto rm = RecordMgr::RecordFileManager::openTable(words[1]);
+    auto &th = rm.getTableHeader();
+    if (th._columnCount == 0)
+    {
+        fmt::print("a table without a schema could not be analyzed\n");
+        RecordMgr::RecordFileManager::closeTable(rm);
+        return;
+    }
+    auto stats = Optimizer::analyze(rm, pages);
+    Optimizer::saveStats(words[1], stats);
+    fmt::print("{} rows, {} pages, {} pages sampled\n", stats._rows, stats._pages, stats._sampledPages);
+    fmt::print("{:<{}} {:>12} {:>8} {:>8}\n", "column", MAXCOLUMNNAME, "distinct", "empty", "spread");
+    for (uint32_t c = 0; c < th._columnCount; c++)
+    {
+        auto &cs = stats._columns[c];
+        fmt::print("{:<{}} {:>12} {:>8.4f} {:>8.4f}\n", th._columns[c]._name, MAXCOLUMNNAME, cs._distinct,
+                   cs._nullFraction, cs._pageSpread);
+    }
+    RecordMgr::RecordFileManager::closeTable(rm);
+}
+
+void explain(const std::vector<std::string> &words)
+{
+    if (words.size() != 5 or PagedFile::FileManager::isFile(words[1]).empty())
+    {
+        fmt::print("usage: .explain TABLE COLUMN OP VALUE\n");
+        return;
+    }
+    auto rm = RecordMgr::RecordFileManager::openTable(words[1]);
+    Predicate pred;
+    if (parsePredicate(rm, words, 2, pred))
+    {
+        Optimizer::TableStats stats;
+        bool analyzed = Optimizer::loadStats(words[1], stats);
+        auto path = pred._integer
+                        ? Optimizer::chooseAccess(rm, analyzed ? &stats : nullptr, pred._col, pred._op, pred._ivalue)
+                        : Optimizer::chooseAccess(rm, analyzed ? &stats : nullptr, pred._col, pred._op, pred._value);
+        fmt::print("{}, {:.0f} rows, {:.0f} pages, cost {:.1f}{}\n",
+                   path._access == Optimizer::Access::ZONESCAN ? "zone scan" : "full scan", path._rows, path._pages,
+                   path._cost, analyzed ? "" : ", not analyzed");
+    }
+    else
+        fmt::print("bad predicate, COLUMN OP VALUE on a number column\n");
+    RecordMgr::RecordFileManager::closeTable(rm);
+}
+
+void mode(const std::vector<std::string> &words)
+{
+    if (words.size() == 2 and words[1] == "csv")
+        shell._mode = Exec::OutputFormat::CSV;
+    else if (words.size() == 2 and words[1] == "tsv")
+        shell._mode = Exec::OutputFormat::TSV;
+    else if (words.size() == 2 and words[1] == "binary")
+        shell._mode = Exec::OutputFormat::BINARY;
+    else
+        fmt::print("usage: .mode csv|tsv|binary\n");
+}
+
+void headers(const std::vector<std::string> &words)
+{
+    if (words.size() == 2 and (words[1] == "on" or words[1] == "off"))
+        shell._headers = words[1] == "on";
+    else
+        fmt::print("usage: .headers on|off\n");
+}
+
+void output(const std::vector<std::string> &words)
+{
+    int fd = STDOUT_FILENO;
+    if (words.size() == 2)
+    {
+        fd = open(words[1].c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1)
+        {
+            fmt::print("could not open {}: {}\n", words[1], strerror(errno));
+            return;
+        }
+    }
+    else if (words.size() != 1)
+    {
+        fmt::print("usage: .output [FILE]\n");
+        return;
+    }
+    if (shell._out != STDOUT_FILENO)
+        close(shell._out);
+    shell._out = fd;
+}
+
+} // namespace
 
 int main(int argc, char **argv)
 {
@@ -10,11 +388,46 @@ int main(int argc, char **argv)
     SetConsoleOutputCP(CP_UTF8);
 #endif
 
-    string u8 = u8"Ελληνικά -- Español -- 中国 --  ĐĄßĞĝ ";
-    fmt::print("{}\n", u8);
-
-    string input = getLineUtf8();
-    fmt::print("{}\n", input);
-
+    signal(SIGPIPE, SIG_IGN); // a closed pipe fails .select instead of killing the shell
+    bool prompt = isatty(STDIN_FILENO);
+    while (true)
+    {
+        if (prompt)
+        {
+            fmt::print("sqlight> ");
+            fflush(stdout);
+        }
+        string input = getLineUtf8();
+        if (input.empty() and std::cin.eof())
+            break;
+        auto words = split(input);
+        if (words.empty())
+            continue;
+        if (words[0] == ".quit" or words[0] == ".exit")
+            break;
+        else if (words[0] == ".create")
+            create(words);
+        else if (words[0] == ".import")
+            import(words);
+        else if (words[0] == ".count")
+            count(words);
+        else if (words[0] == ".select")
+            select(words);
+        else if (words[0] == ".analyze")
+            analyze(words);
+        else if (words[0] == ".explain")
+            explain(words);
+        else if (words[0] == ".mode")
+            mode(words);
+        else if (words[0] == ".headers")
+            headers(words);
+        else if (words[0] == ".output")
+            output(words);
+        else if (words[0] == ".help")
+            fmt::print("{}", HELP);
+        else
+            fmt::print("unknown command {}, enter .help for usage\n", words[0]);
+    }
+    output({".output"});
     return 0;
 }
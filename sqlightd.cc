@@ -0,0 +1,63 @@
+// sqlightd, a server which shares one page cache among local processes.
+// usage: sqlightd SOCKET [threads=N] [cache=PAGES]
+// cache creates a pool of PAGES pages for tables served, or the default pool is used.
+#include "fmt/format.h"
+#include "server.h"
+#include <charconv>
+#include <ciso646>
+#include <csignal>
+#include <string>
+
+namespace
+{
+
+Server::Server *server = nullptr;
+
+void onSignal(int)
+{
+    if (server)
+        server->stop();
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fmt::print(stderr, "usage: {} SOCKET [threads=N] [cache=PAGES]\n", argv[0]);
+        return 1;
+    }
+    uint32_t threads = 0, cache = 0;
+    for (int i = 2; i < argc; i++)
+    {
+        std::string_view arg = argv[i];
+        auto number = [&](size_t prefix, uint32_t &n) {
+            auto r = std::from_chars(arg.data() + prefix, arg.data() + arg.size(), n);
+            return r.ec == std::errc() and r.ptr == arg.data() + arg.size() and n > 0;
+        };
+        bool ok = false;
+        if (arg.rfind("threads=", 0) == 0)
+            ok = number(8, threads);
+        else if (arg.rfind("cache=", 0) == 0)
+            ok = number(6, cache);
+        if (not ok)
+        {
+            fmt::print(stderr, "bad option {}\nusage: {} SOCKET [threads=N] [cache=PAGES]\n", arg, argv[0]);
+            return 1;
+        }
+    }
+    if (cache)
+        PagedFile::createPool("sqlightd", cache);
+
+    Server::Server s(argv[1], threads, cache ? "sqlightd" : "");
+    server = &s;
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    signal(SIGPIPE, SIG_IGN);
+    fmt::print("sqlightd listening on {}\n", argv[1]);
+    fflush(stdout);
+    s.run();
+    server = nullptr;
+    return 0;
+}
@@ -0,0 +1,148 @@
+#include "checksum.h"
+#include <cstring>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+namespace
+{
+
+constexpr uint32_t POLY = 0x82f63b78; // reflected polynomial of CRC32C
+
+constexpr uint32_t LANE = 256; // bytes of each of the three interleaved streams of the crc32 instruction
+
+struct Tables
+{
+    uint32_t _slice[8][256];
+    uint32_t _shift[4][256]; // multiply a crc by x^(8 * LANE)
+
+    static uint32_t times(const uint32_t *mat, uint32_t vec)
+    {
+        uint32_t sum = 0;
+        for (; vec; vec >>= 1, mat++)
+            sum ^= vec & 1 ? *mat : 0;
+        return sum;
+    }
+
+    static void square(uint32_t *dst, const uint32_t *mat)
+    {
+        for (int n = 0; n < 32; n++)
+            dst[n] = times(mat, mat[n]);
+    }
+
+    Tables()
+    {
+        for (uint32_t n = 0; n < 256; n++)
+        {
+            uint32_t crc = n;
+            for (int k = 0; k < 8; k++)
+                crc = crc & 1 ? (crc >> 1) ^ POLY : crc >> 1;
+            _slice[0][n] = crc;
+        }
+        for (uint32_t n = 0; n < 256; n++)
+        {
+            for (int k = 1; k < 8; k++)
+                _slice[k][n] = (_slice[k - 1][n] >> 8) ^ _slice[0][_slice[k - 1][n] & 0xff];
+        }
+
+        // operator of appending LANE zero bytes, by squaring the operator of one zero bit
+        uint32_t odd[32], even[32];
+        odd[0] = POLY;
+        for (int n = 1; n < 32; n++)
+            odd[n] = 1u << (n - 1);
+        square(even, odd); // 2 bits
+        square(odd, even); // 4 bits
+        auto *op = odd;
+        for (size_t len = LANE; len; len >>= 1) // bytes
+        {
+            square(even, odd);
+            op = even;
+            len >>= 1;
+            if (len == 0)
+                break;
+            square(odd, even);
+            op = odd;
+        }
+        for (uint32_t n = 0; n < 256; n++)
+        {
+            for (int k = 0; k < 4; k++)
+                _shift[k][n] = times(op, n << (8 * k));
+        }
+    }
+};
+
+const Tables tables;
+
+uint32_t shift(uint32_t crc)
+{
+    auto &t = tables._shift;
+    return t[0][crc & 0xff] ^ t[1][(crc >> 8) & 0xff] ^ t[2][(crc >> 16) & 0xff] ^ t[3][crc >> 24];
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) uint32_t crc32cHw(const void *data, size_t len, uint32_t crc)
+{
+    auto p = static_cast<const uint8_t *>(data);
+    uint64_t crc0 = ~crc;
+    for (; len and reinterpret_cast<uintptr_t>(p) & 7; len--)
+        crc0 = _mm_crc32_u8(crc0, *p++);
+    // three streams hide the latency of the instruction, then they are combined
+    for (; len >= 3 * LANE; len -= 3 * LANE, p += 3 * LANE)
+    {
+        uint64_t crc1 = 0, crc2 = 0;
+        for (uint32_t i = 0; i < LANE; i += 8)
+        {
+            crc0 = _mm_crc32_u64(crc0, *reinterpret_cast<const uint64_t *>(p + i));
+            crc1 = _mm_crc32_u64(crc1, *reinterpret_cast<const uint64_t *>(p + LANE + i));
+            crc2 = _mm_crc32_u64(crc2, *reinterpret_cast<const uint64_t *>(p + 2 * LANE + i));
+        }
+        crc0 = shift(crc0) ^ crc1;
+        crc0 = shift(crc0) ^ crc2;
+    }
+    for (; len >= 8; len -= 8, p += 8)
+        crc0 = _mm_crc32_u64(crc0, *reinterpret_cast<const uint64_t *>(p));
+    for (; len; len--)
+        crc0 = _mm_crc32_u8(crc0, *p++);
+    return ~static_cast<uint32_t>(crc0);
+}
+
+const bool hardware = __builtin_cpu_supports("sse4.2");
+#else
+const bool hardware = false;
+#endif
+
+} // namespace
+
+uint32_t crc32cSoftware(const void *data, size_t len, uint32_t crc)
+{
+    auto &t = tables._slice;
+    auto p = static_cast<const uint8_t *>(data);
+    crc = ~crc;
+    for (; len and reinterpret_cast<uintptr_t>(p) & 7; len--)
+        crc = t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    for (; len >= 8; len -= 8, p += 8)
+    {
+        uint64_t w;
+        memcpy(&w, p, sizeof(w));
+        w ^= crc;
+        crc = t[7][w & 0xff] ^ t[6][(w >> 8) & 0xff] ^ t[5][(w >> 16) & 0xff] ^ t[4][(w >> 24) & 0xff] ^
+              t[3][(w >> 32) & 0xff] ^ t[2][(w >> 40) & 0xff] ^ t[1][(w >> 48) & 0xff] ^ t[0][w >> 56];
+    }
+    for (; len; len--)
+        crc = t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+uint32_t crc32c(const void *data, size_t len, uint32_t crc)
+{
+#if defined(__x86_64__)
+    if (hardware)
+        return crc32cHw(data, len, crc);
+#endif
+    return crc32cSoftware(data, len, crc);
+}
+
+bool crc32cHardware()
+{
+    return hardware;
+}
@@ -0,0 +1,477 @@
+#include "import.h"
+#include <atomic>
+#include <cassert>
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#endif
+
+namespace Import
+{
+
+Masks scan64(const char *p, char delim)
+{
+    Masks m{0, 0, 0};
+#if defined(__x86_64__)
+    auto nl = _mm_set1_epi8('\n'), quote = _mm_set1_epi8('"'), d = _mm_set1_epi8(delim);
+    for (int i = 0; i < 4; i++)
+    {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16 * i));
+        m._newline |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)))) << (16 * i);
+        m._quote |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(v, quote)))) << (16 * i);
+        m._delim |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(v, d)))) << (16 * i);
+    }
+#else
+    for (int i = 0; i < 64; i++)
+    {
+        m._newline |= uint64_t(p[i] == '\n') << i;
+        m._quote |= uint64_t(p[i] == '"') << i;
+        m._delim |= uint64_t(p[i] == delim) << i;
+    }
+#endif
+    return m;
+}
+
+namespace
+{
+
+/**
+ * @brief masks of [p, min(p + 64, end)), bytes after end are not matched
+ */
+Masks block(const char *p, const char *end, char delim)
+{
+    if (end - p >= 64)
+        return scan64(p, delim);
+    char buf[64] = {};
+    memcpy(buf, p, end - p);
+    auto m = scan64(buf, delim);
+    uint64_t valid = (1ull << (end - p)) - 1;
+    m._newline &= valid, m._quote &= valid, m._delim &= valid;
+    return m;
+}
+
+/**
+ * @brief whether quotes in [p, end) are odd
+ */
+bool quoteParity(const char *p, const char *end)
+{
+    int n = 0;
+    for (; p < end; p += 64)
+        n += __builtin_popcountll(block(p, end, '"')._quote);
+    return n & 1;
+}
+
+/**
+ * @brief the byte after the first line end from p which is not quoted, nullptr if there is none.
+ * @param quoted whether p is in quotes, it is updated to the returned position
+ */
+const char *lineEnd(const char *p, const char *end, bool csv, bool &quoted)
+{
+    for (; p < end; p += 64)
+    {
+        auto m = block(p, end, ',');
+        auto bits = m._newline | (csv ? m._quote : 0);
+        for (; bits; bits &= bits - 1)
+        {
+            auto i = __builtin_ctzll(bits);
+            if (p[i] == '"')
+                quoted = not quoted;
+            else if (not quoted)
+                return p + i + 1;
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * @brief run work(i) for i in [0, n) by threads workers
+ */
+template <typename F> void parallel(uint32_t n, uint32_t threads, F work)
+{
+    std::atomic<uint32_t> next{0};
+    std::vector<std::thread> pool;
+    for (uint32_t t = 0; t < std::min(threads, n); t++)
+    {
+        pool.emplace_back([&, t] {
+            for (uint32_t i; (i = next++) < n;)
+                work(t, i);
+        });
+    }
+    for (auto &&t : pool)
+        t.join();
+}
+
+struct Chunk
+{
+    const char *_begin;
+    const char *_end;
+};
+
+/**
+ * @brief cut text into chunks of about size bytes at line ends which are not quoted.
+ * Quotes of every size bytes are counted by threads, so whether a cut point is in quotes is known without
+ * a serial pass over the text.
+ */
+std::vector<Chunk> cut(const char *begin, const char *end, bool csv, uint64_t size, uint32_t threads)
+{
+    uint32_t blocks = (end - begin + size - 1) / size;
+    std::vector<uint8_t> odd(blocks); // quotes in block i are odd
+    if (csv)
+    {
+        parallel(blocks, threads, [&](uint32_t, uint32_t i) {
+            odd[i] = quoteParity(begin + i * size, std::min(end, begin + (i + 1) * size));
+        });
+    }
+    std::vector<Chunk> ans;
+    auto from = begin;
+    bool quoted = false; // at the beginning of block i
+    for (uint32_t i = 1; i < blocks; i++)
+    {
+        quoted ^= odd[i - 1];
+        auto target = begin + i * size;
+        if (target <= from) // a quoted field longer than a block
+            continue;
+        auto q = quoted;
+        auto next = lineEnd(target, end, csv, q);
+        if (next == nullptr)
+            break;
+        ans.push_back({from, next});
+        from = next;
+    }
+    if (from < end)
+        ans.push_back({from, end});
+    return ans;
+}
+
+/**
+ * @brief parse lines into records of a table, records are inserted a batch at a time
+ */
+class Parser
+{
+  private:
+    RecordMgr::RecordManager &_rm;
+    const TableHeader &_th;
+    char _delim;
+    bool _csv;
+    std::vector<uint8_t> _batch;
+    uint32_t _n = 0; // records in _batch
+    std::string _unquoted;
+
+    uint32_t _col = 0;
+    bool _bad = false;                // the line has a bad field
+    uint32_t _badColumn = UINT32_MAX; // its first bad field
+
+    bool put(const char *b, const char *e, const Column &c, uint8_t *dst)
+    {
+        if (c._type == ColumnType::CHAR)
+        {
+            auto len = std::min<size_t>(e - b, c._size);
+            memcpy(dst, b, len);
+            memset(dst + len, 0, c._size - len);
+            return true;
+        }
+        if (b < e and *b == '+')
+            b++;
+        if (b == e) // an empty number is 0
+        {
+            memset(dst, 0, c._size);
+            return true;
+        }
+        std::from_chars_result r;
+        if (c._type == ColumnType::INT32)
+        {
+            int32_t v = 0;
+            r = std::from_chars(b, e, v);
+            memcpy(dst, &v, sizeof(v));
+        }
+        else if (c._type == ColumnType::INT64)
+        {
+            int64_t v = 0;
+            r = std::from_chars(b, e, v);
+            memcpy(dst, &v, sizeof(v));
+        }
+        else
+        {
+            double v = 0;
+            r = std::from_chars(b, e, v);
+            memcpy(dst, &v, sizeof(v));
+        }
+        return r.ec == std::errc() and r.ptr == e;
+    }
+
+    void endField(const char *b, const char *e, bool quotes)
+    {
+        if (_col >= _th._columnCount)
+        {
+            _badColumn = std::min(_badColumn, _th._columnCount);
+            _bad = true;
+            return;
+        }
+        if (quotes and e - b >= 2 and *b == '"' and e[-1] == '"') // "" in a quoted field is "
+        {
+            _unquoted.clear();
+            for (auto p = b + 1; p < e - 1; p++)
+            {
+                _unquoted.push_back(*p);
+                p += *p == '"' and p[1] == '"';
+            }
+            b = _unquoted.data(), e = b + _unquoted.size();
+        }
+        else if (not _csv and std::find(b, e, '\\') != e) // escapes of TSV
+        {
+            _unquoted.clear();
+            for (auto p = b; p < e; p++)
+            {
+                if (*p == '\\' and p + 1 < e)
+                {
+                    p++;
+                    _unquoted.push_back(*p == 't' ? '\t' : *p == 'n' ? '\n' : *p == 'r' ? '\r' : *p);
+                }
+                else
+                    _unquoted.push_back(*p);
+            }
+            b = _unquoted.data(), e = b + _unquoted.size();
+        }
+        auto &c = _th._columns[_col];
+        if (not put(b, e, c, _batch.data() + size_t(_n) * _th._recordSize + c._offset))
+        {
+            _badColumn = std::min(_badColumn, _col);
+            _bad = true;
+        }
+    }
+
+  public:
+    Stats _stats{};
+
+    Parser(RecordMgr::RecordManager &rm, char delim, bool csv)
+        : _rm(rm), _th(rm.getTableHeader()), _delim(delim), _csv(csv), _batch(size_t(IMPORTBATCH) * _th._recordSize)
+    {
+    }
+
+    ~Parser()
+    {
+        flush();
+    }
+
+    void flush()
+    {
+        if (_n)
+            _rm.insertRecords(_batch.data(), _n);
+        _stats._rows += _n;
+        _n = 0;
+    }
+
+    /**
+     * @param offset byte offset of begin in the file, for errors
+     */
+    void parse(const char *begin, const char *end, uint64_t offset)
+    {
+        const char *field = begin, *line = begin;
+        bool quoted = false, quotes = false;
+        _col = 0, _bad = false, _badColumn = UINT32_MAX; // a chunk starts a line
+        auto endLine = [&](const char *e) {
+            if (e > field and e[-1] == '\r')
+                e--;
+            if (_col == 0 and e == field) // an empty line
+                return;
+            endField(field, e, quotes);
+            if (_bad or _col + 1 != _th._columnCount)
+            {
+                auto at = offset + (line - begin); // chunks may come out of order
+                if (_stats._errors++ == 0 or at < _stats._errorOffset)
+                {
+                    _stats._errorOffset = at;
+                    _stats._errorColumn = _bad ? _badColumn : _th._columnCount;
+                }
+            }
+            else if (++_n == IMPORTBATCH)
+                flush();
+            _col = 0, _bad = false, _badColumn = UINT32_MAX;
+        };
+        for (auto p = begin; p < end; p += 64)
+        {
+            auto m = block(p, end, _delim);
+            auto bits = m._newline | m._delim | (_csv ? m._quote : 0);
+            for (; bits; bits &= bits - 1)
+            {
+                auto pos = p + __builtin_ctzll(bits);
+                if (*pos == '"' and _csv)
+                {
+                    quoted = not quoted, quotes = true;
+                    continue;
+                }
+                if (quoted)
+                    continue;
+                if (*pos == '\n')
+                    endLine(pos), line = pos + 1;
+                else
+                {
+                    endField(field, pos, quotes);
+                    _col++;
+                }
+                field = pos + 1, quotes = false;
+            }
+        }
+        if (field < end or _col != 0) // the last line has no line end, its last field may be empty
+            endLine(end);
+    }
+};
+
+void merge(Stats &to, const Stats &from)
+{
+    if (from._errors and (to._errors == 0 or from._errorOffset < to._errorOffset))
+        to._errorOffset = from._errorOffset, to._errorColumn = from._errorColumn;
+    to._rows += from._rows;
+    to._errors += from._errors;
+}
+
+/**
+ * @brief import from a file which could not be mapped, such as a pipe, a chunk at a time by this thread
+ */
+Stats importStream(int fd, RecordMgr::RecordManager &rm, const Options &opt)
+{
+    Stats st{};
+    uint32_t recordSize = rm.getTableHeader()._recordSize;
+    bool csv = opt._format == Format::CSV, header = opt._header;
+    Parser parser(rm, csv ? ',' : '\t', csv);
+    std::vector<char> buf;
+    size_t used = 0;
+    uint64_t offset = 0; // of buf in the stream
+    bool eof = false;
+    while (not eof or used)
+    {
+        buf.resize(std::max<size_t>(buf.size(), used + IMPORTCHUNK));
+        while (not eof and used < buf.size())
+        {
+            auto n = read(fd, buf.data() + used, buf.size() - used);
+            eof = n <= 0;
+            used += std::max<ssize_t>(n, 0);
+            st._bytes += std::max<ssize_t>(n, 0);
+        }
+        const char *begin = buf.data(), *end = begin + used, *cut = end;
+        if (opt._format == Format::BINARY)
+        {
+            cut = begin + used / recordSize * recordSize;
+            for (auto p = begin; p < cut; p += size_t(IMPORTBATCH) * recordSize)
+            {
+                uint32_t n = std::min<size_t>(IMPORTBATCH, (cut - p) / recordSize);
+                rm.insertRecords(p, n);
+                st._rows += n;
+            }
+            if (eof and cut != end and st._errors++ == 0) // a partial record at the end
+            {
+                st._errorOffset = offset + (cut - buf.data());
+                st._errorColumn = rm.getTableHeader()._columnCount;
+            }
+            cut = eof ? end : cut;
+        }
+        else
+        {
+            bool quoted = false;
+            if (header and (begin = lineEnd(begin, end, csv, quoted)) == nullptr) // the header is not complete
+            {
+                if (not eof)
+                    continue;
+                break;
+            }
+            header = false;
+            if (not eof) // up to the last line end out of quotes
+            {
+                cut = begin;
+                for (const char *next; (next = lineEnd(cut, end, csv, quoted));)
+                    cut = next;
+            }
+            parser.parse(begin, cut, offset + (begin - buf.data()));
+        }
+        offset += cut - buf.data();
+        memmove(buf.data(), cut, end - cut);
+        used = end - cut;
+        if (eof)
+            used = 0;
+    }
+    parser.flush();
+    merge(st, parser._stats);
+    return st;
+}
+
+} // namespace
+
+Stats importFile(std::string_view path, RecordMgr::RecordManager &rm, const Options &opt)
+{
+    int fd = open(std::string(path).c_str(), O_RDONLY);
+    assert(fd != -1);
+    struct stat sb;
+    fstat(fd, &sb);
+    if (not S_ISREG(sb.st_mode) or sb.st_size == 0)
+    {
+        auto st = importStream(fd, rm, opt);
+        close(fd);
+        return st;
+    }
+    auto data = static_cast<const char *>(mmap(nullptr, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0));
+    assert(data != MAP_FAILED);
+    madvise(const_cast<char *>(data), sb.st_size, MADV_SEQUENTIAL);
+    const char *begin = data, *end = data + sb.st_size;
+    uint32_t threads = opt._threads ? opt._threads : std::max(1u, std::thread::hardware_concurrency());
+    Stats st{};
+    st._bytes = sb.st_size;
+
+    if (opt._format == Format::BINARY)
+    {
+        uint64_t recordSize = rm.getTableHeader()._recordSize, records = sb.st_size / recordSize;
+        uint64_t perChunk = std::max<uint64_t>(IMPORTBATCH, IMPORTCHUNK / recordSize / IMPORTBATCH * IMPORTBATCH);
+        std::vector<Stats> stats(threads);
+        parallel((records + perChunk - 1) / perChunk, threads, [&](uint32_t t, uint32_t i) {
+            for (uint64_t r = i * perChunk; r < std::min(records, (i + 1) * perChunk); r += IMPORTBATCH)
+            {
+                uint32_t n = std::min<uint64_t>(IMPORTBATCH, records - r);
+                rm.insertRecords(begin + r * recordSize, n);
+                stats[t]._rows += n;
+            }
+        });
+        for (auto &&s : stats)
+            merge(st, s);
+        if (sb.st_size % recordSize != 0 and st._errors++ == 0) // a partial record at the end
+        {
+            st._errorOffset = records * recordSize;
+            st._errorColumn = rm.getTableHeader()._columnCount;
+        }
+    }
+    else
+    {
+        bool csv = opt._format == Format::CSV, quoted = false;
+        if (opt._header)
+        {
+            begin = lineEnd(begin, end, csv, quoted);
+            begin = begin ? begin : end;
+        }
+        auto chunks = cut(begin, end, csv, IMPORTCHUNK, threads);
+        std::vector<std::unique_ptr<Parser>> parsers(threads);
+        parallel(chunks.size(), threads, [&](uint32_t t, uint32_t i) {
+            if (not parsers[t])
+                parsers[t] = std::make_unique<Parser>(rm, csv ? ',' : '\t', csv);
+            parsers[t]->parse(chunks[i]._begin, chunks[i]._end, chunks[i]._begin - data);
+        });
+        for (auto &&p : parsers)
+        {
+            if (p)
+            {
+                p->flush();
+                merge(st, p->_stats);
+            }
+        }
+    }
+    munmap(const_cast<char *>(data), sb.st_size);
+    close(fd);
+    return st;
+}
+
+} // namespace Import
@@ -0,0 +1,175 @@
+#include "memfile.h"
+#include <cassert>
+#include <cstring>
+#include <sys/mman.h>
+
+namespace PagedFile
+{
+
+std::mutex MemoryFile::_frameMutex;
+uint8_t *MemoryFile::_arena = nullptr;
+uint32_t MemoryFile::_end = 0;
+std::vector<uint32_t> MemoryFile::_freeFrames;
+uint64_t MemoryFile::_budget = MEMBUDGET;
+std::string MemoryFile::_spillDir = ".";
+
+robin_hood::unordered_map<std::string, MemoryFile *> &MemoryFile::names()
+{
+    static auto names = new robin_hood::unordered_map<std::string, MemoryFile *>;
+    return *names;
+}
+
+std::atomic<MemoryFile *> *MemoryFile::files()
+{
+    static auto files = new std::atomic<MemoryFile *>[MEMMAXFILES] {};
+    return files;
+}
+
+uint32_t MemoryFile::allocFrame()
+{
+    std::lock_guard<std::mutex> lk(_frameMutex);
+    if (uint64_t(_end - _freeFrames.size() + 1) * PAGESIZE > _budget)
+        return UINT32_MAX;
+    if (not _freeFrames.empty())
+    {
+        auto f = _freeFrames.back();
+        _freeFrames.pop_back();
+        return f;
+    }
+    if (_arena == nullptr)
+    {
+        // address space only, memory is committed when a frame is first written
+        auto p = mmap(nullptr, MEMARENA, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        assert(p != MAP_FAILED);
+        _arena = static_cast<uint8_t *>(p);
+    }
+    if (uint64_t(_end + 1) * PAGESIZE > MEMARENA)
+        return UINT32_MAX;
+    return _end++;
+}
+
+void MemoryFile::setBudget(uint64_t bytes)
+{
+    std::lock_guard<std::mutex> lk(_frameMutex);
+    _budget = bytes;
+}
+
+uint64_t MemoryFile::used()
+{
+    std::lock_guard<std::mutex> lk(_frameMutex);
+    return uint64_t(_end - _freeFrames.size()) * PAGESIZE;
+}
+
+MemoryFile::~MemoryFile()
+{
+    {
+        std::lock_guard<std::mutex> lk(_frameMutex);
+        for (auto &&x : _pages)
+        {
+            if (x and not(x & SPILLED))
+                _freeFrames.push_back(x - 1);
+        }
+    }
+    if (_spillFd != -1)
+        close(_spillFd);
+}
+
+MemoryFile *MemoryFile::find(std::string_view path)
+{
+    if (not isMemory(path))
+        return nullptr;
+    auto pos = names().find(std::string(path.substr(MEMPREFIX.size())));
+    return pos == names().end() ? nullptr : pos->second;
+}
+
+MemoryFile *MemoryFile::create(std::string_view path)
+{
+    assert(isMemory(path) and find(path) == nullptr);
+    uint32_t index = 0;
+    while (index < MEMMAXFILES and files()[index].load(std::memory_order_relaxed))
+        index++;
+    assert(index < MEMMAXFILES);
+    auto mf = new MemoryFile(path.substr(MEMPREFIX.size()), index);
+    names()[mf->_name] = mf;
+    files()[index].store(mf, std::memory_order_release);
+    return mf;
+}
+
+void MemoryFile::drop(std::string_view path)
+{
+    auto mf = find(path);
+    assert(mf);
+    names().erase(mf->_name);
+    files()[mf->_index].store(nullptr, std::memory_order_release);
+    delete mf;
+}
+
+uint32_t MemoryFile::place(uint32_t pageNum)
+{
+    if (pageNum >= _pages.size())
+        _pages.resize(pageNum + 1, 0);
+    auto f = allocFrame();
+    if (f != UINT32_MAX)
+        return _pages[pageNum] = f + 1;
+    if (_spillFd == -1)
+    {
+        auto tmpl = _spillDir + "/sqlight-spill-XXXXXX";
+        _spillFd = mkstemp(tmpl.data());
+        assert(_spillFd != -1);
+        unlink(tmpl.c_str()); // removed when it is closed
+    }
+    return _pages[pageNum] = SPILLED | _spillPages++;
+}
+
+ssize_t MemoryFile::read(uint32_t pageNum, const struct iovec *iov, int n)
+{
+    std::vector<std::pair<int, uint32_t>> spilled; // index in iov and page in the spill file
+    {
+        std::lock_guard<std::mutex> lk(_mutex);
+        for (int i = 0; i < n; i++)
+        {
+            auto x = pageNum + i < _pages.size() ? _pages[pageNum + i] : 0;
+            if (x == 0)
+                memset(iov[i].iov_base, 0, PAGESIZE);
+            else if (x & SPILLED)
+                spilled.emplace_back(i, x & ~SPILLED);
+            else
+                memcpy(iov[i].iov_base, frame(x - 1), PAGESIZE);
+        }
+    }
+    for (auto &&[i, at] : spilled)
+    {
+        auto nread = pread(_spillFd, iov[i].iov_base, PAGESIZE, off_t(at) * PAGESIZE);
+        assert(nread == PAGESIZE);
+    }
+    return ssize_t(n) * PAGESIZE;
+}
+
+ssize_t MemoryFile::write(uint32_t pageNum, const void *data)
+{
+    uint32_t x;
+    {
+        std::lock_guard<std::mutex> lk(_mutex);
+        x = pageNum < _pages.size() and _pages[pageNum] ? _pages[pageNum] : place(pageNum);
+        if (not(x & SPILLED))
+        {
+            memcpy(frame(x - 1), data, PAGESIZE);
+            return PAGESIZE;
+        }
+    }
+    return pwrite(_spillFd, data, PAGESIZE, off_t(x & ~SPILLED) * PAGESIZE);
+}
+
+uint32_t MemoryFile::pages()
+{
+    std::lock_guard<std::mutex> lk(_mutex);
+    return _pages.size();
+}
+
+uint32_t MemoryFile::spilled()
+{
+    std::lock_guard<std::mutex> lk(_mutex);
+    return _spillPages;
+}
+
+} // namespace PagedFile
@@ -0,0 +1,459 @@
+#include "optimizer.h"
+#include "aggregate.h"
+#include "join.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <robin_hood.h>
+
+using namespace Optimizer;
+
+namespace
+{
+
+constexpr uint32_t STATSMAGIC = 0x53544154; // "STAT"
+
+constexpr uint32_t STATSPAGEBYTES = PAGESIZE - sizeof(PageHeader); // statistics bytes in a page, after its header
+
+constexpr uint32_t RESIDENCYSAMPLE = 256; // pages looked up in the pool by residency
+
+struct StatsHeader
+{
+    uint32_t _magic;
+    uint32_t _size; // sizeof(TableStats) when it was saved
+};
+
+std::string statsPath(std::string_view table)
+{
+    return std::string(table) + STATSSUFFIX;
+}
+
+/**
+ * @brief data pages of a table, zone pages are skipped
+ */
+std::vector<uint32_t> dataPages(const RecordMgr::RecordManager &rm)
+{
+    std::vector<uint32_t> pages;
+    for (auto p = rm.firstDataPage(); p <= rm.getTableHeader()._existsPageNum; p++)
+    {
+        if (not rm.isZonePage(p))
+            pages.push_back(p);
+    }
+    return pages;
+}
+
+/**
+ * @brief normalized key of a value of integer column c, a value out of range of the column is clamped
+ */
+uint64_t keyOf(const Column &c, int64_t value)
+{
+    uint8_t v[sizeof(int64_t)];
+    auto [lo, hi] = Exec::intRange(c._type);
+    value = std::clamp(value, lo, hi);
+    if (c._type == ColumnType::INT32)
+    {
+        auto i = static_cast<int32_t>(value);
+        memcpy(v, &i, sizeof(i));
+    }
+    else
+        memcpy(v, &value, sizeof(value));
+    return normalizeKey(v, c);
+}
+
+/**
+ * @brief normalized key of a value of FLOAT64 column c
+ */
+uint64_t keyOf(const Column &c, double value)
+{
+    assert(c._type == ColumnType::FLOAT64);
+    uint8_t v[sizeof(double)];
+    memcpy(v, &value, sizeof(value));
+    return normalizeKey(v, c);
+}
+
+/**
+ * @brief cost of reading a page, a cached page is cheap
+ */
+double pageCost(double residency, bool sequential)
+{
+    return residency * CACHEDPAGECOST + (1 - residency) * (sequential ? SEQPAGECOST : RANDPAGECOST);
+}
+
+} // namespace
+
+double HyperLogLog::estimate() const
+{
+    constexpr double m = 1 << HLLBITS;
+    double sum = 0;
+    uint32_t zeros = 0;
+    for (auto r : _registers)
+    {
+        sum += std::ldexp(1.0, -r);
+        zeros += r == 0;
+    }
+    auto e = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+    if (e <= 2.5 * m and zeros != 0) // linear counting for small cardinalities
+        e = m * std::log(m / zeros);
+    return e;
+}
+
+double ColumnStats::cdf(uint64_t key) const
+{
+    if (_buckets == 0 or key < _bounds[0])
+        return 0;
+    if (key >= _bounds[_buckets])
+        return 1;
+    auto i = std::upper_bound(_bounds + 1, _bounds + _buckets + 1, key) - _bounds; // bucket i - 1 has key
+    auto lo = _bounds[i - 1], hi = _bounds[i];
+    return (i - 1 + double(key - lo) / double(hi - lo)) / _buckets;
+}
+
+double ColumnStats::selectivity(Exec::CmpOp op, uint64_t key, bool exact) const
+{
+    if (_buckets == 0)
+        return 0;
+    auto below = [&] { return key == 0 ? 0 : cdf(exact ? key - 1 : key); }; // rows < key
+    double eq = 0;
+    if (key >= _bounds[0] and key <= _bounds[_buckets])
+    {
+        // a frequent value fills buckets between bounds which are all the value
+        auto run = std::count(_bounds, _bounds + _buckets + 1, key);
+        eq = std::max(1.0 / std::max<uint64_t>(_distinct, 1), double(std::max<long>(run - 1, 0)) / _buckets);
+    }
+    switch (op)
+    {
+    case Exec::CmpOp::EQ:
+        return eq;
+    case Exec::CmpOp::NE:
+        return 1 - eq;
+    case Exec::CmpOp::LT:
+        return below();
+    case Exec::CmpOp::LE:
+        return exact ? cdf(key) : std::min(1.0, below() + eq);
+    case Exec::CmpOp::GT:
+        return 1 - (exact ? cdf(key) : std::min(1.0, below() + eq));
+    default:
+        return 1 - below();
+    }
+}
+
+TableStats Optimizer::analyze(const RecordMgr::RecordManager &rm, uint32_t samplePages)
+{
+    auto &th = rm.getTableHeader();
+    assert(th._columnCount != 0); // table without schema
+    TableStats s{};
+    s._rows = th._totalRecords;
+    s._columnCount = th._columnCount;
+
+    auto pages = dataPages(rm);
+    s._pages = pages.size();
+    if (pages.size() > samplePages)
+    {
+        // a random subset, read in order of pages
+        std::mt19937_64 rng(pages.size());
+        for (uint32_t i = 0; i < samplePages; i++)
+            std::swap(pages[i], pages[i + rng() % (pages.size() - i)]);
+        pages.resize(samplePages);
+        std::sort(pages.begin(), pages.end());
+    }
+    s._sampledPages = pages.size();
+
+    auto n = th._columnCount;
+    std::vector<HyperLogLog> hll(n);
+    std::vector<std::vector<uint64_t>> keys(n);
+    std::vector<std::vector<std::pair<uint64_t, uint64_t>>> ranges(n); // min and max of every sampled page
+    std::vector<uint64_t> empty(n);
+    std::unique_ptr<uint8_t, decltype(&std::free)> buf(static_cast<uint8_t *>(aligned_alloc(PAGESIZE, PAGESIZE)),
+                                                     &std::free);
+    for (auto p : pages)
+    {
+        auto first = s._sampledRows;
+        std::vector<std::pair<uint64_t, uint64_t>> range(n, {UINT64_MAX, 0});
+        Exec::scanPages(rm, p, p, buf.get(), [&](const uint8_t *record) {
+            for (uint32_t c = 0; c < n; c++)
+            {
+                auto &col = th._columns[c];
+                auto v = record + col._offset;
+                auto size = col._type == ColumnType::CHAR ? strnlen(reinterpret_cast<const char *>(v), col._size)
+                                                          : col._size;
+                empty[c] += col._type == ColumnType::CHAR and size == 0;
+                hll[c].add(robin_hood::hash_bytes(v, size));
+                auto k = normalizeKey(v, col);
+                keys[c].push_back(k);
+                range[c].first = std::min(range[c].first, k);
+                range[c].second = std::max(range[c].second, k);
+            }
+            s._sampledRows++;
+        });
+        if (s._sampledRows != first)
+        {
+            for (uint32_t c = 0; c < n; c++)
+                ranges[c].push_back(range[c]);
+        }
+    }
+
+    for (uint32_t c = 0; c < n; c++)
+    {
+        auto &cs = s._columns[c];
+        auto &k = keys[c];
+        if (k.empty())
+            continue;
+        std::sort(k.begin(), k.end());
+        cs._buckets = std::min<size_t>(STATSBUCKETS, k.size());
+        cs._bounds[0] = k.front();
+        for (uint32_t i = 1; i <= cs._buckets; i++)
+            cs._bounds[i] = k[(i * k.size() + cs._buckets - 1) / cs._buckets - 1];
+        cs._nullFraction = double(empty[c]) / k.size();
+
+        // values seen in a sample which are mostly unique are taken as unique in the table,
+        // otherwise the sample is taken to have seen all of them
+        auto d = std::min(hll[c].estimate(), double(k.size()));
+        if (d > 0.9 * k.size())
+            d = d * s._rows / k.size();
+        cs._distinct = std::max(1.0, std::round(d));
+
+        double spread = 0;
+        for (auto &&[lo, hi] : ranges[c])
+            spread += cs.cdf(hi) - (lo == 0 ? 0 : cs.cdf(lo - 1));
+        cs._pageSpread = spread / ranges[c].size();
+    }
+
+    return s;
+}
+
+void Optimizer::saveStats(std::string_view table, const TableStats &stats)
+{
+    auto path = statsPath(table);
+    if (PagedFile::FileManager::isFile(path).empty())
+        PagedFile::FileManager::createFile(path);
+    auto fd = PagedFile::FileManager::openFile(path);
+    auto pm = PagedFile::FileManager::poolOfFd(fd);
+    std::vector<uint8_t> bytes(sizeof(StatsHeader) + sizeof(TableStats));
+    StatsHeader h{STATSMAGIC, sizeof(TableStats)};
+    memcpy(bytes.data(), &h, sizeof(h));
+    memcpy(bytes.data() + sizeof(h), &stats, sizeof(stats));
+    for (uint32_t i = 0; i * STATSPAGEBYTES < bytes.size(); i++)
+    {
+        auto len = std::min<size_t>(STATSPAGEBYTES, bytes.size() - i * STATSPAGEBYTES);
+        memcpy(pm->newPage({fd, i})->_data + sizeof(PageHeader), bytes.data() + i * STATSPAGEBYTES, len);
+    }
+    PagedFile::FileManager::closeFile(fd, *pm);
+}
+
+bool Optimizer::loadStats(std::string_view table, TableStats &stats)
+{
+    auto path = statsPath(table);
+    if (PagedFile::FileManager::isFile(path).empty())
+        return false;
+    auto fd = PagedFile::FileManager::openFile(path);
+    auto pm = PagedFile::FileManager::poolOfFd(fd);
+    std::vector<uint8_t> bytes(ceil(sizeof(StatsHeader) + sizeof(TableStats), STATSPAGEBYTES) * STATSPAGEBYTES);
+    for (uint32_t i = 0; i * STATSPAGEBYTES < bytes.size(); i++)
+        memcpy(bytes.data() + i * STATSPAGEBYTES, pm->getPage({fd, i})->_data + sizeof(PageHeader), STATSPAGEBYTES);
+    PagedFile::FileManager::closeFile(fd, *pm);
+    StatsHeader h;
+    memcpy(&h, bytes.data(), sizeof(h));
+    if (h._magic != STATSMAGIC or h._size != sizeof(TableStats))
+        return false;
+    memcpy(&stats, bytes.data() + sizeof(h), sizeof(stats));
+    return true;
+}
+
+void Optimizer::dropStats(std::string_view table)
+{
+    auto path = statsPath(table);
+    if (not PagedFile::FileManager::isFile(path).empty())
+        PagedFile::FileManager::deleteFile(path);
+}
+
+double Optimizer::residency(const RecordMgr::RecordManager &rm)
+{
+    auto pages = dataPages(rm);
+    if (pages.empty())
+        return 1;
+    auto step = std::max<size_t>(1, pages.size() / RESIDENCYSAMPLE);
+    uint32_t cached = 0, looked = 0;
+    for (size_t i = 0; i < pages.size(); i += step, looked++)
+        cached += rm.getPageManager()->isInCache({rm.getFd(), pages[i]});
+    return double(cached) / looked;
+}
+
+namespace
+{
+
+/**
+ * @brief the cheapest access path of `column op key`
+ * @param match Match::ALL or Match::NONE if the predicate keeps all rows or none whatever the values are
+ */
+AccessPath choose(const RecordMgr::RecordManager &rm, const TableStats *stats, uint32_t col, Exec::CmpOp op,
+                  uint64_t key, Exec::Match match)
+{
+    auto &th = rm.getTableHeader();
+    auto &c = th._columns[col];
+    double rows = th._totalRecords;
+    double pages = th._existsPageNum + 1 - rm.firstDataPage();
+    if (rm.hasZoneMap())
+        pages -= std::ceil(pages / th._zoneSpan);
+    pages = std::max(pages, 0.0);
+
+    // a filter which keeps no row reads nothing
+    if (match == Exec::Match::NONE)
+        return {Access::FULLSCAN, 0, 0, 0};
+    // without statistics a predicate is taken to keep a third of rows, and pages to be unclustered
+    double selectivity = 1.0 / 3, spread = 1;
+    if (match == Exec::Match::ALL)
+        selectivity = 1;
+    else if (stats != nullptr and stats->_columns[col]._buckets != 0)
+    {
+        auto &cs = stats->_columns[col];
+        selectivity = cs.selectivity(op, key, c._type != ColumnType::FLOAT64);
+        spread = cs._pageSpread;
+    }
+    auto res = residency(rm);
+    AccessPath full{Access::FULLSCAN, rows * selectivity, pages, pages * pageCost(res, true) + rows * ROWCOST};
+    if (not rm.hasZoneMap() or not(th._zoneColumns & (1u << col)) or op == Exec::CmpOp::NE or
+        match == Exec::Match::ALL)
+        return full;
+
+    // a page is read if its range of values overlaps the predicate
+    auto fraction = selectivity == 0 ? 0 : std::min(1.0, selectivity + spread);
+    auto zonePages = std::ceil(pages / th._zoneSpan);
+    auto read = pages * fraction;
+    AccessPath zone{Access::ZONESCAN, rows * selectivity, read,
+                    zonePages * pageCost(res, true) + read * pageCost(res, fraction > 0.5) + rows * fraction * ROWCOST};
+    return zone._cost < full._cost ? zone : full;
+}
+
+/**
+ * @brief scan of `column op value` by the cheapest access path, value is int64_t or double
+ */
+template <typename T>
+Exec::OperatorPtr plan(const RecordMgr::RecordManager &rm, const TableStats *stats, uint32_t col, Exec::CmpOp op,
+                       T value, AccessPath *path)
+{
+    auto chosen = chooseAccess(rm, stats, col, op, value);
+    if (path)
+        *path = chosen;
+    auto scan = std::make_unique<Exec::ScanOp>(&rm);
+    if (chosen._access == Access::ZONESCAN)
+        scan->prune(col, op, value);
+    return std::make_unique<Exec::FilterOp>(std::move(scan), col, op, value);
+}
+
+} // namespace
+
+AccessPath Optimizer::chooseAccess(const RecordMgr::RecordManager &rm, const TableStats *stats, uint32_t col,
+                                   Exec::CmpOp op, double value)
+{
+    auto &th = rm.getTableHeader();
+    assert(col < th._columnCount);
+    auto &c = th._columns[col];
+    if (c._type == ColumnType::FLOAT64)
+        return choose(rm, stats, col, op, keyOf(c, value), Exec::Match::SOME);
+    auto [lo, hi] = Exec::intRange(c._type);
+    int64_t bound = 0;
+    auto match = Exec::intMatch(op, value, lo, hi, bound);
+    return choose(rm, stats, col, op, keyOf(c, bound), match);
+}
+
+AccessPath Optimizer::chooseAccess(const RecordMgr::RecordManager &rm, const TableStats *stats, uint32_t col,
+                                   Exec::CmpOp op, int64_t value)
+{
+    auto &th = rm.getTableHeader();
+    assert(col < th._columnCount);
+    auto &c = th._columns[col];
+    if (c._type == ColumnType::FLOAT64)
+        return chooseAccess(rm, stats, col, op, double(value));
+    auto [lo, hi] = Exec::intRange(c._type);
+    return choose(rm, stats, col, op, keyOf(c, value), Exec::intMatch(op, value, lo, hi));
+}
+
+Exec::OperatorPtr Optimizer::planScan(const RecordMgr::RecordManager &rm, const TableStats *stats, uint32_t col,
+                                      Exec::CmpOp op, double value, AccessPath *path)
+{
+    return plan(rm, stats, col, op, value, path);
+}
+
+Exec::OperatorPtr Optimizer::planScan(const RecordMgr::RecordManager &rm, const TableStats *stats, uint32_t col,
+                                      Exec::CmpOp op, int64_t value, AccessPath *path)
+{
+    return plan(rm, stats, col, op, value, path);
+}
+
+std::vector<uint32_t> Optimizer::joinOrder(const std::vector<Relation> &rels)
+{
+    std::vector<uint32_t> order;
+    if (rels.empty())
+        return order;
+    std::vector<bool> used(rels.size());
+    // start from the pair with the smallest result, then add the relation which keeps the result smallest
+    uint32_t a = 0, b = rels.size() > 1 ? 1 : 0;
+    for (uint32_t i = 0; i < rels.size(); i++)
+    {
+        for (uint32_t j = i + 1; j < rels.size(); j++)
+        {
+            if (joinEstimate(rels[i], rels[j])._rows < joinEstimate(rels[a], rels[b])._rows)
+                a = i, b = j;
+        }
+    }
+    if (rels[b]._rows < rels[a]._rows)
+        std::swap(a, b);
+    order.push_back(a);
+    used[a] = true;
+    auto result = rels[a];
+    if (b != a)
+    {
+        order.push_back(b);
+        used[b] = true;
+        result = joinEstimate(result, rels[b]);
+    }
+    while (order.size() < rels.size())
+    {
+        uint32_t best = -1;
+        for (uint32_t i = 0; i < rels.size(); i++)
+        {
+            if (not used[i] and (best == uint32_t(-1) or joinEstimate(result, rels[i])._rows <
+                                                             joinEstimate(result, rels[best])._rows))
+                best = i;
+        }
+        order.push_back(best);
+        used[best] = true;
+        result = joinEstimate(result, rels[best]);
+    }
+    return order;
+}
+
+Exec::OperatorPtr Optimizer::planJoin(std::vector<JoinInput> inputs, std::vector<uint32_t> *columns)
+{
+    assert(not inputs.empty());
+    std::vector<Relation> rels;
+    for (auto &&in : inputs)
+        rels.push_back(in._rel);
+    auto order = joinOrder(rels);
+    std::vector<uint32_t> first(inputs.size()); // first column of every input in the result
+    auto result = std::move(inputs[order[0]]._op);
+    auto key = inputs[order[0]]._key;
+    auto rel = inputs[order[0]]._rel;
+    for (size_t i = 1; i < order.size(); i++)
+    {
+        // output columns of a join are columns of its probe side then of its build side
+        auto &in = inputs[order[i]];
+        if (in._rel._rows < rel._rows)
+        {
+            first[order[i]] = result->schema().size();
+            result = std::make_unique<Exec::HashJoinOp>(std::move(in._op), in._key, std::move(result), key);
+        }
+        else
+        {
+            uint32_t width = in._op->schema().size();
+            for (size_t j = 0; j < i; j++)
+                first[order[j]] += width;
+            result = std::make_unique<Exec::HashJoinOp>(std::move(result), key, std::move(in._op), in._key);
+            key = in._key;
+        }
+        rel = joinEstimate(rel, in._rel);
+    }
+    if (columns)
+        *columns = std::move(first);
+    return result;
+}
@@ -1,17 +1,147 @@
 #include "pagedFile.h"
+#include <filesystem>
+#include <sys/syscall.h>
 
 robin_hood::unordered_map<std::string, int> PagedFile::FileManager::_path2fd;
 robin_hood::unordered_map<int, std::string> PagedFile::FileManager::_fd2path;
+robin_hood::unordered_map<std::string, PagedFile::PageManager *> PagedFile::FileManager::_path2pool;
+std::string PagedFile::FileManager::_tempDir = ".";
 
-static std::vector<std::unique_ptr<PagedFile::PageManager>> vec;
+namespace
+{
+
+constexpr int MPOLBIND = 2; // MPOL_BIND of mbind(2)
+
+constexpr unsigned MPOLMFMOVE = 1 << 1; // MPOL_MF_MOVE of mbind(2)
+
+constexpr std::string_view DEFAULTPOOL = "default";
+
+struct Pool
+{
+    std::string _name;
+    int _node;
+    bool _local; // preferred by threads on _node
+    std::unique_ptr<PagedFile::PageManager> _pm;
+};
+
+std::mutex poolMutex;
+std::vector<Pool> vec;                                          // pools, the default one is created on first use
+robin_hood::unordered_map<std::string, std::string> assignment; // path -> name of pool
+
+Pool *findPool(std::string_view name)
+{
+    for (auto &&p : vec)
+    {
+        if (p._name == name)
+            return &p;
+    }
+    return nullptr;
+}
+
+} // namespace
+
+bool PagedFile::bindToNode(void *addr, size_t len, int node)
+{
+    constexpr int BITS = 8 * sizeof(unsigned long);
+    if (node < 0 or node >= numaNodes())
+        return false;
+    std::vector<unsigned long> mask(node / BITS + 1, 0);
+    mask[node / BITS] = 1ul << (node % BITS);
+    return syscall(SYS_mbind, addr, len, MPOLBIND, mask.data(), mask.size() * BITS + 1, MPOLMFMOVE) == 0;
+}
+
+int PagedFile::currentNode()
+{
+    unsigned cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0)
+        return 0;
+    return node;
+}
+
+int PagedFile::numaNodes()
+{
+    static const int nodes = [] {
+        int n = 0;
+        std::error_code ec;
+        for (auto &&e : std::filesystem::directory_iterator("/sys/devices/system/node", ec))
+        {
+            auto name = e.path().filename().string();
+            n += name.size() > 4 and name.compare(0, 4, "node") == 0;
+        }
+        return std::max(n, 1);
+    }();
+    return nodes;
+}
 
 PagedFile::PageManager *PagedFile::getPageManager()
 {
-    if (vec.empty())
+    std::lock_guard<std::mutex> lk(poolMutex);
+    if (vec.size() > 1)
+    {
+        auto node = currentNode();
+        for (auto &&p : vec)
+        {
+            if (p._local and p._node == node)
+                return p._pm.get();
+        }
+    }
+    if (auto p = findPool(DEFAULTPOOL))
+        return p->_pm.get();
+    auto p = std::make_unique<PagedFile::PageManager>();
+    assert(p.get() != nullptr);
+    vec.push_back({std::string(DEFAULTPOOL), -1, false, move(p)});
+    return vec.back()._pm.get();
+}
+
+PagedFile::PageManager *PagedFile::createPool(std::string_view name, uint32_t capacity, int node, bool local)
+{
+    std::lock_guard<std::mutex> lk(poolMutex);
+    assert(findPool(name) == nullptr);
+    assert(node >= 0 or not local);
+    vec.push_back({std::string(name), node, local, std::make_unique<PageManager>(capacity, node)});
+    return vec.back()._pm.get();
+}
+
+PagedFile::PageManager *PagedFile::getPool(std::string_view name)
+{
+    std::lock_guard<std::mutex> lk(poolMutex);
+    auto p = findPool(name);
+    return p ? p->_pm.get() : nullptr;
+}
+
+void PagedFile::dropPool(std::string_view name)
+{
+    std::lock_guard<std::mutex> lk(poolMutex);
+    auto p = findPool(name);
+    assert(p);
+    p->_pm->flushAll(true);
+    FileManager::forgetPool(p->_pm.get());
+    vec.erase(vec.begin() + (p - vec.data()));
+    for (auto i = assignment.begin(); i != assignment.end();)
+        i = i->second == name ? assignment.erase(i) : std::next(i);
+}
+
+void PagedFile::assignPool(std::string_view path, std::string_view name)
+{
+    std::lock_guard<std::mutex> lk(poolMutex);
+    assert(findPool(name));
+    assignment[std::string(path)] = name;
+}
+
+PagedFile::PageManager *PagedFile::poolOf(std::string_view path)
+{
+    if (auto pm = FileManager::poolOfPath(FileManager::isFile(path)))
+        return pm;
+    return choosePool(path);
+}
+
+PagedFile::PageManager *PagedFile::choosePool(std::string_view path)
+{
     {
-        auto p = std::make_unique<PagedFile::PageManager>();
-        assert(p.get() != nullptr);
-        vec.emplace_back(move(p));
+        std::lock_guard<std::mutex> lk(poolMutex);
+        auto pos = assignment.find(std::string(path));
+        if (pos != assignment.end())
+            return findPool(pos->second)->_pm.get();
     }
-    return vec.front().get();
-}
\ No newline at end of file
+    return getPageManager();
+}
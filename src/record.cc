@@ -0,0 +1,3 @@
+#include "record.h"
+
+robin_hood::unordered_map<int, RecordMgr::RecordFileManager::OpenTable> RecordMgr::RecordFileManager::_tables;
@@ -0,0 +1,583 @@
+#include "server.h"
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace Server;
+
+namespace
+{
+
+constexpr uint32_t EPOLLEVENTS = 64; // events taken by one epoll_wait
+
+bool makeAddress(std::string_view path, sockaddr_un &addr)
+{
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        return false;
+    memcpy(addr.sun_path, path.data(), path.size());
+    return true;
+}
+
+/**
+ * @brief write all bytes to a socket, wait by poll when it is full
+ */
+bool writeAll(int fd, const uint8_t *data, size_t n)
+{
+    while (n != 0)
+    {
+        auto k = ::send(fd, data, n, MSG_NOSIGNAL);
+        if (k > 0)
+        {
+            data += k, n -= k;
+            continue;
+        }
+        if (k == -1 and errno == EINTR)
+            continue;
+        if (k == -1 and (errno == EAGAIN or errno == EWOULDBLOCK))
+        {
+            pollfd p{fd, POLLOUT, 0};
+            poll(&p, 1, -1);
+            continue;
+        }
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief write what a socket takes without waiting, written bytes are removed from out
+ * @return false if the connection is broken
+ */
+bool writeSome(int fd, std::vector<uint8_t> &out)
+{
+    size_t sent = 0;
+    while (sent < out.size())
+    {
+        auto k = ::send(fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+        if (k > 0)
+        {
+            sent += k;
+            continue;
+        }
+        if (k == -1 and errno == EINTR)
+            continue;
+        if (k == -1 and (errno == EAGAIN or errno == EWOULDBLOCK))
+            break;
+        return false;
+    }
+    out.erase(out.begin(), out.begin() + sent);
+    return true;
+}
+
+template <typename T> void append(std::vector<uint8_t> &buf, const T &v)
+{
+    auto p = reinterpret_cast<const uint8_t *>(&v);
+    buf.insert(buf.end(), p, p + sizeof(T));
+}
+
+/**
+ * @brief whether a rid is a record of the table, the latch of its pool must be held
+ */
+bool isRecord(const RecordMgr::RecordManager &rm, Rid r)
+{
+    auto &th = rm.getTableHeader();
+    if (r._page < rm.firstDataPage() or r._page > th._existsPageNum or rm.isZonePage(r._page) or
+        r._slot >= th._slotsPerPage)
+        return false;
+    return rm.isRecord(r);
+}
+
+} // namespace
+
+Server::Server::Server(std::string_view path, uint32_t threads, std::string_view pool)
+    : _path(path), _pool(pool), _threads(threads ? threads : std::max(1u, std::thread::hardware_concurrency()))
+{
+    sockaddr_un addr;
+    auto ok = makeAddress(_path, addr);
+    assert(ok);
+    unlink(_path.c_str());
+    _listen = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    assert(_listen != -1);
+    ok = bind(_listen, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0 and listen(_listen, SOMAXCONN) == 0;
+    assert(ok);
+    _epoll = epoll_create1(EPOLL_CLOEXEC);
+    _wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    assert(_epoll != -1 and _wake != -1);
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.ptr = this;
+    epoll_ctl(_epoll, EPOLL_CTL_ADD, _listen, &ev);
+    ev.data.ptr = &_wake;
+    epoll_ctl(_epoll, EPOLL_CTL_ADD, _wake, &ev);
+}
+
+Server::Server::~Server()
+{
+    ::close(_listen);
+    ::close(_epoll);
+    ::close(_wake);
+    unlink(_path.c_str());
+}
+
+void Server::Server::stop()
+{
+    uint64_t one = 1;
+    [[maybe_unused]] auto n = write(_wake, &one, sizeof(one));
+}
+
+void Server::Server::run()
+{
+    std::vector<std::thread> workers;
+    for (uint32_t i = 0; i < _threads; i++)
+        workers.emplace_back([this] { work(); });
+
+    epoll_event events[EPOLLEVENTS];
+    bool running = true;
+    while (running)
+    {
+        auto n = epoll_wait(_epoll, events, EPOLLEVENTS, -1);
+        for (int i = 0; i < n; i++)
+        {
+            if (events[i].data.ptr == this)
+                accept();
+            else if (events[i].data.ptr == &_wake)
+                running = false;
+            else
+            {
+                // the connection is disarmed by EPOLLONESHOT until its worker is done with it
+                std::lock_guard<std::mutex> lk(_queueMutex);
+                _queue.push_back(static_cast<Connection *>(events[i].data.ptr));
+                _queueCv.notify_one();
+            }
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(_queueMutex);
+        _stopping = true;
+        _queueCv.notify_all();
+    }
+    for (auto &&t : workers)
+        t.join();
+    uint64_t v;
+    [[maybe_unused]] auto k = read(_wake, &v, sizeof(v));
+    for (auto c : _connections)
+        release(c);
+    _connections.clear();
+    _queue.clear();
+    _stopping = false;
+}
+
+void Server::Server::accept()
+{
+    int fd;
+    while ((fd = accept4(_listen, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1)
+    {
+        auto c = new Connection;
+        c->_fd = fd;
+        {
+            std::lock_guard<std::mutex> lk(_queueMutex);
+            _connections.insert(c);
+        }
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        ev.data.ptr = c;
+        epoll_ctl(_epoll, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+
+void Server::Server::work()
+{
+    while (true)
+    {
+        Connection *c;
+        {
+            std::unique_lock<std::mutex> lk(_queueMutex);
+            _queueCv.wait(lk, [this] { return _stopping or not _queue.empty(); });
+            if (_stopping)
+                return;
+            c = _queue.front();
+            _queue.pop_front();
+        }
+        std::unique_lock<std::mutex> served(c->_mutex);
+        if (serve(*c))
+        {
+            // responses the socket has not taken are written when it has room, before more requests are read
+            epoll_event ev{};
+            ev.events = (c->_out.empty() ? EPOLLIN | EPOLLRDHUP : EPOLLOUT) | EPOLLONESHOT;
+            ev.data.ptr = c;
+            epoll_ctl(_epoll, EPOLL_CTL_MOD, c->_fd, &ev);
+            continue;
+        }
+        served.unlock();
+        {
+            std::lock_guard<std::mutex> lk(_queueMutex);
+            if (_stopping) // released with the other connections by run
+                continue;
+            _connections.erase(c);
+        }
+        release(c);
+    }
+}
+
+/**
+ * @brief read what a connection has sent, execute whole requests and write their responses in one go.
+ * Responses are written without waiting, those left in _out are written by the next call before anything is read.
+ * @return false if the connection should be closed
+ */
+bool Server::Server::serve(Connection &c)
+{
+    if (not c._out.empty())
+    {
+        if (not writeSome(c._fd, c._out))
+            return false;
+        if (not c._out.empty())
+            return true;
+        if (c._eof)
+            return false;
+    }
+
+    bool open = true;
+    for (size_t got = 0; got < SERVERBATCH;)
+    {
+        auto size = c._in.size();
+        c._in.resize(size + SERVERREAD);
+        auto n = read(c._fd, c._in.data() + size, SERVERREAD);
+        c._in.resize(size + std::max<ssize_t>(n, 0));
+        if (n > 0)
+        {
+            got += n;
+            continue;
+        }
+        if (n == -1 and errno == EINTR)
+            continue;
+        c._eof = n == 0;
+        open = n == -1 and (errno == EAGAIN or errno == EWOULDBLOCK);
+        break;
+    }
+
+    size_t pos = 0;
+    while (c._in.size() - pos >= sizeof(RequestHeader))
+    {
+        RequestHeader h;
+        memcpy(&h, c._in.data() + pos, sizeof(h));
+        if (h._length > MAXREQUEST)
+            return false;
+        if (c._in.size() - pos - sizeof(h) < h._length)
+            break;
+        execute(c, h, c._in.data() + pos + sizeof(h));
+        pos += sizeof(h) + h._length;
+    }
+    c._in.erase(c._in.begin(), c._in.begin() + pos);
+
+    if (not writeSome(c._fd, c._out))
+        return false;
+    if (c._in.capacity() > 2 * SERVERREAD and c._in.size() < SERVERREAD) // after a large request
+        c._in.shrink_to_fit();
+    return open or (c._eof and not c._out.empty()); // responses to a peer which has shut down writing are sent
+}
+
+void Server::Server::execute(Connection &c, const RequestHeader &h, const uint8_t *payload)
+{
+    auto start = c._out.size();
+    ResponseHeader r{0, h._id, Status::OK, {}};
+    append(c._out, r);
+    auto status = Status::OK;
+    auto rm = h._op == Op::PING or h._op == Op::OPEN ? nullptr : table(c, h._table);
+    WireRid w{};
+    if (h._length >= sizeof(w))
+        memcpy(&w, payload, sizeof(w));
+    auto rid = [&] { return Rid{rm->getFd(), w._page, w._slot}; };
+
+    if (h._op != Op::PING and h._op != Op::OPEN and rm == nullptr)
+        status = Status::BADREQUEST;
+    else
+    {
+        switch (h._op)
+        {
+        case Op::PING:
+            break;
+        case Op::OPEN: {
+            auto id = open(std::string_view(reinterpret_cast<const char *>(payload), h._length), status);
+            if (id == NOTABLE)
+                break;
+            c._tables.push_back(id);
+            std::lock_guard<std::mutex> lk(_tableMutex);
+            append(c._out, id);
+            append(c._out, _tables[id]._rm->getTableHeader()._recordSize);
+            break;
+        }
+        case Op::CLOSE: {
+            auto pos = std::find(c._tables.begin(), c._tables.end(), h._table);
+            c._tables.erase(pos);
+            close(h._table);
+            break;
+        }
+        case Op::COUNT:
+            append(c._out, uint64_t(rm->getTotalRecord()));
+            break;
+        case Op::GET: {
+            if (h._length != sizeof(w))
+            {
+                status = Status::BADREQUEST;
+                break;
+            }
+            std::lock_guard<std::recursive_mutex> lk(rm->getPageManager()->latch());
+            if (not isRecord(*rm, rid()))
+            {
+                status = Status::NOTFOUND;
+                break;
+            }
+            auto p = rm->getRecordPointer(rid());
+            c._out.insert(c._out.end(), p, p + rm->getTableHeader()._recordSize);
+            break;
+        }
+        case Op::INSERT: {
+            auto size = rm->getTableHeader()._recordSize;
+            if (h._length == 0 or h._length % size != 0)
+            {
+                status = Status::BADREQUEST;
+                break;
+            }
+            // a large request is inserted a batch at a time, so other requests on the table are not held up
+            auto n = h._length / size, batch = std::max(1u, INSERTBATCH / size);
+            ArenaScope scope;
+            auto rids = static_cast<Rid *>(scope.arena().allocate(sizeof(Rid) * std::min(n, batch), alignof(Rid)));
+            for (uint32_t done = 0; done < n; done += batch)
+            {
+                auto k = std::min(batch, n - done);
+                rm->insertRecords(payload + size_t(done) * size, k, rids);
+                for (uint32_t i = 0; i < k; i++)
+                    append(c._out, WireRid{rids[i]._page, rids[i]._slot});
+            }
+            break;
+        }
+        case Op::UPDATE:
+        case Op::DELETE: {
+            auto size = h._op == Op::UPDATE ? rm->getTableHeader()._recordSize : 0;
+            if (h._length != sizeof(w) + size)
+            {
+                status = Status::BADREQUEST;
+                break;
+            }
+            std::lock_guard<std::recursive_mutex> lk(rm->getPageManager()->latch());
+            if (not isRecord(*rm, rid()))
+                status = Status::NOTFOUND;
+            else if (h._op == Op::UPDATE)
+                rm->updateRecord(rid(), payload + sizeof(w));
+            else
+                rm->deleteRecord(rid());
+            break;
+        }
+        case Op::SCAN: {
+            uint32_t max;
+            if (h._length != sizeof(w) + sizeof(max))
+            {
+                status = Status::BADREQUEST;
+                break;
+            }
+            memcpy(&max, payload + sizeof(w), sizeof(max));
+            max = std::min(max, SCANMAX);
+            auto size = rm->getTableHeader()._recordSize;
+            std::lock_guard<std::recursive_mutex> lk(rm->getPageManager()->latch());
+            auto end = rm->cend();
+            auto it = w._page == 0 ? rm->cbegin() : RecordMgr::RecordManager::Iterator(rm, rid());
+            if (w._page != 0)
+            {
+                // continue after the last rid of the previous response, even if it was deleted since
+                auto &th = rm->getTableHeader();
+                if (w._page < rm->firstDataPage() or w._page > th._existsPageNum or rm->isZonePage(w._page) or
+                    w._slot >= th._slotsPerPage)
+                    it = end;
+                else
+                    ++it;
+            }
+            for (uint32_t n = 0; n < max and it != end; n++, ++it)
+            {
+                auto r = it.getRid();
+                append(c._out, WireRid{r._page, r._slot});
+                c._out.insert(c._out.end(), *it, *it + size);
+            }
+            break;
+        }
+        default:
+            status = Status::BADREQUEST;
+        }
+    }
+
+    if (status != Status::OK)
+        c._out.resize(start + sizeof(r));
+    r._status = status;
+    r._length = c._out.size() - start - sizeof(r);
+    memcpy(c._out.data() + start, &r, sizeof(r));
+}
+
+void Server::Server::release(Connection *c)
+{
+    for (auto t : c->_tables)
+        close(t);
+    ::close(c->_fd);
+    delete c;
+}
+
+/**
+ * @param status NOTFOUND if there is no such file, BADREQUEST if it is not a table
+ */
+uint32_t Server::Server::open(std::string_view path, Status &status)
+{
+    auto full = PagedFile::FileManager::isFile(std::string(path));
+    if (full.empty())
+    {
+        status = Status::NOTFOUND;
+        return NOTABLE;
+    }
+    std::lock_guard<std::mutex> lk(_tableMutex);
+    auto pos = _tableIds.find(full);
+    if (pos == _tableIds.end())
+    {
+        pos = _tableIds.emplace(full, _tables.size()).first;
+        _tables.push_back({full, nullptr, 0});
+    }
+    auto &t = _tables[pos->second];
+    if (t._refs == 0)
+    {
+        if (not _pool.empty())
+            PagedFile::assignPool(t._path, _pool);
+        if (not RecordMgr::RecordFileManager::isTable(t._path)) // a client may name any file
+        {
+            status = Status::BADREQUEST;
+            return NOTABLE;
+        }
+        t._rm = std::make_unique<RecordMgr::RecordManager>(RecordMgr::RecordFileManager::openTable(t._path));
+    }
+    t._refs++;
+    return pos->second;
+}
+
+void Server::Server::close(uint32_t table)
+{
+    std::lock_guard<std::mutex> lk(_tableMutex);
+    auto &t = _tables[table];
+    assert(t._refs != 0);
+    if (--t._refs == 0)
+    {
+        RecordMgr::RecordFileManager::closeTable(*t._rm);
+        t._rm.reset();
+    }
+}
+
+/**
+ * @return a table opened by the connection, nullptr if it has not opened it
+ */
+RecordMgr::RecordManager *Server::Server::table(Connection &c, uint32_t table)
+{
+    if (std::find(c._tables.begin(), c._tables.end(), table) == c._tables.end())
+        return nullptr;
+    std::lock_guard<std::mutex> lk(_tableMutex);
+    return _tables[table]._rm.get();
+}
+
+Server::Client::Client(std::string_view path)
+{
+    sockaddr_un addr;
+    if (not makeAddress(path, addr))
+        return;
+    _fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (_fd != -1 and connect(_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0)
+    {
+        ::close(_fd);
+        _fd = -1;
+    }
+}
+
+Server::Client::~Client()
+{
+    if (_fd != -1)
+        ::close(_fd);
+}
+
+uint32_t Server::Client::send(Op op, uint32_t table, const void *payload, uint32_t length)
+{
+    RequestHeader h{length, _nextId++, table, op, {}};
+    append(_out, h);
+    auto p = static_cast<const uint8_t *>(payload);
+    _out.insert(_out.end(), p, p + length);
+    return h._id;
+}
+
+bool Server::Client::flush()
+{
+    auto ok = writeAll(_fd, _out.data(), _out.size());
+    _out.clear();
+    return ok;
+}
+
+/**
+ * @brief read until bytes are buffered after _inPos
+ */
+bool Server::Client::fill(size_t bytes)
+{
+    if (_inPos != 0 and _in.size() - _inPos < bytes)
+    {
+        _in.erase(_in.begin(), _in.begin() + _inPos);
+        _inPos = 0;
+    }
+    while (_in.size() - _inPos < bytes)
+    {
+        auto size = _in.size();
+        _in.resize(size + std::max<size_t>(SERVERREAD, bytes));
+        auto n = read(_fd, _in.data() + size, _in.size() - size);
+        _in.resize(size + std::max<ssize_t>(n, 0));
+        if (n == 0 or (n == -1 and errno != EINTR))
+            return false;
+    }
+    return true;
+}
+
+bool Server::Client::receive(Response &r)
+{
+    if (not _out.empty() and not flush())
+        return false;
+    if (not fill(sizeof(ResponseHeader)))
+        return false;
+    memcpy(&r._header, _in.data() + _inPos, sizeof(ResponseHeader));
+    if (not fill(sizeof(ResponseHeader) + r._header._length))
+        return false;
+    auto p = _in.data() + _inPos + sizeof(ResponseHeader);
+    r._payload.assign(p, p + r._header._length);
+    _inPos += sizeof(ResponseHeader) + r._header._length;
+    return true;
+}
+
+Server::Status Server::Client::call(Op op, uint32_t table, const void *payload, uint32_t length, Response &r)
+{
+    auto id = send(op, table, payload, length);
+    while (receive(r))
+    {
+        if (r._header._id == id)
+            return r._header._status;
+    }
+    r._payload.clear();
+    return Status::NOTFOUND;
+}
+
+uint32_t Server::Client::open(std::string_view path, uint32_t *recordSize)
+{
+    Response r;
+    if (call(Op::OPEN, NOTABLE, path.data(), path.size(), r) != Status::OK)
+        return NOTABLE;
+    uint32_t table;
+    memcpy(&table, r._payload.data(), sizeof(table));
+    if (recordSize)
+        memcpy(recordSize, r._payload.data() + sizeof(table), sizeof(*recordSize));
+    return table;
+}
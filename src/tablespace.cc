@@ -0,0 +1,234 @@
+#include "tablespace.h"
+#include <cassert>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace PagedFile
+{
+
+robin_hood::unordered_map<std::string, Tablespace *> &Tablespace::spaces()
+{
+    static auto spaces = new robin_hood::unordered_map<std::string, Tablespace *>;
+    return *spaces;
+}
+
+std::vector<Tablespace *> &Tablespace::byIndex()
+{
+    static auto byIndex = new std::vector<Tablespace *>;
+    return *byIndex;
+}
+
+Tablespace::Tablespace(std::string_view path, int index) : _path(path), _fdBase(TSFDBASE + index * TSFDSPAN)
+{
+    _fd = ::open(_path.c_str(), O_RDWR | O_CREAT | O_DIRECT, S_IRUSR | S_IWUSR);
+    assert(_fd != -1);
+    _meta.reset(static_cast<uint8_t *>(aligned_alloc(PAGESIZE, EXTENTPAGES * PAGESIZE)));
+    assert(_meta);
+    auto n = pread(_fd, _meta.get(), EXTENTPAGES * PAGESIZE, 0);
+    if (n != EXTENTPAGES * PAGESIZE) // a new tablespace
+    {
+        memset(_meta.get(), 0, EXTENTPAGES * PAGESIZE);
+        *header() = {TSMAGIC, 1, 0};
+        auto err = fallocate(_fd, 0, 0, off_t(EXTENTPAGES) * PAGESIZE);
+        assert(err == 0);
+        n = pwrite(_fd, _meta.get(), EXTENTPAGES * PAGESIZE, 0);
+        assert(n == EXTENTPAGES * PAGESIZE);
+        fdatasync(_fd);
+    }
+    assert(header()->_magic == TSMAGIC);
+    for (uint32_t i = 1; i < header()->_extents; i++)
+    {
+        auto e = extentEntry(i);
+        if (e->_table == 0)
+        {
+            _free.insert(i);
+            continue;
+        }
+        auto &v = _extents[e->_table];
+        v.resize(std::max<size_t>(v.size(), e->_seq + 1));
+        v[e->_seq] = i;
+    }
+}
+
+Tablespace *Tablespace::open(std::string_view path, bool create)
+{
+    auto full = realpath(std::string(path).c_str(), nullptr);
+    if (full == nullptr)
+    {
+        if (not create)
+            return nullptr;
+        int fd = ::open(std::string(path).c_str(), O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+        assert(fd != -1);
+        close(fd);
+        full = realpath(std::string(path).c_str(), nullptr);
+    }
+    std::string p(full);
+    free(full);
+    auto pos = spaces().find(p);
+    if (pos != spaces().end())
+        return pos->second;
+    assert(byIndex().size() < (MEMFDBASE - TSFDBASE) / TSFDSPAN);
+    auto ts = new Tablespace(p, byIndex().size());
+    byIndex().push_back(ts);
+    spaces()[p] = ts;
+    return ts;
+}
+
+uint32_t Tablespace::find(std::string_view name)
+{
+    std::lock_guard<std::mutex> lk(_mutex);
+    for (uint32_t id = 1; id <= TSMAXID; id++)
+    {
+        auto e = entry(id);
+        if (e->_id and name == e->_name)
+            return id;
+    }
+    return 0;
+}
+
+uint32_t Tablespace::create(std::string_view name)
+{
+    std::unique_lock<std::mutex> lk(_mutex);
+    assert(name.size() < sizeof(TableEntry::_name));
+    for (uint32_t id = 1; id <= TSMAXID; id++)
+    {
+        auto e = entry(id);
+        if (e->_id)
+            continue;
+        memset(e, 0, sizeof(TableEntry));
+        memcpy(e->_name, name.data(), name.size());
+        e->_id = id;
+        touch(e);
+        _extents[id].clear();
+        lk.unlock();
+        sync();
+        return id;
+    }
+    assert(false); // the directory is full
+    return 0;
+}
+
+void Tablespace::drop(uint32_t id)
+{
+    std::unique_lock<std::mutex> lk(_mutex);
+    for (auto &&x : _extents[id])
+    {
+        *extentEntry(x) = {0, 0};
+        touch(extentEntry(x));
+        _free.insert(x);
+    }
+    _extents.erase(id);
+    memset(entry(id), 0, sizeof(TableEntry));
+    touch(entry(id));
+    lk.unlock();
+    sync();
+}
+
+uint32_t Tablespace::allocExtent(uint32_t id)
+{
+    auto &v = _extents[id];
+    if (_free.empty())
+    {
+        auto h = header();
+        assert(h->_extents + TSGROWTH <= TSMAXEXTENTS);
+        auto err = fallocate(_fd, 0, off_t(h->_extents) * EXTENTPAGES * PAGESIZE,
+                             off_t(TSGROWTH) * EXTENTPAGES * PAGESIZE);
+        assert(err == 0);
+        for (uint32_t i = 0; i < TSGROWTH; i++)
+            _free.insert(h->_extents + i);
+        h->_extents += TSGROWTH;
+        touch(h);
+    }
+    auto pos = v.empty() ? _free.end() : _free.find(v.back() + 1);
+    if (pos == _free.end())
+        pos = _free.begin();
+    auto x = *pos;
+    _free.erase(pos);
+    *extentEntry(x) = {id, uint32_t(v.size())};
+    touch(extentEntry(x));
+    v.push_back(x);
+    entry(id)->_extents = v.size();
+    touch(entry(id));
+    return x;
+}
+
+ssize_t Tablespace::read(uint32_t id, uint32_t pageNum, const struct iovec *iov, int n)
+{
+    std::vector<off_t> at(n);
+    {
+        std::lock_guard<std::mutex> lk(_mutex);
+        for (int i = 0; i < n; i++)
+            at[i] = locate(id, pageNum + i);
+    }
+    for (int i = 0; i < n;)
+    {
+        if (at[i] == -1)
+        {
+            memset(iov[i].iov_base, 0, PAGESIZE);
+            i++;
+            continue;
+        }
+        int k = 1;
+        while (i + k < n and at[i + k] == at[i] + k)
+            k++;
+        auto nread = preadv(_fd, iov + i, k, at[i] * PAGESIZE);
+        assert(nread == ssize_t(k) * PAGESIZE);
+        i += k;
+    }
+    return ssize_t(n) * PAGESIZE;
+}
+
+ssize_t Tablespace::write(uint32_t id, uint32_t pageNum, const void *data)
+{
+    off_t at;
+    {
+        std::lock_guard<std::mutex> lk(_mutex);
+        auto &v = _extents[id];
+        while (pageNum / EXTENTPAGES >= v.size())
+            allocExtent(id);
+        auto e = entry(id);
+        if (pageNum >= e->_pages)
+        {
+            e->_pages = pageNum + 1;
+            touch(e);
+        }
+        at = off_t(v[pageNum / EXTENTPAGES]) * EXTENTPAGES + pageNum % EXTENTPAGES;
+    }
+    return pwrite(_fd, data, PAGESIZE, at * PAGESIZE);
+}
+
+void Tablespace::sync()
+{
+    {
+        std::lock_guard<std::mutex> lk(_mutex);
+        for (auto &&p : _dirtyMeta)
+        {
+            auto n = pwrite(_fd, _meta.get() + p * PAGESIZE, PAGESIZE, off_t(p) * PAGESIZE);
+            assert(n == PAGESIZE);
+        }
+        _dirtyMeta.clear();
+    }
+    fdatasync(_fd);
+}
+
+uint32_t Tablespace::pages(uint32_t id)
+{
+    std::lock_guard<std::mutex> lk(_mutex);
+    return entry(id)->_pages;
+}
+
+std::vector<uint32_t> Tablespace::extents(uint32_t id)
+{
+    std::lock_guard<std::mutex> lk(_mutex);
+    return _extents[id];
+}
+
+uint32_t Tablespace::size()
+{
+    std::lock_guard<std::mutex> lk(_mutex);
+    return header()->_extents;
+}
+
+} // namespace PagedFile
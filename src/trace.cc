@@ -0,0 +1,186 @@
+#include "trace.h"
+#include <cassert>
+#include <cstring>
+#include <fmt/format.h>
+#include <linux/perf_event.h>
+#include <mutex>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+namespace Trace
+{
+
+std::atomic<bool> active{false};
+std::atomic<uint64_t> epoch{0};
+std::atomic<uint64_t> startTime{0};
+std::atomic<bool> counters{false};
+
+namespace
+{
+
+std::mutex ringMutex;
+
+// rings outlive their threads, so events of a finished worker are dumped
+std::vector<std::unique_ptr<Ring>> &rings()
+{
+    static auto rings = new std::vector<std::unique_ptr<Ring>>;
+    return *rings;
+}
+
+// rings of threads which have exited, for threads which trace later
+std::vector<Ring *> &freeRings()
+{
+    static auto rings = new std::vector<Ring *>;
+    return *rings;
+}
+
+int openCounter(uint64_t config, int group)
+{
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+/**
+ * @brief counters of this thread, cycles is the leader of the group so both are read by one read
+ */
+void openCounters(Ring &r)
+{
+    for (auto fd : {r._missFd, r._counterFd})
+    {
+        if (fd != -1)
+            close(fd);
+    }
+    r._missFd = -1;
+    r._counterFd = openCounter(PERF_COUNT_HW_CPU_CYCLES, -1);
+    if (r._counterFd == -1) // not supported, or not permitted by perf_event_paranoid
+        return;
+    r._missFd = openCounter(PERF_COUNT_HW_CACHE_MISSES, r._counterFd);
+    if (r._missFd == -1)
+    {
+        close(r._counterFd);
+        r._counterFd = -1;
+    }
+}
+
+/**
+ * @brief gives the ring of a thread back when the thread exits, its counters belong to the thread
+ */
+struct Owner
+{
+    Ring *_ring = nullptr;
+
+    ~Owner()
+    {
+        if (_ring == nullptr)
+            return;
+        for (auto fd : {_ring->_missFd, _ring->_counterFd})
+        {
+            if (fd != -1)
+                close(fd);
+        }
+        _ring->_missFd = _ring->_counterFd = -1;
+        _ring->_counterEpoch = 0;
+        std::lock_guard<std::mutex> lk(ringMutex);
+        freeRings().push_back(_ring);
+    }
+};
+
+} // namespace
+
+Ring &ring()
+{
+    thread_local Owner mine;
+    if (mine._ring == nullptr)
+    {
+        std::lock_guard<std::mutex> lk(ringMutex);
+        if (freeRings().empty())
+        {
+            rings().push_back(std::make_unique<Ring>());
+            mine._ring = rings().back().get();
+        }
+        else
+        {
+            mine._ring = freeRings().back();
+            freeRings().pop_back();
+        }
+        mine._ring->_tid = syscall(SYS_gettid);
+    }
+    return *mine._ring;
+}
+
+size_t ringCount()
+{
+    std::lock_guard<std::mutex> lk(ringMutex);
+    return rings().size();
+}
+
+void readCounters(Ring &r, uint64_t &cycles, uint64_t &cacheMisses)
+{
+    cycles = cacheMisses = 0;
+    if (not counters.load(std::memory_order_relaxed))
+        return;
+    auto e = epoch.load(std::memory_order_relaxed);
+    if (r._counterEpoch != e)
+    {
+        r._counterEpoch = e;
+        openCounters(r);
+    }
+    uint64_t values[3]; // number of counters, then their values
+    if (r._counterFd == -1 or read(r._counterFd, values, sizeof(values)) != sizeof(values))
+        return;
+    cycles = values[1], cacheMisses = values[2];
+}
+
+void start(bool withCounters)
+{
+    counters.store(withCounters);
+    startTime.store(now());
+    epoch++;
+    active.store(true, std::memory_order_release);
+}
+
+void stop()
+{
+    active.store(false, std::memory_order_release);
+}
+
+uint64_t dump(std::string_view path)
+{
+    auto f = fopen(std::string(path).c_str(), "w");
+    assert(f);
+    auto pid = getpid();
+    uint64_t n = 0;
+    fmt::print(f, "{{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    std::lock_guard<std::mutex> lk(ringMutex);
+    for (auto &&r : rings())
+    {
+        auto head = r->_head.load(std::memory_order_acquire);
+        for (auto i = head > TRACEEVENTS ? head - TRACEEVENTS : 0; i < head; i++)
+        {
+            auto &e = r->_events[i % TRACEEVENTS];
+            if (e._begin < startTime.load())
+                continue;
+            fmt::print(f, "{}\n{{\"name\":\"{}\",\"cat\":\"sqlight\",\"ph\":\"X\",", n ? "," : "", e._name);
+            fmt::print(f, "\"ts\":{:.3f},\"dur\":{:.3f},\"pid\":{},\"tid\":{}", e._begin / 1e3, e._duration / 1e3, pid,
+                       e._tid);
+            if (counters.load())
+                fmt::print(f, ",\"args\":{{\"cycles\":{},\"cacheMisses\":{}}}", e._cycles, e._cacheMisses);
+            fmt::print(f, "}}");
+            n++;
+        }
+    }
+    fmt::print(f, "\n]}}\n");
+    fclose(f);
+    return n;
+}
+
+} // namespace Trace
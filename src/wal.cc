@@ -0,0 +1,487 @@
+#include "wal.h"
+#include "checksum.h"
+#include "pagedFile.h"
+#include <cstddef>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <thread>
+
+thread_local PagedFile::LogManager::OpState PagedFile::LogManager::_op;
+
+namespace PagedFile
+{
+
+// CRC32C of the record without _checksum
+uint32_t logChecksum(const LogRecord *r)
+{
+    auto p = reinterpret_cast<const uint8_t *>(r);
+    constexpr uint32_t off = offsetof(LogRecord, _checksum), end = off + sizeof(r->_checksum);
+    return crc32c(p + end, r->_size - end, crc32c(p, off));
+}
+
+LogManager::LogManager(std::string_view path)
+{
+    _fd = open(path.data(), O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    assert(_fd != -1);
+    LogFileHeader h{};
+    if (pread(_fd, &h, sizeof(h), 0) != sizeof(h)) // a new log
+    {
+        std::vector<uint8_t> page(LOGHEADERSIZE);
+        h = {LOGMAGIC, 0, LOGHEADERSIZE};
+        memcpy(page.data(), &h, sizeof(h));
+        auto n = pwrite(_fd, page.data(), LOGHEADERSIZE, 0);
+        assert(n == LOGHEADERSIZE);
+        fdatasync(_fd);
+    }
+    assert(h._magic == LOGMAGIC);
+    _base = h._base;
+    _start = h._start;
+    _nextLsn = findEnd();
+    auto r = ftruncate(_fd, _nextLsn - _base);
+    assert(r == 0);
+    _bufferLsn = _writingLsn = _flushedLsn = _nextLsn;
+    loadState();
+}
+
+LogManager::~LogManager()
+{
+    flush();
+    close(_fd);
+    _op = OpState();
+}
+
+// end of the last group whose records are all complete
+uint64_t LogManager::findEnd()
+{
+    struct stat st;
+    fstat(_fd, &st);
+    uint64_t lsn = firstLsn(), end = firstLsn();
+    walk(firstLsn(), _base + st.st_size, [&](const LogRecord &r) {
+        if (r._lsn != lsn or r._checksum != logChecksum(&r))
+            return false;
+        lsn += r._size;
+        if (r._flags & LOGEND)
+            end = lsn;
+        return true;
+    });
+    return end;
+}
+
+// transactions and files from the log
+void LogManager::loadState()
+{
+    uint64_t group = firstLsn();
+    walk(firstLsn(), _nextLsn, [&](const LogRecord &r) {
+        _maxTxn = std::max(_maxTxn, r._txn);
+        auto first = group;
+        if (r._flags & LOGEND)
+            group = r._lsn + r._size;
+        switch (r._type)
+        {
+        case LogType::INSERT:
+        case LogType::DELETE:
+        case LogType::UPDATE:
+        case LogType::CLR: {
+            auto &t = _active[r._txn];
+            t._first = t._first ? t._first : first;
+            t._last = r._lsn;
+            break;
+        }
+        case LogType::COMMIT:
+        case LogType::ABORT:
+            _active.erase(r._txn);
+            break;
+        case LogType::FILE: {
+            std::string path(reinterpret_cast<const char *>(r.image()), r._len);
+            _path2id[path] = r._fileId;
+            _id2path[r._fileId] = path;
+            _maxFileId = std::max(_maxFileId, r._fileId);
+            break;
+        }
+        case LogType::DROP: {
+            auto pos = _id2path.find(r._fileId);
+            if (pos != _id2path.end())
+            {
+                _path2id.erase(pos->second);
+                _id2path.erase(pos);
+            }
+            break;
+        }
+        case LogType::CHECKPOINT: {
+            CheckpointImage c;
+            memcpy(&c, r.image(), sizeof(c));
+            _maxTxn = std::max(_maxTxn, c._maxTxn);
+            break;
+        }
+        default:
+            break;
+        }
+        return true;
+    });
+}
+
+LogRecord *LogManager::pushRecord(std::vector<uint8_t> &buf, LogType type, uint32_t fileId, uint32_t len)
+{
+    assert(len <= UINT16_MAX);
+    auto off = buf.size();
+    auto size = (sizeof(LogRecord) + len + 7) / 8 * 8; // records are aligned to 8
+    buf.resize(off + size);
+    auto r = reinterpret_cast<LogRecord *>(buf.data() + off);
+    memset(r, 0, size);
+    r->_size = size;
+    r->_type = type;
+    r->_len = len;
+    r->_fileId = fileId;
+    r->_txn = _op._txn;
+    return r;
+}
+
+// _mutex must be held
+uint64_t LogManager::appendGroup(std::vector<uint8_t> &group)
+{
+    auto lsn = _nextLsn;
+    LogRecord *r = nullptr;
+    for (size_t off = 0; off < group.size(); off += r->_size)
+    {
+        r = reinterpret_cast<LogRecord *>(group.data() + off);
+        r->_lsn = lsn + off;
+        if (r->_txn == 0)
+            continue;
+        switch (r->_type)
+        {
+        case LogType::INSERT:
+        case LogType::DELETE:
+        case LogType::UPDATE:
+        case LogType::CLR: {
+            auto &t = _active[r->_txn];
+            r->_prevLsn = t._last;
+            t._first = t._first ? t._first : lsn;
+            t._last = r->_lsn;
+            break;
+        }
+        case LogType::COMMIT:
+        case LogType::ABORT:
+            r->_prevLsn = _active[r->_txn]._last;
+            _active.erase(r->_txn);
+            break;
+        default:
+            break;
+        }
+    }
+    r->_flags |= LOGEND;
+    for (size_t off = 0; off < group.size(); off += r->_size)
+    {
+        r = reinterpret_cast<LogRecord *>(group.data() + off);
+        r->_checksum = logChecksum(r);
+    }
+    _buffer.insert(_buffer.end(), group.begin(), group.end());
+    _nextLsn += group.size();
+    return lsn;
+}
+
+// _mutex must be held
+uint64_t LogManager::appendOne(LogType type, uint64_t txn, uint32_t fileId, const void *image, uint32_t len)
+{
+    std::vector<uint8_t> group;
+    auto r = pushRecord(group, type, fileId, len);
+    r->_txn = txn;
+    if (len)
+        memcpy(r + 1, image, len);
+    return appendGroup(group);
+}
+
+void LogManager::flush(uint64_t lsn)
+{
+    std::unique_lock<std::mutex> lk(_mutex);
+    lsn = std::min(lsn, _nextLsn - 1);
+    while (_flushedLsn <= lsn)
+    {
+        if (_flushing)
+        {
+            _cv.wait(lk);
+            continue;
+        }
+        _flushing = true;
+        if (_groupDelay.count() != 0)
+        {
+            lk.unlock();
+            std::this_thread::sleep_for(_groupDelay);
+            lk.lock();
+        }
+        std::swap(_buffer, _writing);
+        _writingLsn = _bufferLsn;
+        _bufferLsn = _nextLsn;
+        lk.unlock();
+        auto n = pwrite(_fd, _writing.data(), _writing.size(), _writingLsn - _base);
+        assert(n == ssize_t(_writing.size()));
+        fdatasync(_fd);
+        lk.lock();
+        _flushedLsn = _writingLsn + _writing.size();
+        _writing.clear();
+        _flushing = false;
+        _flushes++;
+        _cv.notify_all();
+    }
+}
+
+void LogManager::read(uint64_t lsn, std::vector<uint8_t> &buf)
+{
+    std::unique_lock<std::mutex> lk(_mutex);
+    assert(lsn >= firstLsn() and lsn < _nextLsn);
+    const std::vector<uint8_t> *mem = nullptr;
+    uint64_t memLsn = 0;
+    if (lsn >= _bufferLsn)
+        mem = &_buffer, memLsn = _bufferLsn;
+    else if (_flushing and lsn >= _writingLsn)
+        mem = &_writing, memLsn = _writingLsn;
+    if (mem)
+    {
+        auto p = mem->data() + (lsn - memLsn);
+        buf.assign(p, p + reinterpret_cast<const LogRecord *>(p)->_size);
+        return;
+    }
+    lk.unlock();
+    buf.resize(sizeof(LogRecord));
+    auto n = pread(_fd, buf.data(), sizeof(LogRecord), lsn - _base);
+    assert(n == sizeof(LogRecord));
+    buf.resize(reinterpret_cast<LogRecord *>(buf.data())->_size);
+    n = pread(_fd, buf.data() + sizeof(LogRecord), buf.size() - sizeof(LogRecord), lsn - _base + sizeof(LogRecord));
+    assert(n == ssize_t(buf.size() - sizeof(LogRecord)));
+    assert(reinterpret_cast<LogRecord *>(buf.data())->_lsn == lsn);
+}
+
+uint64_t LogManager::begin()
+{
+    assert(_op._txn == 0 and _op._depth == 0);
+    std::lock_guard<std::mutex> lk(_mutex);
+    _op._txn = ++_maxTxn;
+    _active[_op._txn] = {0, 0};
+    return _op._txn;
+}
+
+void LogManager::commit()
+{
+    if (_op._txn == 0)
+    {
+        flush();
+        return;
+    }
+    uint64_t lsn;
+    {
+        std::lock_guard<std::mutex> lk(_mutex);
+        lsn = appendOne(LogType::COMMIT, _op._txn, 0, nullptr, 0);
+    }
+    _op._txn = 0;
+    flush(lsn);
+}
+
+void LogManager::endAbort(uint64_t txn)
+{
+    {
+        std::lock_guard<std::mutex> lk(_mutex);
+        appendOne(LogType::ABORT, txn, 0, nullptr, 0);
+    }
+    if (_op._txn == txn)
+        _op._txn = 0;
+}
+
+uint64_t LogManager::lastLsn(uint64_t txn)
+{
+    std::lock_guard<std::mutex> lk(_mutex);
+    auto pos = _active.find(txn);
+    return pos == _active.end() ? 0 : pos->second._last;
+}
+
+std::vector<uint64_t> LogManager::activeTransactions()
+{
+    std::lock_guard<std::mutex> lk(_mutex);
+    std::vector<uint64_t> ans;
+    for (auto &&i : _active)
+        ans.push_back(i.first);
+    return ans;
+}
+
+uint64_t LogManager::firstActiveLsn()
+{
+    std::lock_guard<std::mutex> lk(_mutex);
+    auto ans = _nextLsn;
+    for (auto &&i : _active)
+    {
+        if (i.second._first)
+            ans = std::min(ans, i.second._first);
+    }
+    return ans;
+}
+
+void LogManager::beginUndo(uint64_t txn, uint64_t undoNext)
+{
+    assert(not _op._undoing);
+    std::swap(_op._txn, txn);
+    _op._undoing = true;
+    _op._undoNext = undoNext;
+    _op._savedTxn = txn;
+}
+
+void LogManager::endUndo()
+{
+    assert(_op._undoing);
+    _op._txn = _op._savedTxn;
+    _op._undoing = false;
+}
+
+void LogManager::beginOp()
+{
+    _op._depth++;
+}
+
+void LogManager::endOp()
+{
+    assert(_op._depth > 0);
+    if (--_op._depth == 0)
+        appendOp();
+}
+
+void LogManager::appendOp()
+{
+    if (_op._buf.empty())
+        return;
+    uint64_t lsn;
+    {
+        std::lock_guard<std::mutex> lk(_mutex);
+        lsn = appendGroup(_op._buf);
+    }
+    for (auto &&[p, off] : _op._pages)
+    {
+        reinterpret_cast<PageHeader *>(p->_data)->_lsn = lsn + off;
+        p->_lsn = lsn + off;
+        if (p->_recLsn == 0)
+            p->_recLsn = lsn + off;
+        p->_pending = false;
+    }
+    _op._buf.clear();
+    _op._pages.clear();
+}
+
+void LogManager::logPage(Page *p, uint32_t fileId, uint32_t offset, uint32_t len)
+{
+    assert(_op._depth > 0 and offset >= sizeof(PageHeader::_lsn) and offset + len <= PAGESIZE);
+    if (p->_recLsn == 0 and not p->_pending) // not logged since written back
+        offset = sizeof(PageHeader::_lsn), len = PAGESIZE - offset;
+    auto off = _op._buf.size();
+    auto r = pushRecord(_op._buf, LogType::PAGE, fileId, len);
+    r->_pageNum = p->_id.pageNum;
+    r->_offset = offset;
+    memcpy(r + 1, p->_data + offset, len);
+    p->_pending = true;
+    _op._pages.emplace_back(p, off);
+}
+
+void LogManager::logUndo(LogType type, uint32_t fileId, uint32_t pageNum, uint32_t slot, const void *before,
+                         uint32_t len)
+{
+    assert(_op._depth > 0);
+    if (_op._txn == 0)
+        return;
+    if (_op._undoing)
+        type = LogType::CLR, len = 0;
+    auto r = pushRecord(_op._buf, type, fileId, len);
+    r->_pageNum = pageNum;
+    r->_offset = slot;
+    if (_op._undoing)
+        r->_undoNext = _op._undoNext;
+    if (len)
+        memcpy(r + 1, before, len);
+}
+
+uint64_t LogManager::checkpoint(uint64_t redoLsn)
+{
+    uint64_t lsn, start = redoLsn;
+    {
+        std::lock_guard<std::mutex> lk(_mutex);
+        // files are logged again, as their records may be truncated
+        std::vector<uint8_t> group;
+        for (auto &&[id, path] : _id2path)
+        {
+            auto r = pushRecord(group, LogType::FILE, id, path.size());
+            r->_txn = 0;
+            memcpy(r + 1, path.data(), path.size());
+        }
+        CheckpointImage c{redoLsn, _maxTxn};
+        auto r = pushRecord(group, LogType::CHECKPOINT, 0, sizeof(c));
+        r->_txn = 0;
+        memcpy(r + 1, &c, sizeof(c));
+        lsn = appendGroup(group);
+        for (auto &&i : _active)
+        {
+            if (i.second._first)
+                start = std::min(start, i.second._first);
+        }
+    }
+    flush(lsn);
+    {
+        std::lock_guard<std::mutex> lk(_mutex); // a pin is either seen here or made after _start moves
+        if (not _pins.empty())
+            start = std::min(start, *_pins.begin());
+        if (start <= _start)
+            return lsn;
+        _start = start;
+    }
+    LogFileHeader h{LOGMAGIC, _base, start};
+    auto n = pwrite(_fd, &h, sizeof(h), 0);
+    assert(n == sizeof(h));
+    fdatasync(_fd);
+    // free space of truncated records, the log file keeps its size
+    auto hole = (start - _base) / PAGESIZE * PAGESIZE;
+    if (hole > LOGHEADERSIZE)
+        fallocate(_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, LOGHEADERSIZE, hole - LOGHEADERSIZE);
+    return lsn;
+}
+
+uint64_t LogManager::pin(uint64_t lsn)
+{
+    std::lock_guard<std::mutex> lk(_mutex);
+    lsn = std::max<uint64_t>(lsn, _start);
+    _pins.insert(lsn);
+    return lsn;
+}
+
+void LogManager::unpin(uint64_t lsn)
+{
+    std::lock_guard<std::mutex> lk(_mutex);
+    _pins.erase(_pins.find(lsn));
+}
+
+uint32_t LogManager::fileId(std::string_view path)
+{
+    std::lock_guard<std::mutex> lk(_mutex);
+    std::string p(path);
+    auto pos = _path2id.find(p);
+    if (pos != _path2id.end())
+        return pos->second;
+    auto id = ++_maxFileId;
+    _path2id[p] = id;
+    _id2path[id] = p;
+    appendOne(LogType::FILE, 0, id, p.data(), p.size());
+    return id;
+}
+
+std::string LogManager::pathOf(uint32_t fileId)
+{
+    std::lock_guard<std::mutex> lk(_mutex);
+    auto pos = _id2path.find(fileId);
+    return pos == _id2path.end() ? "" : pos->second;
+}
+
+void LogManager::dropFile(std::string_view path)
+{
+    std::lock_guard<std::mutex> lk(_mutex);
+    auto pos = _path2id.find(std::string(path));
+    if (pos == _path2id.end())
+        return;
+    auto id = pos->second;
+    _path2id.erase(pos);
+    _id2path.erase(id);
+    appendOne(LogType::DROP, 0, id, nullptr, 0);
+}
+
+} // namespace PagedFile